@@ -22,6 +22,7 @@
 //THIS ALL IS FOR THE CDROM REGISTERS HANDLING
 #include "PsxCommon.h"
 #include "CdRom.h"
+#include "profiler.h"
 
 // global variables
 cdrStruct cdr;
@@ -103,6 +104,11 @@ unsigned long CDR_fakeStatus();
 	psxRegs.intCycle[2+16+1] = eCycle; \
 	psxRegs.intCycle[2+16] = psxRegs.cycle; }
 
+#define CDRPLAY_INT(eCycle) { \
+	psxRegs.interrupt|= 0x100000; \
+	psxRegs.intCycle[2+18+1] = eCycle; \
+	psxRegs.intCycle[2+18] = psxRegs.cycle; }
+
 #define StartReading(type) { \
    	cdr.Reading = type; \
   	cdr.FirstSector = 1; \
@@ -122,6 +128,7 @@ unsigned long CDR_fakeStatus();
 		if (!Config.Cdda) CDRstop(); \
 		cdr.StatP&=~0x80; \
 		cdr.Play = 0; \
+		psxRegs.interrupt&=~0x100000; \
 	} \
 }
 
@@ -132,6 +139,7 @@ unsigned long CDR_fakeStatus();
 }
 
 void ReadTrack() {
+	PROFILE_SCOPE(PROF_CDROM);
 
 	cdr.Prev[0] = itob(cdr.SetSector[0]);
 	cdr.Prev[1] = itob(cdr.SetSector[1]);
@@ -644,6 +652,27 @@ void cdrReadInterrupt() {
 	psxHu32ref(0x1070)|= SWAP32((u32)0x4);
 }
 
+//while playing, one sector of cd audio goes to the spu every sector time, as it would come off a real drive
+void cdrPlayInterrupt() {
+	if (!cdr.Play) return;
+
+	const unsigned char *frame = CDRreadCDDA(cdr.CddaSector);
+	if (frame == NULL) { // ran off the end of the audio
+		StopCdda();
+		return;
+	}
+	if (cdr.Muted == 1)
+		SPUplayCDDAchannel((short*)frame, CD_FRAMESIZE_RAW);
+
+	cdr.CddaSector++;
+	if ((cdr.Mode & 0x2) && cdr.CddaSector >= CDRgetTrackEnd(cdr.CddaSector - 1)) { // autopause at the end of the track
+		StopCdda();
+		AddIrqQueue(CdlPause, 0x800);
+		return;
+	}
+	CDRPLAY_INT(cdReadTime);
+}
+
 /*
 cdrRead0:
 	bit 0 - 0 REG1 command send / 1 REG1 data read
@@ -737,6 +766,7 @@ void cdrWrite1(unsigned char rt) {
 
     	case CdlSetloc:
 			StopReading();
+			CDRcancelReadahead();
 			cdr.Seeked = 0;
         	for (i=0; i<3; i++) cdr.SetSector[i] = btoi(cdr.Param[i]);
         	cdr.SetSector[3] = 0;
@@ -748,24 +778,28 @@ void cdrWrite1(unsigned char rt) {
     		AddIrqQueue(cdr.Cmd, 0x800);
         	break;
 
-    	case CdlPlay:
+    	case CdlPlay: {
+			unsigned char msf[3] = { cdr.SetSector[0], cdr.SetSector[1], cdr.SetSector[2] };
         	if (!cdr.SetSector[0] & !cdr.SetSector[1] & !cdr.SetSector[2]) {
             	if (CDRgetTN(cdr.ResultTN) != -1) {
 	                if (cdr.CurTrack > cdr.ResultTN[1]) cdr.CurTrack = cdr.ResultTN[1];
                     if (CDRgetTD((unsigned char)(cdr.CurTrack), cdr.ResultTD) != -1) {
-		               	int tmp = cdr.ResultTD[2];
-                        cdr.ResultTD[2] = cdr.ResultTD[0];
-						cdr.ResultTD[0] = tmp;
-	                    if (!Config.Cdda) CDRplay(cdr.ResultTD);
+						// the start of the track, which CDRgetTD gives as minute and second in bytes 1 and 2
+						msf[0] = cdr.ResultTD[1];
+						msf[1] = cdr.ResultTD[2];
+						msf[2] = 0;
 					}
                 }
 			}
-    		else if (!Config.Cdda) CDRplay(cdr.SetSector);
+			cdr.CddaSector = MSF2SECT(msf[0], msf[1], msf[2]);
+			if (!Config.Cdda && CDRplay(msf) == 0)
+				CDRPLAY_INT(cdReadTime);
     		cdr.Play = 1;
 			cdr.Ctrl|= 0x80;
     		cdr.Stat = NoIntr; 
     		AddIrqQueue(cdr.Cmd, 0x800);
     		break;
+		}
 
     	case CdlForward:
         	if (cdr.CurTrack < 0xaa) cdr.CurTrack++;
@@ -886,6 +920,7 @@ void cdrWrite1(unsigned char rt) {
 
     	case CdlSeekL:
 //			((u32 *)cdr.SetSectorSeek)[0] = ((u32 *)cdr.SetSector)[0];
+			CDRcancelReadahead();
 			cdr.Ctrl|= 0x80;
     		cdr.Stat = NoIntr; 
     		AddIrqQueue(cdr.Cmd, 0x800);
@@ -893,6 +928,7 @@ void cdrWrite1(unsigned char rt) {
 
     	case CdlSeekP:
 //        	((u32 *)cdr.SetSectorSeek)[0] = ((u32 *)cdr.SetSector)[0];
+			CDRcancelReadahead();
 			cdr.Ctrl|= 0x80;
     		cdr.Stat = NoIntr; 
     		AddIrqQueue(cdr.Cmd, 0x800);
@@ -73,7 +73,9 @@ struct cdrStruct{
 
 	int Seeked;
 
-	char Unused[4083];
+	int CddaSector; // the next sector of cd audio to play, while Play is set
+
+	char Unused[4079];
 };
 
 extern cdrStruct cdr;
@@ -81,6 +83,7 @@ extern cdrStruct cdr;
 void cdrReset();
 void cdrInterrupt();
 void cdrReadInterrupt();
+void cdrPlayInterrupt();
 unsigned char cdrRead0(void);
 unsigned char cdrRead1(void);
 unsigned char cdrRead2(void);
@@ -3,7 +3,9 @@
 #include <malloc.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <algorithm>
+#include <emmintrin.h>
 #include "padwin.h"
 
 using std::min;
@@ -11,11 +13,18 @@ using std::max;
 
 
 
+// PSXJIN_LUAJIT (the Release LuaJIT configuration) builds against LuaJIT instead of Lua 5.1.4:
+// LuaJIT 2 goes in Win32/lua/luajit, built with "msvcbuild static" from its src directory.
+// The C API is the same, but lstate.h is stock Lua's own, and LuaJIT adds the psx table of FFI pointers (see PSXjin_LuaExportFFI).
 extern "C" {
 	#include <lua.h>
 	#include <lauxlib.h>
 	#include <lualib.h>
+#ifdef PSXJIN_LUAJIT
+	#include <luajit.h>
+#else
 	#include <lstate.h>
+#endif
 }
 
 #include "PsxCommon.h"
@@ -24,6 +33,11 @@ extern "C" {
 #include "Win32/resource.h"
 #endif
 #include "LuaEngine.h"
+#include "memsearch.h"
+#include "debugger.h"
+#include "cputrace.h"
+#include "profiler.h"
+#include "pcprofile.h"
 
 #ifndef TRUE
 #define TRUE 1
@@ -76,11 +90,17 @@ static int skipRerecords = FALSE;
 static const char *frameAdvanceThread = "PSXjin.FrameAdvance";
 static const char *memoryWatchTable = "PSXjin.Memory";
 static const char *memoryValueTable = "PSXjin.MemValues";
+static const char *breakpointTable = "PSXjin.Breakpoints";
 static const char *guiCallbackTable = "PSXjin.GUI";
 
 // True if there's a thread waiting to run after a run of frame-advance.
 static int frameAdvanceWaiting = FALSE;
 
+// What the waiting thread waits on: the frame boundaries to go by before it's resumed (emu.frameadvance(n)),
+// or a breakpoint of the debugger's in the middle of a frame (emu.runto, emu.runcycles)
+static int luaFramesToSkip;
+static int luaRunningTo;
+
 // Transparency strength. 255=opaque, 0=so transparent it's invisible
 static int transparencyModifier = 255;
 
@@ -93,12 +113,53 @@ static uint8 lua_analogjoy_used;
 static uint8 gui_enabled = TRUE;
 static enum { GUI_USED_SINCE_LAST_DISPLAY, GUI_USED_SINCE_LAST_FRAME, GUI_CLEAR } gui_used = GUI_CLEAR;
 static uint8 *gui_data = NULL;
+static int gui_data_width;
+
+// the parts of gui_data drawn on since it was last cleared, so that clearing and compositing only visit those.
+// gui_drawpixel_fast widens gui_drawn as it goes, and gui_prepare files it away as a dirty box at the next draw call.
+// boxes which overlap are merged, so that no pixel is blended twice.
+#define GUI_DIRTY_RECTS 16
+struct GuiRect { int x1, y1, x2, y2; }; // inclusive
+static GuiRect gui_dirty[GUI_DIRTY_RECTS];
+static int gui_dirty_count;
+static GuiRect gui_drawn = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
 
 // Protects Lua calls from going nuts.
 // We set this to a big number like 1000 and decrement it
 // over time. The script gets knifed once this reaches zero.
 static int numTries;
 
+#ifdef PSXJIN_LUAJIT
+// LuaJIT doesn't compile any traces while a count hook is set, so rather than being set for good
+// the watchdog's hook is only set by a timer (see LuaWatchdogTick) once a call into Lua has gone on for a while.
+static volatile DWORD luaCallStarted; // timeGetTime() when the running call into Lua began, 0 if none is running
+static volatile bool luaWatchdogOff;
+static HANDLE luaWatchdog;
+static int luaCallDepth;
+static void *luaExportedRam;
+#endif
+
+// around each call into the script, for the watchdog
+static void LuaCallBegin() {
+	numTries = 1000;
+	ProfileEnter(PROF_LUA);
+#ifdef PSXJIN_LUAJIT
+	if (luaCallDepth++ == 0)
+		luaCallStarted = timeGetTime() | 1;
+#endif
+}
+
+static void LuaCallEnd() {
+	ProfileLeave();
+#ifdef PSXJIN_LUAJIT
+	if (--luaCallDepth == 0) {
+		luaCallStarted = 0;
+		if (!luaWatchdogOff)
+			lua_sethook(LUA, NULL, 0, 0);
+	}
+#endif
+}
+
 // Look in pcsx.h for macros named like JOY_UP to determine the order.
 static const char *button_mappings[] = {
 	"select", "l3", "r3", "start", "up", "right", "down", "left",
@@ -132,8 +193,15 @@ static int usingMemoryRegister=0;
  * Resets emulator speed / pause states after script exit.
  * (Actually, PSXjin doesn't do any of these. They were very annoying.)
  */
+static void LuaRunToHit(int id, u32 address, int size, int type, void* param);
+static void LuaBreakpointHit(int id, u32 address, int size, int type, void* param);
 static void PSXjin_LuaOnStop() {
 	luaRunning = FALSE;
+	luaFramesToSkip = 0;
+	luaRunningTo = 0;
+	DebugBreakAtCycle(0, NULL);
+	DebugRemoveBreakpoints(LuaRunToHit);
+	DebugRemoveBreakpoints(LuaBreakpointHit);
 	lua_joypads_used = 0;
 	lua_analogjoy_used = 0;
 	gui_used = GUI_CLEAR;
@@ -213,8 +281,9 @@ void PSXjin_LuaWriteInform() {
 			lua_settable(LUA, 4);
 			lua_pop(LUA, 2);
 
-			numTries = 1000;
+			LuaCallBegin();
 			res = lua_pcall(LUA, 0, 0, 0);
+			LuaCallEnd();
 			if (res) {
 				const char *err = lua_tostring(LUA, -1);
 				
@@ -263,22 +332,111 @@ static int psxjin_speedmode(lua_State *L) {
 }
 
 
-// psxjin.frameadvance()
+// psxjin.frameadvance(int frames = 1)
 //
 //  Executes a frame advance. Occurs by yielding the coroutine, then re-running
-//  when we break out.
+//  when we break out. With frames > 1 the script sleeps through that many frame
+//  boundaries at once, and the joypads it set are held for all of them.
 static int psxjin_frameadvance(lua_State *L) {
+	int frames = luaL_optinteger(L, 1, 1);
+
 	// We're going to sleep for a frame-advance. Take notes.
 
 	if (frameAdvanceWaiting) 
 		return luaL_error(L, "can't call psxjin.frameadvance() from here");
 
 	frameAdvanceWaiting = TRUE;
+	luaFramesToSkip = max(frames, 1) - 1;
 
 	// Now we can yield to the main 
 	return lua_yield(L, 0);
 }
 
+// emu.runto(int pc)
+//
+//  Runs until the cpu is about to execute the instruction at pc (any mirror of it),
+//  and carries on with the script from there, in the middle of the frame.
+//  The delay slot of a branch isn't a place the cpu stops at.
+static int psxjin_runto(lua_State *L) {
+	uint32 pc = (uint32)luaL_checknumber(L, 1);
+
+	if (frameAdvanceWaiting) 
+		return luaL_error(L, "can't call psxjin.runto() from here");
+
+	frameAdvanceWaiting = TRUE;
+	luaRunningTo = 1;
+	DebugAddBreakpoint(BP_EXEC, pc, pc, LuaRunToHit);
+	return lua_yield(L, 0);
+}
+
+// emu.runcycles(int cycles)
+//
+//  Runs for the given number of cpu cycles (instructions, as the interpreter counts them)
+//  and carries on with the script from there, in the middle of the frame.
+static int psxjin_runcycles(lua_State *L) {
+	uint32 cycles = (uint32)luaL_checknumber(L, 1);
+
+	if (frameAdvanceWaiting) 
+		return luaL_error(L, "can't call psxjin.runcycles() from here");
+
+	frameAdvanceWaiting = TRUE;
+	luaRunningTo = 1;
+	DebugBreakAtCycle(psxRegs.cycle + cycles, LuaRunToHit);
+	return lua_yield(L, 0);
+}
+
+// bool emu.starttrace(string filename)
+//
+//  Records every instruction the cpu runs from here on into the file,
+//  until emu.stoptrace() (or the emulation stops). See cputrace.h.
+static int psxjin_starttrace(lua_State *L) {
+	lua_pushboolean(L, TraceStart(luaL_checkstring(L, 1)));
+	return 1;
+}
+
+// emu.stoptrace()
+static int psxjin_stoptrace(lua_State *L) {
+	TraceStop();
+	return 0;
+}
+
+// bool emu.profilestart([string filename])
+//
+//  Starts timing the subsystems (cpu, gte, gpu, vram, display, spu, mdec,
+//  cdrom, lua, idle) at the end of this frame, shows the times on the screen,
+//  and writes them for each frame to the file if one is given (CSV, or JSON if
+//  the name ends in .json).
+static int psxjin_profilestart(lua_State *L) {
+	lua_pushboolean(L, ProfileStart(luaL_optstring(L, 1, NULL)));
+	return 1;
+}
+
+// emu.profilestop()
+static int psxjin_profilestop(lua_State *L) {
+	ProfileStop();
+	return 0;
+}
+
+// table emu.profile()
+//
+//  Returns the milliseconds each subsystem took in the last frame, and the
+//  frame's in total, as {total=..., cpu=..., gte=..., ...}; nil if the profiler isn't on.
+static int psxjin_profile(lua_State *L) {
+	double ms[PROF_COUNT], total;
+	if (!ProfileLastFrame(ms, &total)) {
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_newtable(L);
+	lua_pushnumber(L, total);
+	lua_setfield(L, -2, "total");
+	for (int i = 0; i < PROF_COUNT; i++) {
+		lua_pushnumber(L, ms[i]);
+		lua_setfield(L, -2, profileNames[i]);
+	}
+	return 1;
+}
+
 
 // psxjin.pause()
 //
@@ -344,6 +502,7 @@ static void toCStringConverter(lua_State* L, int i, char*& ptr, int& remaining)
 		case LUA_TSTRING: APPENDPRINT "%s",lua_tostring(L,i) END break;
 		case LUA_TNUMBER: APPENDPRINT "%.12Lg",lua_tonumber(L,i) END break;
 		case LUA_TFUNCTION: 
+#ifndef PSXJIN_LUAJIT // the parameter names are only found through stock Lua's internals
 			if((L->base + i-1)->value.gc->cl.c.isC)
 			{
 				//lua_CFunction func = lua_tocfunction(L, i);
@@ -368,6 +527,7 @@ static void toCStringConverter(lua_State* L, int i, char*& ptr, int& remaining)
 				APPENDPRINT ")" END
 			}
 			break;
+#endif
 defcase:default: APPENDPRINT "%s:%p",luaL_typename(L,i),lua_topointer(L,i) END break;
 		case LUA_TTABLE:
 		{
@@ -709,16 +869,19 @@ static int memory_readwordsigned(lua_State *L) {
 	return 1;
 }
 
-static int memory_readdword(lua_State *L)
+static inline void lua_pushdword(lua_State *L, uint32 val)
 {
-	uint32 addr = luaL_checkinteger(L,1);
-	uint32 val = psxMu32(addr);
-
 	// lua_pushinteger doesn't work properly for 32bit system, does it?
 	if (val >= 0x80000000 && sizeof(int) <= 4)
 		lua_pushnumber(L, val);
 	else
 		lua_pushinteger(L, val);
+}
+
+static int memory_readdword(lua_State *L)
+{
+	uint32 addr = luaL_checkinteger(L,1);
+	lua_pushdword(L, psxMu32(addr));
 	return 1;
 }
 
@@ -755,6 +918,232 @@ static int memory_readbyterange(lua_State *L) {
 	return 1;
 }
 
+// string memory.readbytes(int address, int length)
+//
+//  Like memory.readbyterange, but returns the bytes as a string,
+//  which is copied straight out of main ram instead of built up a byte at a time.
+//  Use string.byte or string.unpack-alikes on the result.
+static int memory_readbytes(lua_State *L) {
+	uint32 address = luaL_checkinteger(L,1);
+	int length = luaL_checkinteger(L,2);
+
+	if(length < 0)
+	{
+		address += length;
+		length = -length;
+	}
+	if(length > 0x200000)
+		luaL_error(L, "memory.readbytes can read at most 2MB");
+
+	// the range can wrap around the end of ram
+	uint32 offset = address & 0x1fffff;
+	uint32 first = std::min<uint32>(length, 0x200000 - offset);
+	if(first == (uint32)length)
+		lua_pushlstring(L, (const char *) &psxM[offset], length);
+	else
+	{
+		luaL_Buffer b;
+		luaL_buffinit(L, &b);
+		luaL_addlstring(&b, (const char *) &psxM[offset], first);
+		luaL_addlstring(&b, (const char *) psxM, length - first);
+		luaL_pushresult(&b);
+	}
+	return 1;
+}
+
+// table memory.readwordarray(int address, int count)
+// table memory.readdwordarray(int address, int count)
+//
+//  Reads count consecutive words or dwords into a (1-based) array.
+static int memory_readwordarray(lua_State *L) {
+	uint32 address = luaL_checkinteger(L,1);
+	int count = luaL_checkinteger(L,2);
+	int n;
+
+	if(count < 0)
+		luaL_error(L, "count must be positive");
+	lua_createtable(L, count, 0);
+	for(n = 1; n <= count; n++, address += 2)
+	{
+		lua_pushinteger(L, psxMu16(address));
+		lua_rawseti(L, -2, n);
+	}
+	return 1;
+}
+
+static int memory_readdwordarray(lua_State *L) {
+	uint32 address = luaL_checkinteger(L,1);
+	int count = luaL_checkinteger(L,2);
+	int n;
+
+	if(count < 0)
+		luaL_error(L, "count must be positive");
+	lua_createtable(L, count, 0);
+	for(n = 1; n <= count; n++, address += 4)
+	{
+		lua_pushdword(L, psxMu32(address));
+		lua_rawseti(L, -2, n);
+	}
+	return 1;
+}
+
+// A view is a userdata which reads main ram when indexed, so that a script can look at
+// a whole array of structures without copying any of it. Writes go through the memory map like memory.write*.
+#define MEMORY_VIEW_META "PSXjin Memory View"
+
+struct MemoryView {
+	uint32 address;
+	int count;
+	int size;
+	bool sign;
+};
+
+// userdata memory.view(int address, int count, [string type])
+//
+//  type is "u8", "s8", "u16", "s16", "u32" (the default) or "s32".
+//  view[1] is the element at address, and #view is count.
+static int memory_view(lua_State *L) {
+	static const char* const types[] = {"u8", "s8", "u16", "s16", "u32", "s32", NULL};
+	uint32 address = luaL_checkinteger(L,1);
+	int count = luaL_checkinteger(L,2);
+	int type = luaL_checkoption(L, 3, "u32", types);
+
+	if(count < 0)
+		luaL_error(L, "count must be positive");
+
+	MemoryView *view = (MemoryView *) lua_newuserdata(L, sizeof(MemoryView));
+	view->address = address;
+	view->count = count;
+	view->size = 1 << (type / 2);
+	view->sign = (type & 1) != 0;
+	luaL_getmetatable(L, MEMORY_VIEW_META);
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+// returns the address of the element the key at index 2 picks out
+static uint32 memory_view_element(lua_State *L, MemoryView *view) {
+	int i = luaL_checkinteger(L, 2);
+	if(i < 1 || i > view->count)
+		luaL_error(L, "index %d is outside of the view (1 to %d)", i, view->count);
+	return view->address + (i - 1) * view->size;
+}
+
+static int memory_view_index(lua_State *L) {
+	MemoryView *view = (MemoryView *) luaL_checkudata(L, 1, MEMORY_VIEW_META);
+	uint32 address = memory_view_element(L, view);
+
+	switch(view->size)
+	{
+	case 1:
+		lua_pushinteger(L, view->sign ? (int)(signed char) psxMs8(address) : (int) psxMu8(address));
+		break;
+	case 2:
+		lua_pushinteger(L, view->sign ? (int)(signed short) psxMs16(address) : (int) psxMu16(address));
+		break;
+	default:
+		if(view->sign)
+			lua_pushinteger(L, (int32) psxMs32(address));
+		else
+			lua_pushdword(L, psxMu32(address));
+		break;
+	}
+	return 1;
+}
+
+static int memory_view_newindex(lua_State *L) {
+	MemoryView *view = (MemoryView *) luaL_checkudata(L, 1, MEMORY_VIEW_META);
+	uint32 address = memory_view_element(L, view);
+	uint32 value = (uint32) luaL_checknumber(L, 3);
+
+	switch(view->size)
+	{
+	case 1: psxMemWrite8(address, value); break;
+	case 2: psxMemWrite16(address, value); break;
+	default: psxMemWrite32(address, value); break;
+	}
+	return 0;
+}
+
+static int memory_view_len(lua_State *L) {
+	MemoryView *view = (MemoryView *) luaL_checkudata(L, 1, MEMORY_VIEW_META);
+	lua_pushinteger(L, view->count);
+	return 1;
+}
+
+static const struct luaL_reg memoryviewmeta [] = {
+	{"__index", memory_view_index},
+	{"__newindex", memory_view_newindex},
+	{"__len", memory_view_len},
+	{NULL,NULL}
+};
+
+// int memory.find(string pattern, [string mask], [int start], [int end])
+//
+//  Returns the address of the first place in main ram from start (0x80000000 by default)
+//  up to end (the end of ram by default) where pattern is found, or nil.
+//  mask, if given, is as long as pattern, and only the bits set in it are compared.
+//  To find the next match, search again from the address found plus one.
+static int memory_find(lua_State *L) {
+	size_t length, maskLength = 0;
+	const uint8 *pattern = (const uint8 *) luaL_checklstring(L, 1, &length);
+	const uint8 *mask = lua_isnoneornil(L, 2) ? NULL : (const uint8 *) luaL_checklstring(L, 2, &maskLength);
+	uint32 start = luaL_optinteger(L, 3, 0x80000000);
+	uint32 begin = start & 0x1fffff;
+	uint32 stop = 0x200000;
+	const uint8 *ram = (const uint8 *) psxM;
+	size_t anchor, i;
+
+	if(length == 0)
+		luaL_error(L, "the pattern is empty");
+	if(mask && maskLength != length)
+		luaL_error(L, "the mask has to be as long as the pattern");
+	if(!lua_isnoneornil(L, 4))
+	{
+		uint32 end = luaL_checkinteger(L, 4);
+		if(end < start)
+			luaL_error(L, "end is before start");
+		if(end - start < stop - begin)
+			stop = begin + (end - start);
+	}
+	if(stop - begin < length)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+
+	// memchr for a byte which has to match exactly, and only compare the rest where it's found
+	for(anchor = 0; anchor < length; anchor++)
+		if(!mask || mask[anchor] == 0xFF)
+			break;
+
+	const uint8 *last = ram + stop - length; // the last place a match can start
+	const uint8 *p = ram + begin;
+	while(p <= last)
+	{
+		if(anchor < length)
+		{
+			p = (const uint8 *) memchr(p + anchor, pattern[anchor], last - p + 1);
+			if(!p)
+				break;
+			p -= anchor;
+		}
+
+		for(i = 0; i < length; i++)
+			if(mask ? (p[i] ^ pattern[i]) & mask[i] : p[i] != pattern[i])
+				break;
+		if(i == length)
+		{
+			lua_pushdword(L, start + (uint32)(p - (ram + begin)));
+			return 1;
+		}
+		p++;
+	}
+
+	lua_pushnil(L);
+	return 1;
+}
+
 
 static int memory_writebyte(lua_State *L)
 {
@@ -807,6 +1196,56 @@ static int memory_registerwrite(lua_State *L) {
 	return 0;
 }
 
+// sets or (with a nil function) removes the breakpoint which calls a function on an address range
+static int memory_registerbreakpoint(lua_State *L, int type, const char *name) {
+	uint32 addr = (uint32)luaL_checknumber(L, 1);
+	int funcIndex = lua_isfunction(L, 2) || lua_isnil(L, 2) ? 2 : 3;
+	uint32 size = funcIndex == 3 ? (uint32)luaL_checknumber(L, 2) : 1;
+	if (lua_type(L,funcIndex) != LUA_TNIL && lua_type(L,funcIndex) != LUA_TFUNCTION)
+		luaL_error(L, "function or nil expected in arg %d to memory.%s", funcIndex, name);
+	if (size == 0)
+		luaL_error(L, "the size given to memory.%s should be at least 1", name);
+
+	uint32 start = addr & 0x1fffffff, end = (addr + size - 1) & 0x1fffffff;
+	lua_getfield(L, LUA_REGISTRYINDEX, breakpointTable);
+
+	// there's one function for each range, so whatever was set on it before goes
+	const std::vector<Breakpoint>& bps = DebugBreakpoints();
+	for (size_t i = 0; i < bps.size(); i++) {
+		if (bps[i].handler == LuaBreakpointHit && bps[i].type == type && bps[i].start == start && bps[i].end == end) {
+			lua_pushnil(L);
+			lua_rawseti(L, -2, bps[i].id);
+			DebugRemoveBreakpoint(bps[i].id);
+			break;
+		}
+	}
+
+	if (!lua_isnil(L, funcIndex)) {
+		int id = DebugAddBreakpoint(type, start, end, LuaBreakpointHit);
+		lua_pushvalue(L, funcIndex);
+		lua_rawseti(L, -2, id);
+	}
+	return 0;
+}
+
+// memory.registerexec(int address, [int size = 1], function func)
+//
+//  Calls func(address, size) when the cpu is about to execute an instruction
+//  from address to address+size-1 (in any mirror of it). The delay slot of a
+//  branch doesn't count. func = nil removes what was set for the range.
+static int memory_registerexec(lua_State *L) {
+	return memory_registerbreakpoint(L, BP_EXEC, "registerexec");
+}
+
+// memory.registerread(int address, [int size = 1], function func)
+//
+//  Calls func(address, size) when the cpu is about to read from address to
+//  address+size-1, with the address and size of the read. Only reads by the
+//  cpu are seen, not DMA. func = nil removes what was set for the range.
+static int memory_registerread(lua_State *L) {
+	return memory_registerbreakpoint(L, BP_READ, "registerread");
+}
+
 
 // table joypad.read(int which = 1)
 //
@@ -1198,21 +1637,79 @@ static int movie_stop(lua_State *L) {
 int LUA_SCREEN_WIDTH  = 640;
 int LUA_SCREEN_HEIGHT = 512;
 
+static inline bool gui_rects_overlap(const GuiRect &a, const GuiRect &b) {
+	return a.x1 <= b.x2 && b.x1 <= a.x2 && a.y1 <= b.y2 && b.y1 <= a.y2;
+}
+
+static inline GuiRect gui_rects_union(const GuiRect &a, const GuiRect &b) {
+	GuiRect r = { std::min(a.x1, b.x1), std::min(a.y1, b.y1), std::max(a.x2, b.x2), std::max(a.y2, b.y2) };
+	return r;
+}
+
+static inline int gui_rect_area(const GuiRect &r) {
+	return (r.x2 - r.x1 + 1) * (r.y2 - r.y1 + 1);
+}
+
+static void gui_add_dirty(GuiRect r) {
+	int i;
+
+	// swallow every box the new one overlaps, until it overlaps none
+	for (i = 0; i < gui_dirty_count; ) {
+		if (gui_rects_overlap(r, gui_dirty[i])) {
+			r = gui_rects_union(r, gui_dirty[i]);
+			gui_dirty[i] = gui_dirty[--gui_dirty_count];
+			i = 0;
+		}
+		else
+			i++;
+	}
+
+	// out of boxes: merge it with the one that grows the least, which may overlap others again
+	if (gui_dirty_count == GUI_DIRTY_RECTS) {
+		int best = 0, bestGrowth = INT_MAX;
+		for (i = 0; i < gui_dirty_count; i++) {
+			int growth = gui_rect_area(gui_rects_union(r, gui_dirty[i])) - gui_rect_area(gui_dirty[i]);
+			if (growth < bestGrowth) {
+				best = i;
+				bestGrowth = growth;
+			}
+		}
+		r = gui_rects_union(r, gui_dirty[best]);
+		gui_dirty[best] = gui_dirty[--gui_dirty_count];
+		gui_add_dirty(r);
+		return;
+	}
+
+	gui_dirty[gui_dirty_count++] = r;
+}
+
+static void gui_flush_drawn() {
+	if (gui_drawn.x1 > gui_drawn.x2)
+		return;
+	gui_add_dirty(gui_drawn);
+	gui_drawn.x1 = gui_drawn.y1 = INT_MAX;
+	gui_drawn.x2 = gui_drawn.y2 = INT_MIN;
+}
+
 // Common code by the gui library: make sure the screen array is ready
 static void gui_prepare() {
-	int x,y;
-	if (!gui_data)
-		gui_data = (uint8 *) malloc(LUA_SCREEN_WIDTH * LUA_SCREEN_HEIGHT * 4);
+	int i,y;
+	if (!gui_data) // big enough for either canvas size
+		gui_data = (uint8 *) calloc(1024 * 1024, 4);
+	gui_flush_drawn();
+	if (gui_data_width != LUA_SCREEN_WIDTH) {
+		memset(gui_data, 0, 1024 * 1024 * 4);
+		gui_dirty_count = 0;
+		gui_data_width = LUA_SCREEN_WIDTH;
+	}
 	if (gui_used != GUI_USED_SINCE_LAST_DISPLAY) {
-		for (y = 0; y < LUA_SCREEN_HEIGHT; y++) {
-			for (x=0; x < LUA_SCREEN_WIDTH; x++) {
-				if (gui_data[(y*LUA_SCREEN_WIDTH+x)*4+3] != 0)
-					gui_data[(y*LUA_SCREEN_WIDTH+x)*4+3] = 0;
-			}
+		for (i = 0; i < gui_dirty_count; i++) {
+			const GuiRect &r = gui_dirty[i];
+			for (y = r.y1; y <= r.y2; y++)
+				memset(&gui_data[(y*LUA_SCREEN_WIDTH+r.x1)*4], 0, (r.x2 - r.x1 + 1) * 4);
 		}
+		gui_dirty_count = 0;
 	}
-//		if (gui_used != GUI_USED_SINCE_LAST_DISPLAY) /* mz: 10% slower on my system */
-//			memset(gui_data,0,LUA_SCREEN_WIDTH * LUA_SCREEN_HEIGHT * 4);
 	gui_used = GUI_USED_SINCE_LAST_DISPLAY;
 }
 
@@ -1268,6 +1765,10 @@ static inline uint8 gui_check_boundary(int x, int y) {
 // write a pixel to gui_data (do not check boundaries for speedup)
 static inline void gui_drawpixel_fast(int x, int y, uint32 colour) {
 	//gui_prepare();
+	if (x < gui_drawn.x1) gui_drawn.x1 = x;
+	if (x > gui_drawn.x2) gui_drawn.x2 = x;
+	if (y < gui_drawn.y1) gui_drawn.y1 = y;
+	if (y > gui_drawn.y2) gui_drawn.y2 = y;
 	blend32((uint32*) &gui_data[(y*LUA_SCREEN_WIDTH+x)*4], colour);
 }
 
@@ -2609,6 +3110,223 @@ static int input_getcurrentinputstatus(lua_State *L) {
 	return 1;
 }
 
+// The search library runs a RAM search of its own (the same engine as the RAM Search window, but not
+// the window's search), so that a script can narrow down addresses by itself as the game plays.
+// Addresses are offsets into main ram, as in the RAM Search window.
+static MemorySearch *luaSearch = NULL;
+
+static const char* const search_types[] = {"u8", "s8", "u16", "s16", "u32", "s32", NULL};
+
+// sets the search up from the type at index n (and whether it's aligned at n+1)
+static void search_settype_at(lua_State *L, int n) {
+	int type = luaL_checkoption(L, n, "u8", search_types);
+	int size = 1 << (type / 2);
+	bool aligned = lua_isnoneornil(L, n+1) || lua_toboolean(L, n+1);
+	luaSearch->setType(size, (type & 1) != 0, aligned ? size : 1);
+}
+
+static MemorySearch* search_get(lua_State *L) {
+	if (!luaSearch)
+		luaSearch = new MemorySearch(); // bytes to start with
+	return luaSearch;
+}
+
+// search.reset([string type], [boolean aligned])
+//
+//  Starts over with every address a candidate and the values in ram now.
+//  type is "u8" (the default), "s8", "u16", "s16", "u32" or "s32".
+//  Words and dwords are only looked for at addresses they're aligned to, unless aligned is false.
+static int search_reset(lua_State *L) {
+	search_get(L);
+	search_settype_at(L, 1);
+	luaSearch->reset();
+	return 0;
+}
+
+// search.settype(string type, [boolean aligned])
+//
+//  Changes the type of value searched for, keeping the candidates.
+static int search_settype(lua_State *L) {
+	search_get(L);
+	search_settype_at(L, 1);
+	return 0;
+}
+
+static MemorySearch::Op search_checkop(lua_State *L, int n) {
+	static const char* const ops[] = {"<", ">", "<=", ">=", "==", "~=", "!=", "diffby", "modulo", NULL};
+	static const MemorySearch::Op values[] = {MemorySearch::Less, MemorySearch::More, MemorySearch::LessEqual,
+		MemorySearch::MoreEqual, MemorySearch::Equal, MemorySearch::Unequal, MemorySearch::Unequal,
+		MemorySearch::DiffBy, MemorySearch::Modulo};
+	return values[luaL_checkoption(L, n, NULL, ops)];
+}
+
+static int search_run(lua_State *L, MemorySearch::Kind kind) {
+	MemorySearch *search = search_get(L);
+	MemorySearch::Op op = search_checkop(L, 1);
+	int n = 2;
+	s32 value = 0;
+	if (kind != MemorySearch::Relative)
+		value = (s32)(u32)luaL_checknumber(L, n++);
+	s32 param = (s32)(u32)luaL_optnumber(L, n, 0);
+	if (op == MemorySearch::Modulo && param == 0)
+		luaL_error(L, "a modulo search needs a nonzero modulus");
+
+	search->search(kind, op, value, param);
+	lua_pushinteger(L, search->count());
+	return 1;
+}
+
+// int search.relative(string op, [int param])
+// int search.specific(string op, int value, [int param])
+// int search.address(string op, int address, [int param])
+// int search.changes(string op, int count, [int param])
+//
+//  Eliminates the candidates whose value (compared to its value at the last search),
+//  address or number of changes doesn't compare to the given one as op says,
+//  and returns how many candidates are left.
+//  op is "<", ">", "<=", ">=", "==", "~=", "diffby" (differs by param) or "modulo" (value modulo param equals).
+static int search_relative(lua_State *L) { return search_run(L, MemorySearch::Relative); }
+static int search_specific(lua_State *L) { return search_run(L, MemorySearch::Specific); }
+static int search_address(lua_State *L) { return search_run(L, MemorySearch::Address); }
+static int search_changes(lua_State *L) { return search_run(L, MemorySearch::Changes); }
+
+// int search.count()
+static int search_count(lua_State *L) {
+	lua_pushinteger(L, search_get(L)->count());
+	return 1;
+}
+
+// table search.results([int max])
+//
+//  Returns the addresses of the candidates in order, up to max of them.
+static int search_results(lua_State *L) {
+	MemorySearch *search = search_get(L);
+	u32 count = search->count();
+	if (!lua_isnoneornil(L, 1))
+		count = std::min<u32>(count, (u32)std::max(0, (int)luaL_checkinteger(L, 1)));
+
+	lua_createtable(L, count, 0);
+	for (u32 i = 0; i < count; i++) {
+		lua_pushinteger(L, search->addressOf(i));
+		lua_rawseti(L, -2, i+1);
+	}
+	return 1;
+}
+
+static void search_pushvalue(lua_State *L, MemorySearch *search, u32 value) {
+	if (search->isSigned())
+		lua_pushinteger(L, (s32)value);
+	else
+		lua_pushdword(L, value);
+}
+
+// int search.previous(int address)
+//
+//  The value at the address when the last search was made.
+static int search_previous(lua_State *L) {
+	MemorySearch *search = search_get(L);
+	search_pushvalue(L, search, search->previous(luaL_checkinteger(L, 1)));
+	return 1;
+}
+
+// int search.changecount(int address)
+//
+//  How many frames the value at the address has changed on since the search was reset.
+static int search_changecount(lua_State *L) {
+	lua_pushinteger(L, search_get(L)->changes(luaL_checkinteger(L, 1)));
+	return 1;
+}
+
+// search.eliminate(int address, [int length])
+static int search_eliminate(lua_State *L) {
+	search_get(L)->eliminate(luaL_checkinteger(L, 1) & (MemorySearch::RAM_SIZE-1), luaL_optinteger(L, 2, 1));
+	return 0;
+}
+
+// search.saveundo() and search.undo()
+//
+//  undo brings back the candidates saveundo kept, and calling it again redoes.
+static int search_saveundo(lua_State *L) {
+	search_get(L)->saveUndo();
+	return 0;
+}
+
+static int search_undo(lua_State *L) {
+	search_get(L)->undo();
+	return 0;
+}
+
+// sampler.start([int interval = 10000], [string foldedfile])
+//
+//  Starts sampling where the emulated program is every interval cycles (see pcprofile.h).
+//  If foldedfile is given the folded stacks are written to it when sampling stops.
+static int sampler_start(lua_State *L) {
+	PcProfileStart((uint32)luaL_optnumber(L, 1, 10000), luaL_optstring(L, 2, NULL));
+	return 0;
+}
+
+// sampler.stop()
+static int sampler_stop(lua_State *L) {
+	PcProfileStop();
+	return 0;
+}
+
+// sampler.clear()
+//
+//  Forgets the samples taken so far.
+static int sampler_clear(lua_State *L) {
+	PcProfileClear();
+	return 0;
+}
+
+// int sampler.count()
+static int sampler_count(lua_State *L) {
+	lua_pushinteger(L, PcProfileSamples());
+	return 1;
+}
+
+// bool sampler.loadsymbols(string filename)
+//
+//  Names the functions from a file of "address name" lines,
+//  instead of calling them after the nearest jal target.
+static int sampler_loadsymbols(lua_State *L) {
+	lua_pushboolean(L, PcProfileLoadSymbols(luaL_checkstring(L, 1)));
+	return 1;
+}
+
+// bool sampler.writefolded(string filename)
+//
+//  Writes the stacks sampled so far in the folded format of flamegraph.pl.
+static int sampler_writefolded(lua_State *L) {
+	lua_pushboolean(L, PcProfileWriteFolded(luaL_checkstring(L, 1)));
+	return 1;
+}
+
+// table sampler.functions([int count])
+//
+//  Returns the functions sampled, the ones with the most samples of their own first,
+//  as an array of {address=..., name=..., self=..., total=...}; total counts the samples in what they called too.
+static int sampler_functions(lua_State *L) {
+	std::vector<PcProfileFunction> functions;
+	PcProfileFunctions(functions);
+	size_t count = std::min<size_t>(functions.size(), (size_t)luaL_optinteger(L, 1, functions.size()));
+
+	lua_createtable(L, count, 0);
+	for (size_t i = 0; i < count; i++) {
+		lua_createtable(L, 0, 4);
+		lua_pushnumber(L, functions[i].address);
+		lua_setfield(L, -2, "address");
+		lua_pushstring(L, functions[i].name.c_str());
+		lua_setfield(L, -2, "name");
+		lua_pushinteger(L, functions[i].self);
+		lua_setfield(L, -2, "self");
+		lua_pushinteger(L, functions[i].total);
+		lua_setfield(L, -2, "total");
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
 // test.checksum(string component)
 // Return a crc32 checksum over the given component.
 // Component can be "mainmem", "videomem", "cpu", or "savestate".
@@ -2636,6 +3354,54 @@ static int test_checksum(lua_State *L)
 	return 1;
 }
 
+// test.spubench([int samples])
+// Mixes the given number of samples (default 44100) from a copy of the current SPU state,
+// once with the reference mixer and once with the block mixer.
+// Returns the seconds each one took and the largest difference between their outputs,
+// or -1 for the difference if a channel whose envelope ends at the end of a block leaves them in different states.
+static int test_spubench(lua_State *L)
+{
+	int samples = luaL_optinteger(L, 1, 44100);
+	double referenceSeconds, blockSeconds;
+	s32 maxDiff = SPUbenchmarkMixer(samples, &referenceSeconds, &blockSeconds);
+
+	lua_pushnumber(L, referenceSeconds);
+	lua_pushnumber(L, blockSeconds);
+	lua_pushinteger(L, maxDiff);
+	return 3;
+}
+
+// test.spustep([int samples])
+// Advances two copies of the current SPU state by the given number of samples (default 44100),
+// one by mixing and one with the silent stepping used when the core's output is discarded,
+// and then two copies with a channel whose envelope ends at the end of a block.
+// Returns true if each pair ends up in the same state.
+static int test_spustep(lua_State *L)
+{
+	int samples = luaL_optinteger(L, 1, 44100);
+	lua_pushboolean(L, SPUverifyStep(samples));
+	return 1;
+}
+
+// test.spucache()
+// Returns the hit and miss counts of the SPU's decoded BRR block cache since the last reset or state load.
+static int test_spucache(lua_State *L)
+{
+	lua_pushnumber(L, SPU_core->brrCache.hits);
+	lua_pushnumber(L, SPU_core->brrCache.misses);
+	return 2;
+}
+
+// test.cdreadahead()
+// Returns how many sectors the cdrom has read which the disc image readahead had ready for it,
+// and how many it hadn't, since the image was opened.
+static int test_cdreadahead(lua_State *L)
+{
+	lua_pushnumber(L, CDRreadaheadHits);
+	lua_pushnumber(L, CDRreadaheadMisses);
+	return 2;
+}
+
 // the following bit operations are ported from LuaBitOp 1.0.1,
 // because it can handle the sign bit (bit 31) correctly.
 
@@ -2877,13 +3643,95 @@ static void PSXjin_LuaHookFunction(lua_State *L, lua_Debug *dbg) {
 
 		// else, kill the debug hook.
 		lua_sethook(L, NULL, 0, 0);
+#ifdef PSXJIN_LUAJIT
+		luaWatchdogOff = true;
+#endif
+	}
+}
+
+#ifdef PSXJIN_LUAJIT
+// runs on a thread of the timer queue. lua_sethook is safe to call from another thread,
+// and the hook then goes off at the script's next instruction outside of a compiled trace
+static VOID CALLBACK LuaWatchdogTick(PVOID, BOOLEAN) {
+	DWORD started = luaCallStarted;
+	if (started && !luaWatchdogOff && timeGetTime() - started > 3000) {
+		numTries = 0;
+		lua_sethook(LUA, PSXjin_LuaHookFunction, LUA_MASKCOUNT, 1000);
 	}
 }
 
+static const char luaExportFFIChunk[] =
+	"local ffi = require('ffi')\n"
+	"local ram, regs, regsSize, pads1, pads2, padSize = ...\n"
+	"if not psx then\n"
+	"	ffi.cdef[[\n"
+	"	typedef struct {\n"
+	"		union {\n"
+	"			struct { uint32_t r0, at, v0, v1, a0, a1, a2, a3, t0, t1, t2, t3, t4, t5, t6, t7,\n"
+	"				s0, s1, s2, s3, s4, s5, s6, s7, t8, t9, k0, k1, gp, sp, s8, ra, lo, hi; } n;\n"
+	"			uint32_t r[34];\n"
+	"		} GPR;\n"
+	"		struct { uint32_t r[32]; } CP0, CP2D, CP2C;\n"
+	"		uint32_t pc, code, cycle, interrupt;\n"
+	"		uint32_t intCycle[32];\n"
+	"	} psxRegisters;\n"
+	"	typedef struct {\n"
+	"		uint8_t controllerType, padding;\n"
+	"		uint16_t buttonStatus;\n"
+	"		uint8_t rightJoyX, rightJoyY, leftJoyX, leftJoyY, moveX, moveY;\n"
+	"	} PadDataS;\n"
+	"	]]\n"
+	"	assert(ffi.sizeof('psxRegisters') == regsSize and ffi.sizeof('PadDataS') == padSize, 'the FFI structs are out of date')\n"
+	"end\n"
+	"psx = {\n"
+	"	ram = ffi.cast('uint8_t*', ram), ram16 = ffi.cast('uint16_t*', ram), ram32 = ffi.cast('uint32_t*', ram),\n"
+	"	regs = ffi.cast('psxRegisters*', regs),\n"
+	"	pads1 = ffi.cast('PadDataS*', pads1), pads2 = ffi.cast('PadDataS*', pads2),\n"
+	"}\n";
+
+// (re)makes the global table psx of FFI pointers to the emulator's state, which scripts can read and write with no C calls:
+//   psx.ram[offset], psx.ram16[offset/2], psx.ram32[offset/4]  main ram, by offset (address & 0x1FFFFF)
+//   psx.regs                                                   psxRegisters: psx.regs.pc, psx.regs.GPR.n.sp, psx.regs.GPR.r[4]...
+//   psx.pads1[0..3], psx.pads2[0..3]                           the PadDataS the game was given this frame
+// scripts still run without the psx table if it can't be made, so the error is only reported
+static void PSXjin_LuaExportFFIError() {
+	const char *err = lua_tostring(LUA, -1);
+#ifdef WIN32
+	MessageBox(gApp.hWnd, err, "Lua Engine", MB_OK);
+#else
+	fprintf(stderr, "Lua error: %s\n", err);
+#endif
+	lua_pop(LUA, 1);
+}
+
+static void PSXjin_LuaExportFFI() {
+	luaExportedRam = psxM;
+	if (luaL_loadbuffer(LUA, luaExportFFIChunk, sizeof(luaExportFFIChunk)-1, "=psx")) {
+		PSXjin_LuaExportFFIError();
+		return;
+	}
+	lua_pushlightuserdata(LUA, psxM);
+	lua_pushlightuserdata(LUA, &psxRegs);
+	lua_pushinteger(LUA, sizeof(psxRegs));
+	lua_pushlightuserdata(LUA, Movie.lastPads1);
+	lua_pushlightuserdata(LUA, Movie.lastPads2);
+	lua_pushinteger(LUA, sizeof(PadDataS));
+	if (lua_pcall(LUA, 6, 0, 0))
+		PSXjin_LuaExportFFIError();
+}
+#endif
+
 
 void HandleCallbackError(lua_State* L)
 {
+#ifdef PSXJIN_LUAJIT
+	// stock Lua looks at whether a protected call is running; LuaJIT doesn't keep that in its lua_State,
+	// but the callbacks only run inside one when some Lua was already running on L
+	lua_Debug ar;
+	if(lua_getstack(L, 0, &ar))
+#else
 	if(L->errfunc || L->errorJmp)
+#endif
 		luaL_error(L, "%s", lua_tostring(L,-1));
 	else {
 		lua_pushnil(LUA);
@@ -2952,6 +3800,13 @@ void CallRegisteredLuaFunctions(int calltype)
 static const struct luaL_reg psxjinlib [] = {
 	{"speedmode", psxjin_speedmode},
 	{"frameadvance", psxjin_frameadvance},
+	{"runto", psxjin_runto},
+	{"runcycles", psxjin_runcycles},
+	{"starttrace", psxjin_starttrace},
+	{"stoptrace", psxjin_stoptrace},
+	{"profilestart", psxjin_profilestart},
+	{"profilestop", psxjin_profilestop},
+	{"profile", psxjin_profile},
 	{"pause", psxjin_pause},
 	{"unpause", psxjin_unpause},
 	{"framecount", movie_framecount},
@@ -2974,6 +3829,11 @@ static const struct luaL_reg memorylib [] = {
 	{"readdword", memory_readdword},
 	{"readdwordsigned", memory_readdwordsigned},
 	{"readbyterange", memory_readbyterange},
+	{"readbytes", memory_readbytes},
+	{"readwordarray", memory_readwordarray},
+	{"readdwordarray", memory_readdwordarray},
+	{"view", memory_view},
+	{"find", memory_find},
 	{"writebyte", memory_writebyte},
 	{"writeword", memory_writeword},
 	{"writedword", memory_writedword},
@@ -2994,6 +3854,8 @@ static const struct luaL_reg memorylib [] = {
 	{"registerwrite", memory_registerwrite},
 	// alternate names
 	{"register", memory_registerwrite},
+	{"registerexec", memory_registerexec},
+	{"registerread", memory_registerread},
 
 	{NULL,NULL}
 };
@@ -3080,35 +3942,60 @@ static const struct luaL_reg inputlib[] = {
 	{NULL, NULL}
 };
 
+static const struct luaL_reg searchlib[] = {
+	{"reset", search_reset},
+	{"settype", search_settype},
+	{"relative", search_relative},
+	{"specific", search_specific},
+	{"address", search_address},
+	{"changes", search_changes},
+	{"count", search_count},
+	{"results", search_results},
+	{"previous", search_previous},
+	{"changecount", search_changecount},
+	{"eliminate", search_eliminate},
+	{"saveundo", search_saveundo},
+	{"undo", search_undo},
+	{NULL, NULL}
+};
+
+static const struct luaL_reg samplerlib[] = {
+	{"start", sampler_start},
+	{"stop", sampler_stop},
+	{"clear", sampler_clear},
+	{"count", sampler_count},
+	{"loadsymbols", sampler_loadsymbols},
+	{"writefolded", sampler_writefolded},
+	{"functions", sampler_functions},
+	{NULL, NULL}
+};
+
 static const struct luaL_reg testlib[] = {
 	{"checksum", test_checksum},
+	{"spubench", test_spubench},
+	{"spustep", test_spustep},
+	{"spucache", test_spucache},
+	{"cdreadahead", test_cdreadahead},
 	{NULL, NULL}
 };
 
-void PSXjin_LuaFrameBoundary() {
+// resumes the script's thread where it yielded
+static void PSXjin_LuaResume() {
 	lua_State *thread;
 	int result;
 
-	// HA!
-	if (!LUA || !luaRunning)
-		return;
-
 	// Our function needs calling
 	lua_settop(LUA,0);
 	lua_getfield(LUA, LUA_REGISTRYINDEX, frameAdvanceThread);
 	thread = lua_tothread(LUA,1);	
 
-	// Lua calling C must know that we're busy inside a frame boundary
-	frameBoundary = TRUE;
 	frameAdvanceWaiting = FALSE;
 
-	lua_joypads_used = 0;
-	lua_analogjoy_used = 0;
-
-	numTries = 1000;
+	LuaCallBegin();
 	chdir(luaCWD);
 	result = lua_resume(thread, 0);
 	_getcwd(luaCWD, _MAX_PATH);
+	LuaCallEnd();
 	
 	if (result == LUA_YIELD) {
 		// Okay, we're fine with that.
@@ -3130,13 +4017,79 @@ void PSXjin_LuaFrameBoundary() {
 		//GPUdisplayText("Script died of natural causes.\n");
 	}
 
+	if (!frameAdvanceWaiting) {
+		PSXjin_LuaOnStop();
+	}
+}
+
+void PSXjin_LuaFrameBoundary() {
+	// HA!
+	if (!LUA || !luaRunning)
+		return;
+
+	// the values a search compares with are the ones at the end of each frame
+	if (luaSearch)
+		luaSearch->update();
+#ifdef PSXJIN_LUAJIT
+	if (psxM != luaExportedRam)
+		PSXjin_LuaExportFFI();
+#endif
+
+	// a script sleeping through frames isn't resumed at all until they've gone by
+	if (luaRunningTo)
+		return;
+	if (luaFramesToSkip > 0) {
+		luaFramesToSkip--;
+		return;
+	}
+
+	// Lua calling C must know that we're busy inside a frame boundary
+	frameBoundary = TRUE;
+
+	lua_joypads_used = 0;
+	lua_analogjoy_used = 0;
+
+	PSXjin_LuaResume();
+
 	// Past here, the nes actually runs, so any Lua code is called mid-frame. We must
 	// not do anything too stupid, so let ourselves know.
 	frameBoundary = FALSE;
+}
 
-	if (!frameAdvanceWaiting) {
-		PSXjin_LuaOnStop();
+// the breakpoint of emu.runto or emu.runcycles
+static void LuaRunToHit(int id, u32 address, int size, int type, void* param) {
+	if (id >= 0)
+		DebugRemoveBreakpoint(id);
+	luaRunningTo = 0;
+	if (!LUA || !luaRunning)
+		return;
+	PSXjin_LuaResume();
+}
+
+// the breakpoints of memory.registerexec and memory.registerread
+static void LuaBreakpointHit(int id, u32 address, int size, int type, void* param) {
+	int res;
+	if (!LUA || !luaRunning)
+		return;
+
+	lua_settop(LUA, 0);
+	lua_getfield(LUA, LUA_REGISTRYINDEX, breakpointTable);
+	lua_rawgeti(LUA, 1, id);
+	lua_pushinteger(LUA, address);
+	lua_pushinteger(LUA, size);
+
+	LuaCallBegin();
+	res = lua_pcall(LUA, 2, 0, 0);
+	LuaCallEnd();
+	if (res) {
+		const char *err = lua_tostring(LUA, -1);
+#ifdef WIN32
+		MessageBox(gApp.hWnd, err, "Lua Engine", MB_OK);
+#else
+		fprintf(stderr, "Lua error: %s\n", err);
+#endif
 	}
+	lua_settop(LUA, 0);
 }
 
 
@@ -3187,8 +4140,14 @@ int PSXjin_LoadLuaCode(const char *filename) {
 		luaL_register(LUA, "movie", movielib);
 		luaL_register(LUA, "gui", guilib);
 		luaL_register(LUA, "input", inputlib);
+#ifndef PSXJIN_LUAJIT
 		luaL_register(LUA, "bit", bit_funcs); // LuaBitOp library
+#endif
 		luaL_register(LUA, "test", testlib);
+		luaL_register(LUA, "search", searchlib);
+		luaL_register(LUA, "sampler", samplerlib);
+		luaL_newmetatable(LUA, MEMORY_VIEW_META);
+		luaL_register(LUA, NULL, memoryviewmeta);
 		lua_settop(LUA, 0); // clean the stack, because each call to luaL_register leaves a table on top
 
 		// register a few utility functions outside of libraries (in the global namespace)
@@ -3210,6 +4169,13 @@ int PSXjin_LoadLuaCode(const char *filename) {
 		lua_setfield(LUA, LUA_REGISTRYINDEX, memoryWatchTable);
 		lua_newtable(LUA);
 		lua_setfield(LUA, LUA_REGISTRYINDEX, memoryValueTable);
+		lua_newtable(LUA);
+		lua_setfield(LUA, LUA_REGISTRYINDEX, breakpointTable);
+
+#ifdef PSXJIN_LUAJIT
+		// LuaJIT's own bit library is LuaBitOp, which its compiler turns into plain instructions
+		PSXjin_LuaExportFFI();
+#endif
 	}
 
 	// We make our thread NOW because we want it at the bottom of the stack.
@@ -3265,8 +4231,14 @@ int PSXjin_LoadLuaCode(const char *filename) {
 	// And run it right now. :)
 	//PSXjin_LuaFrameBoundary();
 
+#ifdef PSXJIN_LUAJIT
+	luaWatchdogOff = false;
+	if (!luaWatchdog)
+		CreateTimerQueueTimer(&luaWatchdog, NULL, LuaWatchdogTick, NULL, 1000, 1000, WT_EXECUTEDEFAULT);
+#else
 	// Set up our protection hook to be executed once every 10,000 bytecode instructions.
 	lua_sethook(thread, PSXjin_LuaHookFunction, LUA_MASKCOUNT, 10000);
+#endif
 
 	// We're done.
 	return 1;
@@ -3301,8 +4273,16 @@ void PSXjin_LuaStop() {
 	if (info_onstop)
 		info_onstop(info_uid);
 
+#ifdef PSXJIN_LUAJIT
+	if (luaWatchdog) {
+		DeleteTimerQueueTimer(NULL, luaWatchdog, INVALID_HANDLE_VALUE);
+		luaWatchdog = NULL;
+	}
+#endif
 	lua_close(LUA); // this invokes our garbage collectors for us
 	LUA = NULL;
+	delete luaSearch;
+	luaSearch = NULL;
 	PSXjin_LuaOnStop();
 }
 
@@ -3382,6 +4362,44 @@ int PSXjin_LuaRerecordCountSkip() {
 }
 
 
+// blends two pixels of the gui (widened to 16 bits a channel) onto two of the screen:
+// dst = (dst * (255 - a) + src * a) / 255, rounded, where (t + (t >> 8)) >> 8 divides t + 128 by 255
+static inline __m128i gui_blend2(__m128i dst, __m128i src) {
+	const __m128i c255 = _mm_set1_epi16(255);
+	const __m128i c128 = _mm_set1_epi16(128);
+	__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, 0xFF), 0xFF);
+	__m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(dst, _mm_sub_epi16(c255, a)), _mm_mullo_epi16(src, a)), c128);
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// blends a run of gui pixels onto the screen, four at a time. the screen's own alpha byte is left alone
+static void gui_blendrow(uint8 *dst, const uint8 *src, int n) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alphaMask = _mm_set1_epi32(0xFF000000);
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i*)(src + i*4));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alphaMask), zero)) == 0xFFFF)
+			continue; // nothing drawn here
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + i*4));
+		__m128i lo = gui_blend2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero));
+		__m128i hi = gui_blend2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero));
+		__m128i out = _mm_packus_epi16(lo, hi);
+		out = _mm_or_si128(_mm_andnot_si128(alphaMask, out), _mm_and_si128(alphaMask, d));
+		_mm_storeu_si128((__m128i*)(dst + i*4), out);
+	}
+	for (; i < n; i++) {
+		int a = src[i*4+3];
+		if (a == 0)
+			continue;
+		for (int c = 0; c < 3; c++) {
+			int t = dst[i*4+c] * (255 - a) + src[i*4+c] * a + 128;
+			dst[i*4+c] = (uint8) ((t + (t >> 8)) >> 8);
+		}
+	}
+}
+
 /**
  * Given an 8-bit screen with the indicated resolution,
  * draw the current GUI onto it.
@@ -3389,8 +4407,7 @@ int PSXjin_LuaRerecordCountSkip() {
  * Currently we only support 256x* resolutions.
  */
 void PSXjin_LuaGui(void *s, int width, int height, int bpp, int pitch) {
-	int x,y;
-	uint8 r,g,b,gui_alpha,gui_red,gui_green,gui_blue;
+	int i,y;
 
 	XBuf = (uint8 *)s;
 	iScreenWidth = width;
@@ -3414,8 +4431,9 @@ void PSXjin_LuaGui(void *s, int width, int height, int bpp, int pitch) {
 		int ret;
 
 		// We call it now
-		numTries = 1000;
+		LuaCallBegin();
 		ret = lua_pcall(LUA, 0, 0, 0);
+		LuaCallEnd();
 		if (ret != 0) {
 #ifdef WIN32
 			MessageBox(gApp.hWnd, lua_tostring(LUA, -1), "Lua Error in GUI function", MB_OK);
@@ -3436,28 +4454,15 @@ void PSXjin_LuaGui(void *s, int width, int height, int bpp, int pitch) {
 
 	gui_used = GUI_USED_SINCE_LAST_FRAME;
 
-	for (y = 0; y < LUA_SCREEN_HEIGHT; y++) {
-		for (x=0; x < LUA_SCREEN_WIDTH; x++) {
-			gui_alpha = gui_data[(y*LUA_SCREEN_WIDTH+x)*4+3];
-			if (gui_alpha != 0) {
-				if (gui_alpha == 255) {
-					XBuf[(y*LUA_SCREEN_WIDTH+x)*4+2]=gui_data[(y*LUA_SCREEN_WIDTH+x)*4+2];
-					XBuf[(y*LUA_SCREEN_WIDTH+x)*4+1]=gui_data[(y*LUA_SCREEN_WIDTH+x)*4+1];
-					XBuf[(y*LUA_SCREEN_WIDTH+x)*4]=gui_data[(y*LUA_SCREEN_WIDTH+x)*4];
-				}
-				else {
-					gui_red   = gui_data[(y*LUA_SCREEN_WIDTH+x)*4+2];
-					gui_green = gui_data[(y*LUA_SCREEN_WIDTH+x)*4+1];
-					gui_blue  = gui_data[(y*LUA_SCREEN_WIDTH+x)*4];
-					r = XBuf[(y*LUA_SCREEN_WIDTH+x)*4+2];
-					g = XBuf[(y*LUA_SCREEN_WIDTH+x)*4+1];
-					b = XBuf[(y*LUA_SCREEN_WIDTH+x)*4];
-					XBuf[(y*LUA_SCREEN_WIDTH+x)*4+2] = ((gui_red   - r) * gui_alpha / 255 + r) & 255;
-					XBuf[(y*LUA_SCREEN_WIDTH+x)*4+1] = ((gui_green - g) * gui_alpha / 255 + g) & 255;
-					XBuf[(y*LUA_SCREEN_WIDTH+x)*4]   = ((gui_blue  - b) * gui_alpha / 255 + b) & 255;
-				}
-			}
-		}
+	// drawn at another canvas size, which gui_prepare will clear away
+	if (gui_data_width != LUA_SCREEN_WIDTH)
+		return;
+
+	gui_flush_drawn();
+	for (i = 0; i < gui_dirty_count; i++) {
+		const GuiRect &r = gui_dirty[i];
+		for (y = r.y1; y <= r.y2; y++)
+			gui_blendrow(&XBuf[(y*LUA_SCREEN_WIDTH+r.x1)*4], &gui_data[(y*LUA_SCREEN_WIDTH+r.x1)*4], r.x2 - r.x1 + 1);
 	}
 
 	return;
@@ -20,6 +20,7 @@ void CallRegisteredLuaFunctions(int calltype);
 
 //void PSXjin_LuaWrite(uint32 addr);
 void PSXjin_LuaFrameBoundary();
+
 int PSXjin_LoadLuaCode(const char *filename);
 void PSXjin_ReloadLuaCode();
 void PSXjin_LuaStop();
@@ -23,6 +23,7 @@
 
 #include "PsxCommon.h"
 #include "Mdec.h"
+#include "profiler.h"
 
 #define FIXED
 
@@ -280,6 +281,7 @@ void psxDma1(u32 adr, u32 bcr, u32 chcr) {
 
 	if (chcr!=0x01000200) return;
 
+	PROFILE_SCOPE(PROF_MDEC);
 	size = (bcr>>16)*(bcr&0xffff);
 
     image = (u16*)PSXM(adr);
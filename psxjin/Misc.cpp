@@ -22,6 +22,10 @@
 #include <stdarg.h>
 #include <ctype.h>
 
+#include <map>
+#include <string>
+#include <vector>
+
 #include "Coff.h"
 #include "PsxCommon.h"
 #include "plugins.h"
@@ -139,16 +143,130 @@ void mmssdd( char *b, char *p )
 	} \
 	time[0] = itob(time[0]); time[1] = itob(time[1]); time[2] = itob(time[2]);
 
+//the volume descriptor, directories and SYSTEM.CNF are kept for each disc once they have been read,
+//so that checking or booting it again doesn't go back to the disc for them.
+//they're also saved to a file for the image, so that other runs with the same disc (a batch of movies) have them too.
+//the cdrom buffer is left holding the last sector the lookups asked for, just as if they had all been read,
+//but a sector found in the cache is copied there rather than read from the image again.
+const char CdromMetaHeader[32] = "PSXjin disc metadata v1";
+static std::map<int, std::vector<u8> > cdromMeta;
+static std::string cdromMetaDisc;
+static bool cdromMetaDirty; // sectors were read which aren't in the file yet
+static const u8 *cdromMetaPending; // the last sector asked for came from the cache, and isn't in the cdrom buffer
+
+static void GetCdromMetaFile(char *file) {
+	u32 crc = crc32(0, (const Bytef*)cdromMetaDisc.c_str(), cdromMetaDisc.size());
+	sprintf(file, "%scdmeta_%08x.pxm", Config.SstatesDir, crc);
+}
+
+// the file's key has to match in full, since different images could have the same crc
+static void LoadCdromMeta() {
+	char file[512], header[32];
+	GetCdromMetaFile(file);
+	EMUFILE_FILE f(file, "rb");
+	if (f.fail()) return;
+
+	u32 len, count;
+	if (f.fread(header, 32) != 32 || memcmp(header, CdromMetaHeader, 32)) return;
+	if (!f.read32le(&len) || len != cdromMetaDisc.size()) return;
+	std::string key(len, 0);
+	if (f.fread(&key[0], len) != len || key != cdromMetaDisc) return;
+
+	f.read32le(&count);
+	while (count-- && !f.fail()) {
+		s32 sector;
+		u32 size;
+		f.read32le(&sector);
+		if (!f.read32le(&size) || size != DATA_SIZE + 1) break;
+		std::vector<u8> &data = cdromMeta[sector];
+		data.resize(size);
+		f.fread(&data[0], size);
+	}
+	if (f.fail())
+		cdromMeta.clear();
+}
+
+// written to a file of this process's own and moved into place, since the workers of a batch can all be saving it at once
+static void SaveCdromMeta() {
+	char file[512], tmp[512];
+	GetCdromMetaFile(file);
+	sprintf(tmp, "%s.%lu.tmp", file, (unsigned long)GetCurrentProcessId());
+	bool ok;
+	{
+		EMUFILE_FILE f(tmp, "wb");
+		if (f.fail()) return;
+
+		f.fwrite(CdromMetaHeader, 32);
+		f.write32le((u32)cdromMetaDisc.size());
+		f.fwrite(cdromMetaDisc.c_str(), cdromMetaDisc.size());
+		f.write32le((u32)cdromMeta.size());
+		for (std::map<int, std::vector<u8> >::iterator it = cdromMeta.begin(); it != cdromMeta.end(); ++it) {
+			f.write32le((s32)it->first);
+			f.write32le((u32)it->second.size());
+			f.fwrite(&it->second[0], it->second.size());
+		}
+		ok = !f.fail();
+	}
+	if (!ok || !MoveFileEx(tmp, file, MOVEFILE_REPLACE_EXISTING)) {
+		remove(tmp);
+		return;
+	}
+	cdromMetaDirty = false;
+}
+
+static u8 *ReadCdromMeta(u8 *time) {
+	if (cdromMetaDisc != CDRgetImageKey()) {
+		cdromMeta.clear();
+		cdromMetaPending = NULL;
+		cdromMetaDisc = CDRgetImageKey();
+		cdromMetaDirty = false;
+		if (!cdromMetaDisc.empty())
+			LoadCdromMeta();
+	}
+
+	int sector = MSF2SECT(btoi(time[0]), btoi(time[1]), btoi(time[2]));
+	std::map<int, std::vector<u8> >::iterator it = cdromMeta.find(sector);
+	if (it != cdromMeta.end()) {
+		cdromMetaPending = &it->second[0];
+		return &it->second[0];
+	}
+
+	if (CDRreadTrack(time) == -1) return NULL;
+	u8 *buf = CDRgetBuffer();
+	if (buf == NULL) return NULL;
+	cdromMetaPending = NULL;
+
+	std::vector<u8> &data = cdromMeta[sector];
+	data.assign(buf, buf + DATA_SIZE);
+	data.push_back(0); // so that SYSTEM.CNF can't be scanned off the end
+	cdromMetaDirty = true;
+	return &data[0];
+}
+
+// called once a lookup is done: puts the last sector it asked for in the cdrom buffer, and saves what it added to the cache
+static void SyncCdromMeta() {
+	if (cdromMetaDirty && !cdromMetaDisc.empty())
+		SaveCdromMeta();
+	if (cdromMetaPending) {
+		CDRsetBuffer(cdromMetaPending);
+		cdromMetaPending = NULL;
+	}
+}
+
 #define READTRACK() \
 	if (CDRreadTrack(time) == -1) return -1; \
-	buf = CDRgetBuffer(); if (buf == NULL) return -1;
+	buf = CDRgetBuffer(); if (buf == NULL) return -1; \
+	cdromMetaPending = NULL;
+
+#define READMETA() \
+	buf = ReadCdromMeta(time); if (buf == NULL) return -1;
 
 #define READDIR(_dir) \
-	READTRACK(); \
+	READMETA(); \
 	memcpy(_dir, buf+12, 2048); \
  \
 	incTime(); \
-	READTRACK(); \
+	READMETA(); \
 	memcpy(_dir+2048, buf+12, 2048);
 
 int GetCdromFile(u8 *mdir, u8 *time, s8 *filename) {
@@ -188,21 +306,16 @@ int GetCdromFile(u8 *mdir, u8 *time, s8 *filename) {
 	return 0;
 }
 
-int LoadCdrom() {
+static int LoadCdromExe() {
 	EXE_HEADER tmpHead;
 	struct iso_directory_record *dir;
 	u8 time[4],*buf;
 	u8 mdir[4096];
 	s8 exename[256];
 
-	if (!Config.HLE) {
-		psxRegs.pc = psxRegs.GPR.n.ra;
-		return 0;
-	}
-
 	time[0] = itob(0); time[1] = itob(2); time[2] = itob(0x10);
 
-	READTRACK();
+	READMETA();
 
 	// skip head and sub, and go to the root directory record
 	dir = (struct iso_directory_record*) &buf[12+156]; 
@@ -217,7 +330,7 @@ int LoadCdrom() {
 		READTRACK();
 	}
 	else {
-		READTRACK();
+		READMETA();
 
 		sscanf((char*)buf+12, "BOOT = cdrom:\\%s", exename);
 		if (GetCdromFile(mdir, time, exename) == -1) {
@@ -260,7 +373,18 @@ int LoadCdrom() {
 	return 0;
 }
 
-int LoadCdromFile(char *filename, EXE_HEADER *head) {
+int LoadCdrom() {
+	if (!Config.HLE) {
+		psxRegs.pc = psxRegs.GPR.n.ra;
+		return 0;
+	}
+
+	int ret = LoadCdromExe();
+	SyncCdromMeta();
+	return ret;
+}
+
+static int LoadCdromFileExe(char *filename, EXE_HEADER *head) {
 	struct iso_directory_record *dir;
 	u8 time[4],*buf;
 	u8 mdir[4096], exename[256];
@@ -271,7 +395,7 @@ int LoadCdromFile(char *filename, EXE_HEADER *head) {
 
 	time[0] = itob(0); time[1] = itob(2); time[2] = itob(0x10);
 
-	READTRACK();
+	READMETA();
 
 	// skip head and sub, and go to the root directory record
 	dir = (struct iso_directory_record*) &buf[12+156]; 
@@ -302,7 +426,13 @@ int LoadCdromFile(char *filename, EXE_HEADER *head) {
 	return 0;
 }
 
-int CheckCdrom() {
+int LoadCdromFile(char *filename, EXE_HEADER *head) {
+	int ret = LoadCdromFileExe(filename, head);
+	SyncCdromMeta();
+	return ret;
+}
+
+static int CheckCdromId() {
 	struct iso_directory_record *dir;
 	unsigned char time[4],*buf;
 	unsigned char mdir[4096];
@@ -311,7 +441,7 @@ int CheckCdrom() {
 
 	time[0] = itob(0); time[1] = itob(2); time[2] = itob(0x10);
 
-	READTRACK();
+	READMETA();
 
 	CdromLabel[32]=0;
 	CdromId[9]=0;
@@ -326,7 +456,7 @@ int CheckCdrom() {
 	READDIR(mdir);
 
 	if (GetCdromFile(mdir, time, "SYSTEM.CNF;1") != -1) {
-		READTRACK();
+		READMETA();
 
 		sscanf((char*)buf+12, "BOOT = cdrom:\\%s", exename);
 		if (GetCdromFile(mdir, time, exename) == -1) {
@@ -371,6 +501,12 @@ int CheckCdrom() {
 	return 0;
 }
 
+int CheckCdrom() {
+	int ret = CheckCdromId();
+	SyncCdromMeta();
+	return ret;
+}
+
 #define PSX_EXE     1
 #define CPE_EXE     2
 #define COFF_EXE    3
@@ -545,6 +681,7 @@ int LoadStateEmufile(EMUFILE *f) {
 		gzseek(f, 128*96*3-4, SEEK_CUR);
 
 	gzread(f, psxM, 0x00200000);
+	PSXjinCheatsChanged();
 	gzread(f, psxP, 0x00010000);
 	gzread(f, psxR, 0x00080000);
 	gzread(f, psxH, 0x00010000);
@@ -593,6 +730,163 @@ int LoadState(char *file) {
 	return LoadStateEmufile(&f);
 }
 
+// BOOT SNAPSHOTS
+
+//the state of the machine once the bios has run up to the shell (see psxExecuteBios).
+//with Config.BootSnapshot set, it is saved the first time a bios, disc and configuration are booted,
+//and restored instead of running the bios again after that.
+//it is written like a savestate, leaving out what the bios doesn't touch: the disc buffer, the pads and the movie.
+//
+//the disc is told by its image rather than by CdromId, which is only read from the disc after the reset.
+//a reset during a movie always runs the bios, since the frames it takes are part of the movie,
+//and a movie is played back from a snapshot only if it was recorded from one.
+//the settings which change what the bios does are in the file name, and with cheats on (which are applied
+//at each vsync of the boot too) no snapshot is saved or restored.
+const char BootSnapshotHeader[32] = "PSXjin boot snapshot v1";
+const u32 BootSnapshotEndTag = 0xB007B007; // so that a snapshot cut short by a crash isn't half loaded
+bool BootSnapshotUsed;
+bool BootSnapshotBlocked;
+
+static void GetBootSnapshotFile(char *file) {
+	u32 crc = crc32(0, (const Bytef*)psxR, 0x00080000);
+	const char *disc = CDRgetImageKey();
+	u32 discCrc = *disc ? crc32(0, (const Bytef*)disc, strlen(disc)) : 0;
+	int flags = (Config.PsxType ? 1 : 0) | (Config.HLE ? 2 : 0) | (Config.Sio ? 4 : 0) | (Config.RCntFix ? 8 : 0) | (Config.VSyncWA ? 16 : 0) |
+		(Config.PsxOut ? 32 : 0) | (Config.Xa ? 64 : 0) | (Config.Cdda ? 128 : 0) | (Config.Mdec ? 256 : 0) | (Config.UsingAnalogHack ? 512 : 0);
+	sprintf(file, "%sboot_%08x_%08x_%03x.pxb", Config.SstatesDir, crc, discCrc, flags);
+}
+
+void SaveBootSnapshot() {
+	GPUFreeze_t *gpufP;
+	int Size;
+	char file[512];
+
+	if (!Config.BootSnapshot || cheatsEnabled) return;
+
+	GetBootSnapshotFile(file);
+	EMUFILE_FILE f(file, "wb");
+	if (f.fail()) return;
+
+	gzwrite(&f, (void*)BootSnapshotHeader, 32);
+
+	Size = exceptionPatches.size();
+	gzwrite(&f, &Size, 4);
+	for (int i = 0; i < Size; i++) {
+		gzwrite(&f, &exceptionPatches[i].first, 4);
+		gzwrite(&f, &exceptionPatches[i].second, 4);
+	}
+
+	if (Config.HLE)
+		psxBiosFreeze(1);
+
+	gzwrite(&f, psxM, 0x00200000);
+	gzwrite(&f, psxP, 0x00010000);
+	gzwrite(&f, psxR, 0x00080000);
+	gzwrite(&f, psxH, 0x00010000);
+	gzwrite(&f, (void*)&psxRegs, sizeof(psxRegs));
+
+	// gpu
+	gpufP = (GPUFreeze_t *) malloc(sizeof(GPUFreeze_t));
+	gpufP->ulFreezeVersion = 1;
+	GPUfreeze(1, gpufP);
+	void* temp = gpufP->extraData;
+	gpufP->extraData = 0;
+	gzwrite(&f, gpufP, sizeof(GPUFreeze_t));
+	gzwrite(&f, temp, gpufP->extraDataSize);
+	GPUfreeze(3, gpufP);
+	free(gpufP);
+
+	sioFreeze(&f, 1);
+	cdrFreeze(&f, 1);
+	psxHwFreeze(&f, 1);
+	psxRcntFreeze(&f, 1);
+	mdecFreeze(&f, 1);
+
+	EMUFILE_MEMORY memfile;
+	SPUfreeze_new(&memfile);
+	Size = memfile.size();
+	gzwrite(&f, &Size, 4);
+	gzwrite(&f, memfile.buf(),Size);
+
+	f.write32le(BootSnapshotEndTag);
+
+	printf("saved boot snapshot %s\n", file);
+}
+
+bool LoadBootSnapshot() {
+	GPUFreeze_t *gpufP;
+	int Size;
+	char header[32];
+	char file[512];
+
+	if (!Config.BootSnapshot || BootSnapshotBlocked || cheatsEnabled || Movie.mode != MOVIEMODE_INACTIVE) return false;
+
+	GetBootSnapshotFile(file);
+	EMUFILE_FILE f(file, "rb");
+	if (f.fail()) return false;
+
+	gzread(&f, header, 32);
+	if (memcmp(header, BootSnapshotHeader, 32)) return false;
+	u32 endtag = 0;
+	f.fseek(-4, SEEK_END);
+	f.read32le(&endtag);
+	if (endtag != BootSnapshotEndTag) return false;
+	f.fseek(32, SEEK_SET);
+
+	// the state the reset left is kept, to go back to if the snapshot can't all be restored
+	EMUFILE_MEMORY clean;
+	SaveStateEmufile(&clean);
+
+	exceptionPatches.clear();
+	gzread(&f, &Size, 4);
+	while (Size--) {
+		u32 addr, val;
+		gzread(&f, &addr, 4);
+		gzread(&f, &val, 4);
+		exceptionPatches.push_back(std::make_pair(addr, val));
+	}
+
+	gzread(&f, psxM, 0x00200000);
+	PSXjinCheatsChanged();
+	gzread(&f, psxP, 0x00010000);
+	gzread(&f, psxR, 0x00080000);
+	gzread(&f, psxH, 0x00010000);
+	gzread(&f, (void*)&psxRegs, sizeof(psxRegs));
+
+	if (Config.HLE)
+		psxBiosFreeze(0);
+
+	// gpu
+	gpufP = (GPUFreeze_t *) malloc (sizeof(GPUFreeze_t));
+	gzread(&f, gpufP, sizeof(GPUFreeze_t));
+	gpufP->extraData = malloc(gpufP->extraDataSize);
+	gzread(&f, gpufP->extraData, gpufP->extraDataSize);
+	GPUfreeze(0, gpufP);
+	free(gpufP->extraData);
+	free(gpufP);
+
+	sioFreeze(&f, 0);
+	cdrFreeze(&f, 0);
+	psxHwFreeze(&f, 0);
+	psxRcntFreeze(&f, 0);
+	mdecFreeze(&f, 0);
+
+	// spu
+	gzread(&f, &Size, 4);
+	EMUFILE_MEMORY memfile;
+	memfile.truncate(Size);
+	gzread(&f, memfile.buf(), Size);
+	if (f.fail() || !SPUunfreeze_new(&memfile)) {
+		printf("boot snapshot %s is damaged; running the bios instead\n", file);
+		clean.fseek(0, SEEK_SET);
+		LoadStateEmufile(&clean);
+		return false;
+	}
+
+	printf("restored boot snapshot %s\n", file);
+	return true;
+}
+
 int CheckState(char *file) {
 	char header[32];
 
@@ -719,6 +1013,7 @@ int LoadStateEmbed(char *file) {
 		gzseek(f, 128*96*3-4, SEEK_CUR);
 
 	gzread(f, psxM, 0x00200000);
+	PSXjinCheatsChanged();
 	gzread(f, psxP, 0x00010000);
 	gzread(f, psxR, 0x00080000);
 	gzread(f, psxH, 0x00010000);
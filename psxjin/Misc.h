@@ -57,6 +57,11 @@ int LoadStateEmufile(EMUFILE *f);
 
 int CheckState(char *file);
 
+bool LoadBootSnapshot();
+void SaveBootSnapshot();
+extern bool BootSnapshotUsed;
+extern bool BootSnapshotBlocked; // set around a reset which mustn't restore a boot snapshot
+
 int SaveStateEmbed(char *file);
 int LoadStateEmbed(char *file);
 
@@ -154,6 +154,8 @@ typedef struct {
 	long RCntFix;
 	long VSyncWA;
 	long PauseAfterPlayback;
+	long BootSnapshot; // restore a saved snapshot instead of running the bios at reset
+	long CheatsOnWrite; // put plain cheat writes back when the cpu writes over them, instead of at every vsync
 	char Conf_File[256];	
 	long SplitAVI;
 	int CurWinX;
@@ -235,7 +237,7 @@ struct MovieType {
 	unsigned long emuVersion;            //emulator version used in recording
 	char movieFilenameMini[256];         //short movie filename (ex: "movie") used for savestates
 	char movieFilename[256];             //full path file name (ex:"c:/pcsx/movies/movie.pjm")
-	char bytesPerFrame;                  //size of each frame in bytes
+	int bytesPerFrame;                   //size of each frame in bytes
 	char palTiming;                      //PAL mode (50 FPS instead of 60)
 	char currentCdrom;                   //in which CD number are we at now?
 	char CdromCount;                     //how many different cds are used in the movie
@@ -246,9 +248,12 @@ struct MovieType {
 	char startAvi;                       //start AVI capture at first emulated frame?
 	char startWav;                       //start WAV capture at first emulated frame?
 	unsigned long stopCapture;           //stop AVI/WAV capture at what emulated frame?
-	uint8* inputBuffer;                  //full movie input buffer
-	uint32 inputBufferSize;              //movie input buffer size
-	uint8* inputBufferPtr;               //pointer to the full movie input buffer
+	uint8** inputBlocks;                 //movie input, in blocks of INPUT_BLOCK_FRAMES frames
+	uint32 inputBlockCount;              //number of input blocks allocated
+	uint32 inputBlock;                   //the input block inputBufferPtr is in
+	uint8* inputBufferPtr;               //where the next input is read or written
+	uint32 inputFlushedFrames;           //frames which are in the movie file as they are in memory
+	uint32 inputFlushedOffset;           //the input offset they were written at
 	int AviCount;						 //Number of AVIs created
 	char AviDrive[256];					 //Drive where avi will be stored - for splitting
 	char AviDirectory[256];				 //Directory where avi will be stored - for splitting
@@ -261,6 +266,7 @@ struct MovieType {
 	int P2_Start;						//Where does pad2 start? 
 	bool UsingAnalogHack;				//Stupid Analog Hack for Final Fantasy 8. Yes, I added a hack just for me.
 	int UsingRCntFix;					//Parasite Eve Fix
+	int UsingBootSnapshot;				//Was the bios boot restored from a boot snapshot?
 
 };
 
@@ -285,6 +291,7 @@ struct MovieControlType {
 #define MOVIE_FLAG_P2_MTAP		  (1<<8)
 #define MOVIE_FLAG_ANALOG_HACK	  (1<<9)
 #define MOVIE_FLAG_RCNTFIX		  (1<<10)
+#define MOVIE_FLAG_BOOT_SNAPSHOT  (1<<11)
 
 #define MOVIE_CONTROL_RESET       (1<<1)
 #define MOVIE_CONTROL_CDCASE      (1<<2)
@@ -22,6 +22,7 @@
 #include "Win32/Win32.h"
 #include "Win32/ram_search.h"
 #include "Win32/ramwatch.h"
+#include "Win32/movieverify.h"
 
 
 // global variables
@@ -161,6 +162,8 @@ iVSyncFlag = 1;
 		if (Movie.currentFrame>Movie.totalFrames)
 		{
 			GPUdisplayText("*PSXjin*: Movie End");
+			if (MOV_W32_Verifying())
+				MOV_W32_VerifyEnd();
 			MOV_StopMovie();
 		}
 	}
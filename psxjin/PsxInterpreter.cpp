@@ -19,6 +19,9 @@
 #include <stdlib.h>
 
 #include "PsxCommon.h"
+#include "debugger.h"
+#include "cputrace.h"
+#include "profiler.h"
 
 #ifdef _MSC_VER_
 #pragma warning(disable:4018)
@@ -51,7 +54,9 @@ extern void (*psxCP2BSC[32])();
 
 void VsyncThings()
 {
+	ProfileEnter(PROF_IDLE);
 	SysUpdate();
+	ProfileLeave();
 
 	// start capture?
 	if ( (Movie.startAvi) || (Movie.startWav) )
@@ -91,30 +96,36 @@ void VsyncThings()
 }
 
 extern int iVSyncFlag;
+
+// the end of a frame, right after the instruction during which the vsync came:
+// pauses for frame advance, saves states which were waiting for one, and gives the Lua script its turn
+static void VsyncBoundary()
+{
+	if (iGpuHasUpdated || iFrameAdvance || iDoPauseAtVSync) {
+		if (iSaveStateTo) {
+			WIN32_SaveState(iSaveStateTo==10?0:iSaveStateTo);
+			//WIN32_SaveState(Movie.currentFrame);
+			iSaveStateTo = 0;
+		}		
+		if (iFrameAdvance || iDoPauseAtVSync)
+		{			
+			iPause = 1;
+		}				
+		iDoPauseAtVSync = 0;
+		iFrameAdvance = 0;				
+		iGpuHasUpdated = 0;
+	}
+	iVSyncFlag = 0;
+	PSXjin_LuaFrameBoundary();
+	ProfileFrame();
+	iJoysToPoll = 2;
+}
+
 inline void execI()
 {
 	u32 *code;
 	if (!iPause || iFrameAdvance)
 	{
-		if (iVSyncFlag) {
-			if (iGpuHasUpdated || iFrameAdvance || iDoPauseAtVSync) {
-				if (iSaveStateTo) {
-					WIN32_SaveState(iSaveStateTo==10?0:iSaveStateTo);
-					//WIN32_SaveState(Movie.currentFrame);
-					iSaveStateTo = 0;
-				}		
-				if (iFrameAdvance || iDoPauseAtVSync)
-				{			
-					iPause = 1;
-				}				
-				iDoPauseAtVSync = 0;
-				iFrameAdvance = 0;				
-				iGpuHasUpdated = 0;
-			}
-			iVSyncFlag = 0;
-			PSXjin_LuaFrameBoundary();
-			iJoysToPoll = 2;
-		}
 		code = PSXM(psxRegs.pc);
 		psxRegs.code = code == NULL ? 0 : *code;
 		debugI();
@@ -124,6 +135,7 @@ inline void execI()
 		if(iVSyncFlag)
 		{
 			VsyncThings();
+			VsyncBoundary();
 		}
 	}
 	else {
@@ -821,6 +833,7 @@ void psxCOP0() {
 }
 
 void psxCOP2() {
+	PROFILE_SCOPE(PROF_GTE);
 	psxCP2[_Funct_]();
 }
 
@@ -888,6 +901,75 @@ void (*psxCP2BSC[32])() = {
 	psxNULL, psxNULL, psxNULL, psxNULL, psxNULL, psxNULL, psxNULL, psxNULL
 };
 
+/*********************************************************
+* Loads and stores which check the watchpoints           *
+* (in psxBSC only while there are any, see debugger.h)   *
+*********************************************************/
+
+#define WATCH_READ(op, size, mask) \
+	static void op##Watch() { DebugMemCheck(_oB_ & mask, size, BP_READ); op(); }
+#define WATCH_WRITE(op, size, mask) \
+	static void op##Watch() { u32 addr = _oB_ & mask; op(); DebugMemCheck(addr, size, BP_WRITE); }
+
+WATCH_READ(psxLB, 1, ~0)
+WATCH_READ(psxLH, 2, ~0)
+WATCH_READ(psxLWL, 4, ~3)
+WATCH_READ(psxLW, 4, ~0)
+WATCH_READ(psxLBU, 1, ~0)
+WATCH_READ(psxLHU, 2, ~0)
+WATCH_READ(psxLWR, 4, ~3)
+WATCH_READ(gteLWC2, 4, ~0)
+WATCH_WRITE(psxSB, 1, ~0)
+WATCH_WRITE(psxSH, 2, ~0)
+WATCH_WRITE(psxSWL, 4, ~3)
+WATCH_WRITE(psxSW, 4, ~0)
+WATCH_WRITE(psxSWR, 4, ~3)
+WATCH_WRITE(gteSWC2, 4, ~0)
+
+static const struct { int op, type; void (*plain)(); void (*watched)(); } watchOps[] = {
+	{ 0x20, BP_READ, psxLB, psxLBWatch },   { 0x21, BP_READ, psxLH, psxLHWatch },
+	{ 0x22, BP_READ, psxLWL, psxLWLWatch }, { 0x23, BP_READ, psxLW, psxLWWatch },
+	{ 0x24, BP_READ, psxLBU, psxLBUWatch }, { 0x25, BP_READ, psxLHU, psxLHUWatch },
+	{ 0x26, BP_READ, psxLWR, psxLWRWatch }, { 0x32, BP_READ, gteLWC2, gteLWC2Watch },
+	{ 0x28, BP_WRITE, psxSB, psxSBWatch },  { 0x29, BP_WRITE, psxSH, psxSHWatch },
+	{ 0x2a, BP_WRITE, psxSWL, psxSWLWatch },{ 0x2b, BP_WRITE, psxSW, psxSWWatch },
+	{ 0x2e, BP_WRITE, psxSWR, psxSWRWatch },{ 0x3a, BP_WRITE, gteSWC2, gteSWC2Watch },
+};
+
+/*********************************************************
+* Tracing: while a trace is recorded every entry of      *
+* psxBSC is psxTRACE, and the opcodes are run from       *
+* psxBSCTraced                                           *
+*********************************************************/
+
+static void (*psxBSCTraced[64])();
+static int tracing = 0;
+
+static void psxTRACE() {
+	TraceEntry *entry = TraceBegin();
+	psxBSCTraced[psxRegs.code >> 26]();
+	TraceEnd(entry);
+}
+
+void psxIntSetTrace(int on) {
+	if (on == tracing) return;
+	if (on) {
+		memcpy(psxBSCTraced, psxBSC, sizeof(psxBSC));
+		for (int i = 0; i < 64; i++) psxBSC[i] = psxTRACE;
+	} else {
+		memcpy(psxBSC, psxBSCTraced, sizeof(psxBSC));
+	}
+	tracing = on;
+}
+
+void psxIntSetWatch(int reads, int writes) {
+	void (**table)() = tracing ? psxBSCTraced : psxBSC;
+	for (int i = 0; i < sizeof(watchOps) / sizeof(watchOps[0]); i++) {
+		int watch = watchOps[i].type == BP_READ ? reads : writes;
+		table[watchOps[i].op] = watch ? watchOps[i].watched : watchOps[i].plain;
+	}
+}
+
 
 ///////////////////////////////////////////
 
@@ -898,13 +980,23 @@ static int intInit() {
 static void intReset() {
 }
 
+// the breakpoints are only looked at in a loop of their own, which the cpu is in while there are any
 static void intExecute() {
-	for (;;) execI();
+	for (;;) {
+		while (!dbgExecArmed) execI();
+		while (dbgExecArmed) {
+			DebugExecCheck();
+			execI();
+		}
+	}
 }
 
 static void intExecuteBlock() {
 	branch2 = 0;
-	while (!branch2) execI();
+	while (!branch2) {
+		if (dbgExecArmed) DebugExecCheck();
+		execI();
+	}
 }
 
 static void intClear(u32 Addr, u32 Size) {
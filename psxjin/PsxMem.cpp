@@ -80,6 +80,7 @@ void psxMemReset() {
 	
 	memset(psxM, 0, 0x00200000);
 	memset(psxP, 0, 0x00010000);
+	PSXjinCheatsChanged();
 
 	Config.HLE = 0; //adelikat: Meh, just in case, TODO: delete this variable
 }
@@ -178,6 +179,7 @@ void psxMemWrite8(u32 mem, u8 value) {
 		p = (char *)(psxMemWLUT[t]);
 		if (p != NULL) {
 			*(u8  *)(p + (mem & 0xffff)) = value;
+			PSXjinCheatWriteInform(mem);
 #ifdef PSXREC
 			//if (!Config.Cpu) REC_CLEARM(mem&(~3));
 #endif
@@ -204,6 +206,7 @@ void psxMemWrite16(u32 mem, u16 value) {
 		p = (char *)(psxMemWLUT[t]);
 		if (p != NULL) {
 			*(u16 *)(p + (mem & 0xffff)) = SWAPu16(value);
+			PSXjinCheatWriteInform(mem);
 #ifdef PSXREC
 			//if (!Config.Cpu) REC_CLEARM(mem&(~1));
 #endif
@@ -231,6 +234,7 @@ void psxMemWrite32(u32 mem, u32 value) {
 		p = (char *)(psxMemWLUT[t]);
 		if (p != NULL) {
 			*(u32 *)(p + (mem & 0xffff)) = SWAPu32(value);
+			PSXjinCheatWriteInform(mem);
 #ifdef PSXREC
 			//if (!Config.Cpu) REC_CLEARM(mem);
 #endif
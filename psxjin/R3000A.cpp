@@ -22,6 +22,8 @@
 
 #include "PsxCommon.h"
 #include "CdRom.h"
+#include "cputrace.h"
+#include "pcprofile.h"
 
 // global variables
 R3000Acpu *psxCpu;
@@ -57,7 +59,11 @@ void psxReset() {
 	psxHwReset();
 	psxBiosInit();
 
-	psxExecuteBios();
+	BootSnapshotUsed = LoadBootSnapshot();
+	if (!BootSnapshotUsed) {
+		psxExecuteBios();
+		SaveBootSnapshot();
+	}
 
 #ifdef EMU_LOG
 	EMU_LOG("*BIOS END*\n");
@@ -66,6 +72,9 @@ void psxReset() {
 }
 
 void psxShutdown() {
+	TraceStop();
+	PcProfileStop();
+	FlushMcds();
 	psxMemShutdown();
 	psxBiosShutdown();
 
@@ -119,6 +128,9 @@ void psxException(u32 code, u32 bd) {
 }
 
 void psxBranchTest() {
+	if (pcSampling && PcProfileDue())
+		PcProfileSample();
+
 	if ((psxRegs.cycle - psxNextsCounter) >= psxNextCounter)
 		psxRcntUpdate();
 
@@ -141,6 +153,12 @@ void psxBranchTest() {
 				cdrReadInterrupt();
 			}
 		}
+		if (psxRegs.interrupt & 0x100000) { // cdr play
+			if ((psxRegs.cycle - psxRegs.intCycle[2+18]) >= psxRegs.intCycle[2+18+1]) {
+				psxRegs.interrupt&=~0x100000;
+				cdrPlayInterrupt();
+			}
+		}
 		if (psxRegs.interrupt & 0x01000000) { // gpu dma
 			if ((psxRegs.cycle - psxRegs.intCycle[3+24]) >= psxRegs.intCycle[3+24+1]) {
 				psxRegs.interrupt&=~0x01000000;
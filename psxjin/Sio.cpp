@@ -30,6 +30,7 @@
 
 #include "PsxCommon.h"
 #include "padwin.h"
+#include <io.h>
 
 #ifdef _MSC_VER_
 #pragma warning(disable:4244)
@@ -292,6 +293,128 @@ char* MakeMemCardPath(const char* filename)
 	return str;
 }
 
+// MEMORY CARD FILES
+
+//the cards live in Mcd1Data and Mcd2Data, and are written back to their files on a thread of their own,
+//so that a game saving never waits on the disk. SaveMcd copies the frames written into a shadow of the card
+//and marks them dirty; the thread waits a little for the rest of the save to come in, then writes each run
+//of dirty frames with a single fwrite. FlushMcds writes out whatever is left and commits it to the disk.
+//the cards of a movie aren't backed by a file at all, so that playing it back can't change them.
+#define MCD_FRAMES (MCD_SIZE / 128)
+#define MCD_FLUSH_DELAY 100 // ms
+
+struct McdFile {
+	char name[256];         // the file the card was loaded from
+	int offset;             // the size of the file's header (.mem and .gme files have one)
+	bool detached;          // the card belongs to a movie, and has no file
+	bool uncommitted;       // written since the file was last committed
+	unsigned char dirty[MCD_FRAMES];
+	char shadow[MCD_SIZE];  // what the file should hold, which the thread writes from
+};
+
+static McdFile mcdFiles[2];
+static char mcdFlushData[MCD_SIZE];
+static CRITICAL_SECTION mcdLock;     // around the dirty frames and the shadows
+static CRITICAL_SECTION mcdFileLock; // held while a card's file is written
+static HANDLE mcdThread = NULL;
+static HANDLE mcdWake = NULL;
+static bool mcdInitialized = false;
+
+static void McdInit() {
+	if (mcdInitialized) return;
+	InitializeCriticalSection(&mcdLock);
+	InitializeCriticalSection(&mcdFileLock);
+	mcdInitialized = true;
+}
+
+static int McdFileOffset(char *name) {
+	struct stat buf;
+
+	if (stat(name, &buf) != -1) {
+		if (buf.st_size == MCD_SIZE + 64) return 64;
+		if (buf.st_size == MCD_SIZE + 3904) return 3904;
+	}
+	return 0;
+}
+
+// writes the dirty frames of a card to its file, and commits the file if asked to
+static void McdWriteBack(int mcd, bool commit) {
+	McdFile &card = mcdFiles[mcd];
+	int start[MCD_FRAMES], count[MCD_FRAMES];
+	int runs = 0;
+	char name[256];
+	int offset;
+
+	EnterCriticalSection(&mcdFileLock);
+
+	EnterCriticalSection(&mcdLock);
+	for (int i = 0; i < MCD_FRAMES; i++) {
+		if (!card.dirty[i]) continue;
+		if (runs && start[runs-1] + count[runs-1] == i) count[runs-1]++;
+		else { start[runs] = i; count[runs] = 1; runs++; }
+		memcpy(mcdFlushData + i * 128, card.shadow + i * 128, 128);
+		card.dirty[i] = 0;
+	}
+	strcpy(name, card.name);
+	offset = card.offset;
+	if (runs) card.uncommitted = true;
+	commit = commit && card.uncommitted;
+	if (commit) card.uncommitted = false;
+	LeaveCriticalSection(&mcdLock);
+
+	if (runs || commit) {
+		FILE *f = fopen(name, "r+b");
+		if (f != NULL) {
+			for (int i = 0; i < runs; i++) {
+				fseek(f, offset + start[i] * 128, SEEK_SET);
+				fwrite(mcdFlushData + start[i] * 128, 128, count[i], f);
+			}
+			fflush(f);
+			if (commit) _commit(_fileno(f));
+			fclose(f);
+		}
+		else {
+			// try to create it again if we can't open it
+			EnterCriticalSection(&mcdLock);
+			memcpy(mcdFlushData, card.shadow, MCD_SIZE);
+			LeaveCriticalSection(&mcdLock);
+			ConvertMcd(name, mcdFlushData);
+		}
+	}
+
+	LeaveCriticalSection(&mcdFileLock);
+}
+
+static DWORD WINAPI McdFlushThread(LPVOID) {
+	for (;;) {
+		WaitForSingleObject(mcdWake, INFINITE);
+		// let the rest of the save come in
+		Sleep(MCD_FLUSH_DELAY);
+		McdWriteBack(0, false);
+		McdWriteBack(1, false);
+	}
+	return 0;
+}
+
+void FlushMcd(int mcd) {
+	McdInit();
+	McdWriteBack(mcd - 1, true);
+}
+
+void FlushMcds() {
+	FlushMcd(1);
+	FlushMcd(2);
+}
+
+// makes the card one that only lives in memory, until it is loaded from a file again
+static void DetachMcd(int mcd) {
+	McdInit();
+	FlushMcd(mcd);
+	EnterCriticalSection(&mcdLock);
+	mcdFiles[mcd-1].detached = true;
+	memset(mcdFiles[mcd-1].dirty, 0, MCD_FRAMES);
+	LeaveCriticalSection(&mcdLock);
+}
 
 void LoadMcd(int mcd, char *str) {
 	FILE *f;
@@ -304,6 +427,11 @@ void LoadMcd(int mcd, char *str) {
 	sprintf(z, "Mcd00%d.mcr", mcd);	
 	if (*str == 0) str = MakeMemCardPath(z);
 
+	// a movie's card stays as it is until the movie is done with it
+	if (mcdFiles[mcd-1].detached) return;
+
+	FlushMcd(mcd);
+
 	f = fopen(str, "rb");
 	if (f == NULL) {
 		CreateMcd(str);
@@ -334,6 +462,16 @@ void LoadMcd(int mcd, char *str) {
 		fread(data, 1, MCD_SIZE, f);
 		fclose(f);
 	}
+
+	McdFile &card = mcdFiles[mcd-1];
+	EnterCriticalSection(&mcdLock);
+	strncpy(card.name, str, 255);
+	card.name[255] = 0;
+	card.offset = McdFileOffset(str);
+	card.uncommitted = false;
+	memset(card.dirty, 0, MCD_FRAMES);
+	memcpy(card.shadow, data, MCD_SIZE);
+	LeaveCriticalSection(&mcdLock);
 }
 
 void LoadMcds(char *mcd1, char *mcd2) {
@@ -343,7 +481,37 @@ void LoadMcds(char *mcd1, char *mcd2) {
 
 void SaveMcd(char *mcd, char *data, unsigned long adr, int size) {
 	FILE *f;
-	
+	int n = -1;
+
+	McdInit();
+	if (data == Mcd1Data) n = 0;
+	if (data == Mcd2Data) n = 1;
+
+	char z[32] = "";
+	sprintf(z, "Mcd00%d.mcr", n + 1);
+	if (n >= 0 && *mcd == 0) mcd = MakeMemCardPath(z);
+
+	if (n >= 0 && mcdFiles[n].detached) return;
+	if (adr + size > MCD_SIZE) return;
+
+	// the card's own file is written by the flush thread
+	if (n >= 0 && !strcmp(mcd, mcdFiles[n].name)) {
+		McdFile &card = mcdFiles[n];
+		EnterCriticalSection(&mcdLock);
+		memcpy(card.shadow + adr, data + adr, size);
+		for (unsigned long i = adr / 128; i < (adr + size + 127) / 128; i++)
+			card.dirty[i] = 1;
+		LeaveCriticalSection(&mcdLock);
+
+		if (!mcdThread) {
+			DWORD threadId;
+			mcdWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+			mcdThread = CreateThread(NULL, 0, McdFlushThread, NULL, 0, &threadId);
+		}
+		SetEvent(mcdWake);
+		return;
+	}
+
 	f = fopen(mcd, "r+b");
 	if (f != NULL) {
 		struct stat buf;
@@ -610,51 +778,38 @@ int sioFreeze(EMUFILE *f, int Mode) {
 	return 0;
 }
 
-static void SetTempMemoryCard(char slot) {
-	if (slot == 1) {
-		strncpy(Config.OldMcd1, Config.Mcd1, 256);
-		strncpy(Config.Mcd1, MakeMemCardPath("movie001.tmp"), 256);
-	}
-	else {
-		strncpy(Config.OldMcd2, Config.Mcd2, 256);
-		strncpy(Config.Mcd2, MakeMemCardPath("movie002.tmp"), 256);
+// formats a card in memory, the way CreateMcd formats a file
+static void FormatMcd(char *data) {
+	memset(data, 0, MCD_SIZE);
+	data[0] = 'M';
+	data[1] = 'C';
+	data[127] = 0xe;
+	for (int i = 1; i < 16; i++) { // 15 blocks
+		data[i * 128] = (char)0xa0;
+		data[i * 128 + 127] = (char)0xa0;
 	}
 }
 
+static char *McdData(char slot) {
+	return slot == 1 ? Mcd1Data : Mcd2Data;
+}
+
 void SIO_UnsetTempMemoryCards() {
-	strncpy(Config.Mcd1, Config.OldMcd1, 256);
-	strncpy(Config.Mcd2, Config.OldMcd2, 256);
+	mcdFiles[0].detached = false;
+	mcdFiles[1].detached = false;
 	LoadMcds(Config.Mcd1, Config.Mcd2);
-	remove("memcards\\movie001.tmp");
-	remove("memcards\\movie002.tmp");
 }
 
-static unsigned long SaveMemoryCardEmbed(char *file,char *newfile,char *moviefile) {
+//the card is embedded as it is in memory, without the header its file might have
+static unsigned long SaveMemoryCardEmbed(char slot,char *moviefile) {
 	FILE *infile;
 	gzFile f;
-	char *buffer;
-	unsigned long numbytes;
-
-	//read old mcd file
-	infile = fopen(file, "rb");
-	if(infile == NULL)
-		return 0;
-	fseek(infile, 0L, SEEK_END);
-	numbytes = ftell(infile);
-	fseek(infile, 0L, SEEK_SET);
-	buffer = (char*)calloc(numbytes, sizeof(char));
-	if(buffer == NULL)
-		return 0;
-	fread(buffer, sizeof(char), numbytes, infile);
-	fclose(infile);
-
-	//write new mcd temp file
-	infile = fopen(newfile, "wb");
-	fwrite(buffer,sizeof(char),numbytes,infile);
-	fclose(infile);
+	unsigned long numbytes = MCD_SIZE;
 
 	//write uncompressed mcd size to movie file
 	infile = fopen(moviefile, "ab");
+	if (infile == NULL)
+		return 0;
 	fwrite(&numbytes, 1, 4, infile);
 	fclose(infile);
 
@@ -662,80 +817,77 @@ static unsigned long SaveMemoryCardEmbed(char *file,char *newfile,char *moviefil
 	f = gzopen(moviefile, "ab");
 	if (f == NULL)
 		return 0;
-	gzwrite(f, (void*)buffer, numbytes);
+	gzwrite(f, (void*)McdData(slot), numbytes);
 	gzclose(f);
 
-	free(buffer);
 	return 1;
 }
 
 void SIO_SaveMemoryCardsEmbed(char *file,char slot) {
-	if (slot == 1) {
-		SaveMemoryCardEmbed(Config.Mcd1,MakeMemCardPath("movie001.tmp"),file);
-		SetTempMemoryCard(1);
-	}
-	else {
-		SaveMemoryCardEmbed(Config.Mcd2,MakeMemCardPath("movie001.tmp"),file);
-		SetTempMemoryCard(2);
-	}
+	SaveMemoryCardEmbed(slot,file);
+	DetachMcd(slot);
 }
 
-static int LoadMemoryCardEmbed(char *moviefile,char *newmcdfile,
+static int LoadMemoryCardEmbed(char *moviefile,char slot,
                                unsigned long fileOffsetBegin,unsigned long fileOffsetEnd) {
 	unsigned long embMcdSize;
 	FILE* fp;
-	FILE* fp2;
-	gzFile fs;
+	z_stream zs;
 	uint8 * data;
 	uint8 * embMcdTmp;
 	size_t blockSize = fileOffsetEnd-fileOffsetBegin;
 
+	FormatMcd(McdData(slot));
+	if (blockSize <= 4)
+		return 1;
+
 	embMcdTmp = (uint8*)malloc(blockSize);
 
 	//read embedded mcd size and full compressed mcd file
 	fp = fopen(moviefile,"rb");
+	if (fp == NULL) {
+		free(embMcdTmp);
+		return 1;
+	}
 	fseek(fp, fileOffsetBegin, SEEK_SET);
 	fread(&embMcdSize, 1, 4, fp);
 	fread(embMcdTmp, 1, blockSize-4, fp);
 	fclose(fp);
 
-	//write compressed mcd file to temp destination
-	fp2 = fopen("movie_mcd.tmp","wb");
-	fwrite(embMcdTmp, 1, blockSize-4, fp2);
-	fclose(fp2);
+	//uncompress it (it was written by gzwrite, so it has a gzip header)
+	data=(uint8 *)calloc(embMcdSize, 1);
+	memset(&zs, 0, sizeof(zs));
+	zs.next_in = embMcdTmp;
+	zs.avail_in = blockSize-4;
+	zs.next_out = data;
+	zs.avail_out = embMcdSize;
+	if (inflateInit2(&zs, 16 + MAX_WBITS) == Z_OK) {
+		inflate(&zs, Z_FINISH);
+		inflateEnd(&zs);
+	}
 	free(embMcdTmp);
 
-	//open temp compressed mcd file and uncompress it
-	fs = gzopen("movie_mcd.tmp", "rb");
-	if (!fs)
-		return 1;
-
-	data=(uint8 *)malloc(embMcdSize);
-	gzread(fs, (void *) data, embMcdSize);
-	gzclose(fs);
-	remove("movie_mcd.tmp");
-
-	//write uncompressed mcd to new movie temp destination
-	fp2 = fopen(newmcdfile,"wb");
-	fwrite(data, 1, embMcdSize, fp2);
-	fclose(fp2);
+	//older movies embedded the whole file, header and all
+	unsigned long offset = 0;
+	if (embMcdSize == MCD_SIZE + 64) offset = 64;
+	else if (embMcdSize == MCD_SIZE + 3904) offset = 3904;
+	if (embMcdSize >= offset + MCD_SIZE)
+		memcpy(McdData(slot), data + offset, MCD_SIZE);
 	free(data);
 
 	return 0;
 }
 
 void SIO_LoadMemoryCardsEmbed(char *file) {
-	LoadMemoryCardEmbed(file,MakeMemCardPath("movie001.tmp"),Movie.memoryCard1Offset,Movie.memoryCard2Offset);
-	LoadMemoryCardEmbed(file,MakeMemCardPath("movie002.tmp"),Movie.memoryCard2Offset,Movie.cheatListOffset);
-	SetTempMemoryCard(1);
-	SetTempMemoryCard(2);
-	LoadMcds(Config.Mcd1, Config.Mcd2);
+	DetachMcd(1);
+	DetachMcd(2);
+	LoadMemoryCardEmbed(file,1,Movie.memoryCard1Offset,Movie.memoryCard2Offset);
+	LoadMemoryCardEmbed(file,2,Movie.memoryCard2Offset,Movie.cheatListOffset);
 }
 
 void SIO_ClearMemoryCardsEmbed() {
-	SetTempMemoryCard(1);
-	SetTempMemoryCard(2);
-	LoadMcds(Config.Mcd1, Config.Mcd2);
-	remove(MakeMemCardPath("movie001.tmp"));
-	remove(MakeMemCardPath("movie001.tmp"));
+	DetachMcd(1);
+	DetachMcd(2);
+	FormatMcd(Mcd1Data);
+	FormatMcd(Mcd2Data);
 }
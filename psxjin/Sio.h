@@ -61,6 +61,8 @@ int sioFreeze(EMUFILE *f, int Mode);
 void LoadMcd(int mcd, char *str);
 void LoadMcds(char *mcd1, char *mcd2);
 void SaveMcd(char *mcd, char *data, unsigned long adr, int size);
+void FlushMcd(int mcd);
+void FlushMcds();
 void CreateMcd(char *mcd);
 void ConvertMcd(char *mcd, char *data);
 
@@ -59,6 +59,10 @@ void SaveConfig()
 	WritePrivateProfileString("Plugins", "RCntFix", Str_Tmp, Conf_File);
 	wsprintf(Str_Tmp, "%d", Config.VSyncWA);
 	WritePrivateProfileString("Plugins", "VSyncWA", Str_Tmp, Conf_File);
+	wsprintf(Str_Tmp, "%d", Config.BootSnapshot);
+	WritePrivateProfileString("Plugins", "BootSnapshot", Str_Tmp, Conf_File);
+	wsprintf(Str_Tmp, "%d", Config.CheatsOnWrite);
+	WritePrivateProfileString("Plugins", "CheatsOnWrite", Str_Tmp, Conf_File);
 	SavePADConfig();	
 	for (int i = 0; i <= EMUCMDMAX; i++) 
 	{
@@ -90,6 +94,8 @@ void LoadConfig()
 	Config.PsxOut = GetPrivateProfileInt("Plugins", "PsxOut", 0, Conf_File);
 	Config.RCntFix = GetPrivateProfileInt("Plugins", "RCntFix", 0, Conf_File);
 	Config.VSyncWA = GetPrivateProfileInt("Plugins", "VSyncWA", 0, Conf_File);
+	Config.BootSnapshot = GetPrivateProfileInt("Plugins", "BootSnapshot", 0, Conf_File);
+	Config.CheatsOnWrite = GetPrivateProfileInt("Plugins", "CheatsOnWrite", 0, Conf_File);
 	LoadPADConfig();
 	int temp;
 	for (int i = 0; i <= EMUCMDMAX-1; i++)
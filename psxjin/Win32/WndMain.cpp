@@ -39,8 +39,12 @@
 #include "Debug.h"
 #include "Win32.h"
 #include "../cheat.h"
+#include "../cputrace.h"
+#include "../profiler.h"
+#include "../pcprofile.h"
 #include "../movie.h"
 #include "moviewin.h"
+#include "movieverify.h"
 #include "ram_search.h"
 #include "ramwatch.h"
 #include "CWindow.h"
@@ -260,6 +264,12 @@ int main(int argc, char **argv) {
 	char loadMovie=0;
 	int i;
 	bool luaLoaded = false;
+	bool bootSnapshot = false;
+	char *verifyReport = NULL;
+	char *verifyList = NULL;
+	int verifyJobs = 0;
+	int verifyTimeout = 600;
+	char *traceFile = NULL;
 	printf ("PSXjin\n");
 
 	argv = CommandLineToArgvA(GetCommandLine(), &argc);
@@ -304,8 +314,63 @@ int main(int argc, char **argv) {
 		else if (!strcmp(argv[i], "-startpaused")) {
 			iPause = 1;
 		}
+		else if (!strcmp(argv[i], "-bootsnapshot")) {
+			bootSnapshot = true;
+		}
+		else if (!strcmp(argv[i], "-verify") && i+1 < argc) {
+			// plays the movie at maximum speed, writes the result to a file and quits (see movieverify.cpp)
+			verifyReport = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-verifybatch") && i+2 < argc) {
+			verifyList = argv[++i];
+			verifyReport = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-jobs") && i+1 < argc) {
+			verifyJobs = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-timeout") && i+1 < argc) {
+			// the seconds a movie of -verifybatch may take before it's stopped (0 for no limit)
+			verifyTimeout = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-compressiso") && i+2 < argc) {
+			// converts an image to the compressed .Z format and quits
+			return CDRcompressImage(argv[i+1], argv[i+2]) == 0 ? 0 : 1;
+		}
+		else if (!strcmp(argv[i], "-trace") && i+1 < argc) {
+			// records every instruction the cpu runs (see cputrace.cpp)
+			traceFile = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-profile")) {
+			// times the subsystems in each frame, writing the times to a file if one is given (see profiler.h)
+			if (i+1 < argc && argv[i+1][0] != '-')
+				ProfileStart(argv[++i]);
+			else
+				ProfileStart(NULL);
+		}
+		else if (!strcmp(argv[i], "-pcprofile") && i+1 < argc) {
+			// samples where the game's code spends its time, and writes the folded stacks when emulation stops (see pcprofile.h)
+			PcProfileStart(10000, argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-symbols") && i+1 < argc) {
+			// names the functions in the -pcprofile stacks
+			if (!PcProfileLoadSymbols(argv[++i]))
+				printf("Couldn't read the symbols %s\n", argv[i]);
+		}
+		else if (!strcmp(argv[i], "-tracedump") && i+1 < argc) {
+			// prints a trace from the given instruction on (all of it by default) and quits
+			u32 first = i+2 < argc ? strtoul(argv[i+2], NULL, 0) : 0;
+			u32 count = i+3 < argc ? strtoul(argv[i+3], NULL, 0) : 0xffffffff;
+			return TraceDump(argv[i+1], first, count);
+		}
+		else if (!strcmp(argv[i], "-tracediff") && i+2 < argc) {
+			// prints where two traces stop being the same and quits
+			return TraceDiff(argv[i+1], argv[i+2]);
+		}
 	}
 
+	if (verifyList)
+		return MOV_W32_VerifyBatch(verifyList, verifyReport, verifyJobs, verifyTimeout);
+
 	GetCurrentPath();
 
 	gApp.hInstance = GetModuleHandle(NULL);
@@ -323,6 +388,7 @@ int main(int argc, char **argv) {
 	sprintf(Config.MemCardsDir, "%smemcards\\", szCurrentPath);
 	sprintf(Config.Conf_File, "%s\\psxjin.ini", szCurrentPath);
 	LoadConfig();	//Attempt to load ini, or set default settings
+	if (bootSnapshot) Config.BootSnapshot = 1;
 	Config.enable_extern_analog = false;
 	Config.WriteAnalog = false;
 	strcpy (pConfigFile, Config.Conf_File);
@@ -340,13 +406,19 @@ int main(int argc, char **argv) {
 
 	CreateMainWindow(SW_SHOW);
 
+	if (verifyReport)
+		MOV_W32_VerifyStart(verifyReport);
+	if (traceFile && !TraceStart(traceFile))
+		printf("Couldn't write the trace %s\n", traceFile);
+
 	RecentCDs.GetRecentItemsFromIni(Config.Conf_File, "General");
 	RecentMovies.GetRecentItemsFromIni(Config.Conf_File, "General");
 	RecentLua.GetRecentItemsFromIni(Config.Conf_File, "General");
 
 	char Str[MAX_PATH];
 	
-	if (!luaLoaded && RecentLua.GetAutoLoad()) //If lua wasn't loaded from command line (commandline should override autoload parameters)
+	//a script could change how the movie plays, so the one last used isn't loaded when verifying
+	if (!luaLoaded && !verifyReport && RecentLua.GetAutoLoad()) //If lua wasn't loaded from command line (commandline should override autoload parameters)
 			PSXjin_LoadLuaCode(RecentLua.GetRecentItem(0).c_str());
 
 	//adelikat
@@ -363,6 +435,9 @@ int main(int argc, char **argv) {
 	if (loadMovie)
 	{
 		WIN32_StartMovieReplay(szMovieToLoad);
+		//a movie being verified quits when it gets to the end, so if we're still here it didn't play
+		if (verifyReport)
+			MOV_W32_VerifyFail(VERIFY_EXIT_NOSTART);
 	}
 	else if (RecentMovies.GetAutoLoad())
 	{
@@ -799,7 +874,7 @@ LRESULT WINAPI MainWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
 				//-------------------------------------------------------
 				//Check if Ram Watch file
 				//-------------------------------------------------------
-				if (IsFileExtension(fileDropped, ".img") || IsFileExtension(fileDropped, ".bin") || IsFileExtension(fileDropped, ".iso"))
+				if (IsFileExtension(fileDropped, ".img") || IsFileExtension(fileDropped, ".bin") || IsFileExtension(fileDropped, ".iso") || IsFileExtension(fileDropped, ".Z"))
 				{
 					strcpy(IsoFile, fileDropped.c_str());
 					RunCD(hWnd);
@@ -2405,6 +2480,11 @@ void SysMessage(char *fmt, ...) {
 	va_start(list,fmt);
 	vsprintf(tmp,fmt,list);
 	va_end(list);
+	//nobody is there to close a message box while a movie is verified
+	if (MOV_W32_Verifying()) {
+		printf("%s\n", tmp);
+		return;
+	}
 	MessageBox(0, tmp, _("PSXJIN Message"), 0);
 }
 
@@ -2451,7 +2531,7 @@ void WIN32_StartMovieReplay(char* szFilename)
 		if (! MOV_ReadMovieFile(szFilename,&Movie) ) {
 			char errorMessage[300];
 			sprintf(errorMessage, "Movie file \"%s\" doesn't exist.",szFilename);
-			MessageBox(NULL, errorMessage, NULL, MB_ICONERROR);
+			SysMessage("%s", errorMessage);
 			return;
 		}
 		GetMovieFilenameMini(Movie.movieFilename);
@@ -2472,7 +2552,11 @@ void WIN32_StartMovieReplay(char* szFilename)
 				RamWatchHWnd = CreateDialog(gApp.hInstance, MAKEINTRESOURCE(IDD_RAMWATCH), NULL, (DLGPROC) RamWatchProc);
 			}	//adelikat: Need to do this for Movie autoload
 			OpenPlugins(gApp.hWnd);
+			BootSnapshotBlocked = !Movie.UsingBootSnapshot;
 			SysReset();
+			BootSnapshotBlocked = false;
+			if (Movie.UsingBootSnapshot && !BootSnapshotUsed)
+				printf("the movie was recorded from a boot snapshot, but there isn't one for this bios and disc\n");
 			NeedReset = 0;
 			CheckCdrom();
 			if (LoadCdrom() == -1) {
@@ -2484,6 +2568,8 @@ void WIN32_StartMovieReplay(char* szFilename)
 			Running = 1;
 			RecentMovies.UpdateRecentItems(Movie.movieFilename);
 			MOV_StartMovie(MOVIEMODE_PLAY);
+			if (MOV_W32_Verifying())
+				MOV_W32_VerifyLoaded();
 			psxCpu->Execute();
 		}
 	}
@@ -600,6 +600,11 @@ static BOOL CALLBACK ChtEdtrCallB(HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM
 
 					ListView_SetCheckState(GetDlgItem(hwndDlg,IDC_CHEAT_LIST), curr_idx, Cheat.c[counter].enabled);
 				}
+				if (Cheat.num_codes) {
+					char msg[64];
+					sprintf(msg, "*PSXjin*: %d GameShark codes loaded", (int)Cheat.num_codes);
+					GPUdisplayText(msg);
+				}
 				if (!cheatsEnabled) {
 					cheatsEnabled = 1;
 					GPUdisplayText(_("*PSXjin*: Cheats Enabled"));
@@ -738,6 +743,7 @@ static BOOL CALLBACK ChtEdtrCallB(HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM
 						}
 					}
 				}
+				PSXjinCheatsChanged();
 				PSXjinSaveCheatFile(nameo);
 				break;
 			}
@@ -866,6 +872,7 @@ static BOOL CALLBACK ChtEdtrCallB(HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM
 					}
 				}
 
+				PSXjinCheatsChanged();
 				if (!cheatsEnabled) {
 					cheatsEnabled = 1;
 					GPUdisplayText(_("*PSXjin*: Cheats Enabled"));
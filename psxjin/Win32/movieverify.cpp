@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "../PsxCommon.h"
+#include "Win32.h"
+#include "movieverify.h"
+
+//------------------------------------------------------
+// Batch movie verification.
+//
+// The emulator keeps its whole state in globals, so only one instance can run in a process.
+// Verifying many movies at once therefore runs each one in a process of its own:
+// -verifybatch starts a copy of the emulator per (disc, movie) pair, as many at a time as there are cores,
+// and each copy plays its movie at maximum speed with -verify, writes how it went to a file and quits.
+// A copy which can't load its movie quits at once, and one which takes too long is stopped.
+//
+// The list has a line per movie: disc|movie|expected checksum (the checksum may be left out).
+// The report has a line per movie: disc,movie,status,frames,lag frames,fps,checksum.
+// The checksum is a crc32 of main ram and the cpu and gte registers at the end of the movie.
+//------------------------------------------------------
+
+static bool verifying = false;
+static char verifyReport[MAX_PATH];
+static DWORD verifyStartTime;
+
+void MOV_W32_VerifyStart(const char* reportFile)
+{
+	strncpy(verifyReport, reportFile, MAX_PATH-1);
+	verifying = true;
+	Config.PauseAfterPlayback = 0;
+	SetEmulationSpeed(EMUSPEED_MAXIMUM);
+}
+
+bool MOV_W32_Verifying()
+{
+	return verifying;
+}
+
+// called when the disc and movie are loaded and the movie starts, so that the loading isn't counted in the fps
+void MOV_W32_VerifyLoaded()
+{
+	verifyStartTime = timeGetTime();
+}
+
+// called when the movie can't be played; quits without writing a result
+void MOV_W32_VerifyFail(int exitCode)
+{
+	psxShutdown();
+	ReleasePlugins();
+	exit(exitCode);
+}
+
+// called when the movie being verified has played to the end; writes the result and quits
+void MOV_W32_VerifyEnd()
+{
+	DWORD elapsed = timeGetTime() - verifyStartTime;
+	u32 crc = crc32(0, (const Bytef*)psxM, 0x00200000);
+	crc = crc32(crc, (const Bytef*)&psxRegs, offsetof(psxRegisters, code));
+
+	FILE* fp = fopen(verifyReport, "w");
+	if (fp) {
+		fprintf(fp, "%lu,%lu,%.1f,%08x\n", Movie.currentFrame, Movie.lagCounter,
+			elapsed ? Movie.currentFrame * 1000.0 / elapsed : 0.0, crc);
+		fclose(fp);
+	}
+
+	// the ini is left alone, since verifying changed some of the settings
+	psxShutdown();
+	ReleasePlugins();
+	exit(0);
+}
+
+struct VerifyJob {
+	std::string disc;
+	std::string movie;
+	std::string expected;
+	std::string resultFile;
+	HANDLE process;
+	DWORD started;
+};
+
+static std::string Trim(const std::string& s)
+{
+	size_t first = s.find_first_not_of(" \t\r\n");
+	if (first == std::string::npos) return "";
+	return s.substr(first, s.find_last_not_of(" \t\r\n") - first + 1);
+}
+
+static bool ReadVerifyList(const char* listFile, const char* reportFile, std::vector<VerifyJob>& jobs)
+{
+	char line[1024];
+	FILE* fp = fopen(listFile, "r");
+	if (!fp) return false;
+
+	while (fgets(line, sizeof(line), fp)) {
+		std::string s = Trim(line);
+		if (s.empty() || s[0] == '#') continue;
+
+		VerifyJob job;
+		size_t bar1 = s.find('|');
+		if (bar1 == std::string::npos) continue;
+		size_t bar2 = s.find('|', bar1+1);
+		job.disc = Trim(s.substr(0, bar1));
+		job.movie = Trim(s.substr(bar1+1, bar2 == std::string::npos ? std::string::npos : bar2-bar1-1));
+		if (bar2 != std::string::npos)
+			job.expected = Trim(s.substr(bar2+1));
+
+		char resultFile[MAX_PATH];
+		sprintf(resultFile, "%s.%d.tmp", reportFile, (int)jobs.size());
+		job.resultFile = resultFile;
+		job.process = NULL;
+		jobs.push_back(job);
+	}
+	fclose(fp);
+	return true;
+}
+
+static bool StartVerifyJob(VerifyJob& job)
+{
+	char exe[MAX_PATH];
+	GetModuleFileName(NULL, exe, MAX_PATH);
+	remove(job.resultFile.c_str());
+
+	std::string cmd = std::string("\"") + exe + "\" -runcd \"" + job.disc + "\" -play \"" + job.movie +
+		"\" -readonly -verify \"" + job.resultFile + "\"";
+	std::vector<char> cmdline(cmd.begin(), cmd.end());
+	cmdline.push_back(0);
+
+	STARTUPINFO si;
+	PROCESS_INFORMATION pi;
+	memset(&si, 0, sizeof(si));
+	si.cb = sizeof(si);
+	si.dwFlags = STARTF_USESHOWWINDOW;
+	si.wShowWindow = SW_SHOWMINNOACTIVE;
+	if (!CreateProcess(NULL, &cmdline[0], NULL, NULL, FALSE, BELOW_NORMAL_PRIORITY_CLASS, NULL, NULL, &si, &pi))
+		return false;
+	CloseHandle(pi.hThread);
+	job.process = pi.hProcess;
+	job.started = timeGetTime();
+	return true;
+}
+
+static void ReportVerifyJob(FILE* report, VerifyJob& job, DWORD exitCode)
+{
+	char result[256] = "";
+	FILE* fp = fopen(job.resultFile.c_str(), "r");
+	if (fp) {
+		if (!fgets(result, sizeof(result), fp)) result[0] = 0;
+		fclose(fp);
+		remove(job.resultFile.c_str());
+	}
+	std::string r = Trim(result);
+
+	const char* status;
+	char failed[64];
+	if (r.empty()) {
+		if (exitCode == VERIFY_EXIT_NOSTART)
+			status = "failed to load";
+		else if (exitCode == VERIFY_EXIT_TIMEOUT)
+			status = "timed out";
+		else {
+			sprintf(failed, "failed (exit code %lu)", exitCode);
+			status = failed;
+		}
+	}
+	else if (job.expected.empty())
+		status = "no reference";
+	else if (_stricmp(r.substr(r.rfind(',')+1).c_str(), job.expected.c_str()))
+		status = "desync";
+	else
+		status = "ok";
+
+	fprintf(report, "\"%s\",\"%s\",%s,%s\n", job.disc.c_str(), job.movie.c_str(), status, r.empty() ? ",,," : r.c_str());
+	fflush(report);
+	printf("%s: %s\n", job.movie.c_str(), status);
+}
+
+// a job taking longer than timeoutSeconds is stopped and reported as timed out (0 for no limit)
+int MOV_W32_VerifyBatch(const char* listFile, const char* reportFile, int jobs, int timeoutSeconds)
+{
+	std::vector<VerifyJob> list;
+	if (!ReadVerifyList(listFile, reportFile, list)) {
+		printf("Couldn't read the movie list %s\n", listFile);
+		return 1;
+	}
+
+	FILE* report = fopen(reportFile, "w");
+	if (!report) {
+		printf("Couldn't write the report %s\n", reportFile);
+		return 1;
+	}
+	fprintf(report, "disc,movie,status,frames,lag,fps,checksum\n");
+
+	if (jobs <= 0) {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		jobs = info.dwNumberOfProcessors;
+	}
+	if (jobs > MAXIMUM_WAIT_OBJECTS) jobs = MAXIMUM_WAIT_OBJECTS;
+
+	std::vector<int> running;
+	size_t next = 0;
+	while (next < list.size() || !running.empty()) {
+		while (next < list.size() && (int)running.size() < jobs) {
+			if (StartVerifyJob(list[next]))
+				running.push_back(next);
+			else
+				ReportVerifyJob(report, list[next], GetLastError());
+			next++;
+		}
+		if (running.empty()) continue;
+
+		// waits for a job to finish, or until the first of them runs out of time
+		HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+		DWORD now = timeGetTime(), wait = INFINITE;
+		for (size_t i = 0; i < running.size(); i++) {
+			handles[i] = list[running[i]].process;
+			if (timeoutSeconds > 0) {
+				DWORD elapsed = now - list[running[i]].started;
+				DWORD limit = timeoutSeconds * 1000;
+				wait = std::min<DWORD>(wait, elapsed < limit ? limit - elapsed : 0);
+			}
+		}
+		DWORD w = WaitForMultipleObjects(running.size(), handles, FALSE, wait);
+		if (w == WAIT_TIMEOUT) {
+			now = timeGetTime();
+			for (size_t i = 0; i < running.size(); i++) {
+				if (now - list[running[i]].started >= (DWORD)timeoutSeconds * 1000)
+					TerminateProcess(list[running[i]].process, VERIFY_EXIT_TIMEOUT);
+			}
+			// the stopped jobs are reported as they're seen to have ended
+			continue;
+		}
+		if (w >= WAIT_OBJECT_0 + running.size()) break;
+
+		VerifyJob& job = list[running[w - WAIT_OBJECT_0]];
+		DWORD exitCode = 0;
+		GetExitCodeProcess(job.process, &exitCode);
+		CloseHandle(job.process);
+		job.process = NULL;
+		ReportVerifyJob(report, job, exitCode);
+		running.erase(running.begin() + (w - WAIT_OBJECT_0));
+	}
+
+	fclose(report);
+	return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef __W32_MOVIEVERIFY_H__
+#define __W32_MOVIEVERIFY_H__
+
+// the exit codes of a copy of the emulator verifying a movie, when it doesn't get to the end of it
+#define VERIFY_EXIT_NOSTART 2 // the disc or the movie couldn't be loaded
+#define VERIFY_EXIT_TIMEOUT 3 // the batch stopped it for taking too long
+
+void MOV_W32_VerifyStart(const char* reportFile);
+bool MOV_W32_Verifying();
+void MOV_W32_VerifyLoaded();
+void MOV_W32_VerifyEnd();
+void MOV_W32_VerifyFail(int exitCode);
+int MOV_W32_VerifyBatch(const char* listFile, const char* reportFile, int jobs, int timeoutSeconds);
+
+#endif /* __W32_MOVIEVERIFY_H__ */
@@ -6,24 +6,12 @@
 // keep track of the exact number of frames across which each value has changed,
 // without causing the emulation to run noticeably slower than normal.
 //
-// The data representation was changed from one entry per valid address
-// to one entry per contiguous range of uneliminated addresses
-// which references uniform pools of per-address properties.
-// - This saves time when there are many items because
-//   it minimizes the amount of data that needs to be stored and processed per address.
-// - It also saves time when there are few items because
-//   it ensures that no time is wasted in iterating through
-//   addresses that have already been eliminated from the search.
-//
-// The worst-case scenario is when every other item has been
-// eliminated from the search, maximizing the number of regions.
-// This implementation manages to handle even that pathological case
-// acceptably well. In fact, it still updates faster than the previous implementation.
-// The time spent setting up or clearing such a large number of regions
-// is somewhat horrendous, but it seems reasonable to have poor worst-case speed
-// during these sporadic "setup" steps to achieve an all-around faster per-update speed.
-// (You can test this case by performing the search: Modulo 2 Is Specific Address 0)
- 
+// The search itself lives in MemorySearch (memsearch.cpp), which the Lua search library uses as well.
+// It keeps the uneliminated addresses as a bitset over main ram rather than a list of regions,
+// so a search tests 16 bytes at a time and costs the same however the candidates are scattered,
+// and the list box finds its items through a running count of the candidates in each 32 byte word.
+// This window only translates its settings into MemorySearch calls and shows the results.
+
 
 #include "../PsxCommon.h"
 #include "../cheat.h"
@@ -33,6 +21,7 @@
 
 #include "resource.h"
 #include "ram_search.h"
+#include "../memsearch.h"
 #include "ramwatch.h"
 #include <assert.h>
 #include <commctrl.h>
@@ -56,25 +45,8 @@ static inline u8* HardwareToSoftwareAddress(HWAddressType address)
 		return NULL;
 }
 
-
-struct MemoryRegion
-{
-	HWAddressType hardwareAddress; // hardware address of the start of this region
-	unsigned int size; // number of bytes to the end of this region
-	unsigned char* softwareAddress; // pointer to the start of the live emulator source values for this region
-
-	unsigned int virtualIndex; // index into s_prevValues, s_curValues, and s_numChanges, valid after being initialized in ResetMemoryRegions()
-	unsigned int itemIndex; // index into listbox items, valid when s_itemIndicesInvalid is false
-};
-
-int MAX_RAM_SIZE = 0;
-static unsigned char* s_prevValues = 0; // values at last search or reset
-static unsigned char* s_curValues = 0; // values at last frame update
-static unsigned short* s_numChanges = 0; // number of changes of the item starting at this virtual index address
-static MemoryRegion** s_itemIndexToRegionPointer = 0; // used for random access into the memory list (trading memory size to get speed here, too bad it's so much memory), only valid when s_itemIndicesInvalid is false
-static BOOL s_itemIndicesInvalid = true; // if true, the link from listbox items to memory regions (s_itemIndexToRegionPointer) and the link from memory regions to list box items (MemoryRegion::itemIndex) both need to be recalculated
-static BOOL s_prevValuesNeedUpdate = true; // if true, the "prev" values should be updated using the "cur" values on the next frame update signaled
-static unsigned int s_maxItemIndex = 0; // max currently valid item index, the listbox sometimes tries to update things past the end of the list so we need to know this to ignore those attempts
+static MemorySearch* s_search = 0; // created when the window first resets the search
+static CRITICAL_SECTION s_searchCS;
 
 HWND RamSearchHWnd;
 #define hWnd gApp.hWnd
@@ -83,188 +55,9 @@ static char Str_Tmp [1024];
 
 int disableRamSearchUpdate = false;
 
-
-
-//static const MemoryRegion s_prgRegion    = {  0x020000, SEGACD_RAM_PRG_SIZE, (unsigned char*)Ram_Prg,     true};
-//static const MemoryRegion s_word1MRegion = {  0x200000, SEGACD_1M_RAM_SIZE,  (unsigned char*)Ram_Word_1M, true};
-//static const MemoryRegion s_word2MRegion = {  0x200000, SEGACD_2M_RAM_SIZE,  (unsigned char*)Ram_Word_2M, true};
-//static const MemoryRegion s_z80Region    = {  0xA00000, Z80_RAM_SIZE,        (unsigned char*)Ram_Z80,     true};
-//static const MemoryRegion s_68kRegion    = {  0xFF0000, _68K_RAM_SIZE,       (unsigned char*)Ram_68k,     true};
-//static const MemoryRegion s_32xRegion    = {0x06000000, _32X_RAM_SIZE,       (unsigned char*)_32X_Ram,    false};
-
-// list of contiguous uneliminated memory regions
-typedef std::list<MemoryRegion> MemoryList;
-static MemoryList s_activeMemoryRegions;
-static CRITICAL_SECTION s_activeMemoryRegionsCS;
-
-// for undo support (could be better, but this way was really easy)
-static MemoryList s_activeMemoryRegionsBackup;
 static int s_undoType = 0; // 0 means can't undo, 1 means can undo, 2 means can redo
 
 void RamSearchSaveUndoStateIfNotTooBig(HWND hDlg);
-static const int tooManyRegionsForUndo = 10000;
-
-void ResetMemoryRegions()
-{
-//	Clear_Sound_Buffer();
-	EnterCriticalSection(&s_activeMemoryRegionsCS);
-
-	s_activeMemoryRegions.clear();
-
-	// use HardwareToSoftwareAddress to figure out what all the possible memory regions are,
-	// split up wherever there's a discontinuity in the address in our software RAM.
-	static const int regionSearchGranularity = 0x100; // if this is too small, we'll waste time (in this function only), but if any region in RAM isn't evenly divisible by this, we might crash.
-	HWAddressType hwRegionStart = 0;
-	u8* regionStart = NULL;
-	u8* regionEnd = NULL;
-	for(HWAddressType addr = 0; addr != 0x10000000+regionSearchGranularity; addr += regionSearchGranularity)
-	{
-		u8* swAddr = HardwareToSoftwareAddress(addr);
-		if(regionEnd && swAddr != regionEnd+regionSearchGranularity)
-		{
-			// hit end of region
-			// check to see if it mirrors an existing one (in which case we discard it)
-			bool discard = false;
-			for(MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
-			{
-				MemoryRegion& region = *iter;
-				if(region.softwareAddress == regionStart)
-				{
-					unsigned int size = regionSearchGranularity + (regionEnd - regionStart);
-					if(size <= region.size)
-					{
-						discard = true;
-					}
-					else
-					{
-						hwRegionStart += region.size;
-						regionStart += region.size;
-					}
-					break;
-				}
-			}
-			
-			// TODO: don't include ROM in our RAM search (it's too huge)
-
-			// create the region
-			if(!discard)
-			{
-				MemoryRegion region = { hwRegionStart, regionSearchGranularity + (regionEnd - regionStart), regionStart };
-				s_activeMemoryRegions.push_back(region);
-			}
-
-			hwRegionStart = 0;
-			regionStart = NULL;
-			regionEnd = NULL;
-		}
-		if(swAddr)
-		{
-			if(regionStart)
-			{
-				// continue region
-				regionEnd = swAddr;
-			}
-			else
-			{
-				// start new region
-				hwRegionStart = addr;
-				regionStart = swAddr;
-				regionEnd = swAddr;
-			}
-		}
-	}
-
-
-	int nextVirtualIndex = 0;
-	for(MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
-	{
-		MemoryRegion& region = *iter;
-		region.virtualIndex = nextVirtualIndex;
-		assert(((intptr_t)region.softwareAddress & 1) == 0 && "somebody needs to reimplement ReadValueAtSoftwareAddress()");
-		nextVirtualIndex = region.virtualIndex + region.size;
-	}
-	//assert(nextVirtualIndex <= MAX_RAM_SIZE);
-
-	if(nextVirtualIndex > MAX_RAM_SIZE)
-	{
-		s_prevValues = (unsigned char*)realloc(s_prevValues, sizeof(char)*(nextVirtualIndex+4));
-		memset(s_prevValues, 0, sizeof(char)*(nextVirtualIndex+4));
-
-		s_curValues = (unsigned char*)realloc(s_curValues, sizeof(char)*(nextVirtualIndex+4));
-		memset(s_curValues, 0, sizeof(char)*(nextVirtualIndex+4));
-
-		s_numChanges = (unsigned short*)realloc(s_numChanges, sizeof(short)*(nextVirtualIndex+4));
-		memset(s_numChanges, 0, sizeof(short)*(nextVirtualIndex+4));
-
-		s_itemIndexToRegionPointer = (MemoryRegion**)realloc(s_itemIndexToRegionPointer, sizeof(MemoryRegion*)*(nextVirtualIndex+4));
-		memset(s_itemIndexToRegionPointer, 0, sizeof(MemoryRegion*)*(nextVirtualIndex+4));
-
-		MAX_RAM_SIZE = nextVirtualIndex;
-	}
-	LeaveCriticalSection(&s_activeMemoryRegionsCS);
-}
-
-// eliminates a range of hardware addresses from the search results
-// returns 2 if it changed the region and moved the iterator to another region
-// returns 1 if it changed the region but didn't move the iterator
-// returns 0 if it had no effect
-// warning: don't call anything that takes an itemIndex in a loop that calls DeactivateRegion...
-//   doing so would be tremendously slow because DeactivateRegion invalidates the index cache
-int DeactivateRegion(MemoryRegion& region, MemoryList::iterator& iter, HWAddressType hardwareAddress, unsigned int size)
-{
-	if(hardwareAddress + size <= region.hardwareAddress || hardwareAddress >= region.hardwareAddress + region.size)
-	{
-		// region is unaffected
-		return 0;
-	}
-	else if(hardwareAddress > region.hardwareAddress && hardwareAddress + size >= region.hardwareAddress + region.size)
-	{
-		// erase end of region
-		region.size = hardwareAddress - region.hardwareAddress;
-		return 1;
-	}
-	else if(hardwareAddress <= region.hardwareAddress && hardwareAddress + size < region.hardwareAddress + region.size)
-	{
-		// erase start of region
-		int eraseSize = (hardwareAddress + size) - region.hardwareAddress;
-		region.hardwareAddress += eraseSize;
-		region.size -= eraseSize;
-		region.softwareAddress += eraseSize;
-		region.virtualIndex += eraseSize;
-		return 1;
-	}
-	else if(hardwareAddress <= region.hardwareAddress && hardwareAddress + size >= region.hardwareAddress + region.size)
-	{
-		// erase entire region
-		iter = s_activeMemoryRegions.erase(iter);
-		s_itemIndicesInvalid = TRUE;
-		return 2;
-	}
-	else //if(hardwareAddress > region.hardwareAddress && hardwareAddress + size < region.hardwareAddress + region.size)
-	{
-		// split region
-		int eraseSize = (hardwareAddress + size) - region.hardwareAddress;
-		MemoryRegion region2 = {region.hardwareAddress + eraseSize, region.size - eraseSize, region.softwareAddress + eraseSize, region.virtualIndex + eraseSize};
-		region.size = hardwareAddress - region.hardwareAddress;
-		iter = s_activeMemoryRegions.insert(++iter, region2);
-		s_itemIndicesInvalid = TRUE;
-		return 2;
-	}
-}
-
-/*
-// eliminates a range of hardware addresses from the search results
-// this is a simpler but usually slower interface for the above function
-void DeactivateRegion(HWAddressType hardwareAddress, unsigned int size)
-{
-	for(MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); )
-	{
-		MemoryRegion& region = *iter;
-		if(2 != DeactivateRegion(region, iter, hardwareAddress, size))
-			++iter;
-	}
-}
-*/
 
 struct AutoCritSect
 {
@@ -273,508 +66,89 @@ struct AutoCritSect
 	CRITICAL_SECTION* m_cs;
 };
 
-// warning: can be slow
-void CalculateItemIndices(int itemSize)
-{
-	AutoCritSect cs(&s_activeMemoryRegionsCS);
-	unsigned int itemIndex = 0;
-	for(MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
-	{
-		MemoryRegion& region = *iter;
-		region.itemIndex = itemIndex;
-		int startSkipSize = ((unsigned int)(itemSize - (unsigned int)region.hardwareAddress)) % itemSize; // FIXME: is this still ok?
-		unsigned int start = startSkipSize;
-		unsigned int end = region.size;
-		for(unsigned int i = start; i < end; i += itemSize)
-			s_itemIndexToRegionPointer[itemIndex++] = &region;
-	}
-	s_maxItemIndex = itemIndex;
-	s_itemIndicesInvalid = FALSE;
-}
+char rs_c='s';
+char rs_o='=';
+char rs_t='s';
+int rs_param=0, rs_val=0, rs_val_valid=0;
+char rs_type_size = 'b', rs_last_type_size = rs_type_size;
+bool noMisalign = true, rs_last_no_misalign = noMisalign;
+//bool littleEndian = false;
+int last_rs_possible = -1;
+int last_rs_regions = -1;
 
-template<typename stepType, typename compareType>
-void UpdateRegionT(const MemoryRegion& region, const MemoryRegion* nextRegionPtr)
+static MemorySearch::Kind SearchKind(char c)
 {
-	//if(GetAsyncKeyState(VK_SHIFT) & 0x8000) // speed hack
-	//	return;
-
-	if(s_prevValuesNeedUpdate)
-		memcpy(s_prevValues + region.virtualIndex, s_curValues + region.virtualIndex, region.size + sizeof(compareType) - sizeof(stepType));
-
-	unsigned int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
-
-
-	unsigned char* sourceAddr = region.softwareAddress - region.virtualIndex;
-
-	unsigned int indexStart = region.virtualIndex + startSkipSize;
-	unsigned int indexEnd = region.virtualIndex + region.size;
-
-	if(sizeof(compareType) == 1)
+	switch(c)
 	{
-		for(unsigned int i = indexStart; i < indexEnd; i++)
-		{
-			if(s_curValues[i] != sourceAddr[i]) // if value changed
-			{
-				s_curValues[i] = sourceAddr[i]; // update value
-				//if(s_numChanges[i] != 0xFFFF)
-					s_numChanges[i]++; // increase change count
-			}
-		}
-	}
-	else // it's more complicated for non-byte sizes because:
-	{    // - more than one byte can affect a given change count entry
-	     // - when more than one of those bytes changes simultaneously the entry's change count should only increase by 1
-	     // - a few of those bytes can be outside the region
-
-		unsigned int endSkipSize = ((unsigned int)(startSkipSize - region.size)) % sizeof(stepType);
-		unsigned int lastIndexToRead = indexEnd + endSkipSize + sizeof(compareType) - sizeof(stepType);
-		unsigned int lastIndexToCopy = lastIndexToRead;
-		if(nextRegionPtr)
-		{
-			const MemoryRegion& nextRegion = *nextRegionPtr;
-			int nextStartSkipSize = ((unsigned int)(sizeof(stepType) - nextRegion.hardwareAddress)) % sizeof(stepType);
-			unsigned int nextIndexStart = nextRegion.virtualIndex + nextStartSkipSize;
-			if(lastIndexToCopy > nextIndexStart)
-				lastIndexToCopy = nextIndexStart;
-		}
-
-		unsigned int nextValidChange [sizeof(compareType)];
-		for(unsigned int i = 0; i < sizeof(compareType); i++)
-			nextValidChange[i] = indexStart + i;
-
-		for(unsigned int i = indexStart, j = 0; i < lastIndexToRead; i++, j++)
-		{
-			if(s_curValues[i] != sourceAddr[i]) // if value of this byte changed
-			{
-				if(i < lastIndexToCopy)
-					s_curValues[i] = sourceAddr[i]; // update value
-				for(int k = 0; k < sizeof(compareType); k++) // loop through the previous entries that contain this byte
-				{
-					if(i >= indexEnd+k)
-						continue;
-					int m = (j-k+sizeof(compareType)) & (sizeof(compareType)-1);
-					if(nextValidChange[m] <= i) // if we didn't already increase the change count for this entry
-					{
-						//if(s_numChanges[i-k] != 0xFFFF)
-							s_numChanges[i-k]++; // increase the change count for this entry
-						nextValidChange[m] = i-k+sizeof(compareType); // and remember not to increase it again
-					}
-				}
-			}
-		}
+		case 'r': return MemorySearch::Relative;
+		case 'a': return MemorySearch::Address;
+		case 'n': return MemorySearch::Changes;
+		default: return MemorySearch::Specific;
 	}
 }
 
-template<typename stepType, typename compareType>
-void UpdateRegionsT()
+static MemorySearch::Op SearchOp(char o)
 {
-	for(MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end();)
+	switch(o)
 	{
-		const MemoryRegion& region = *iter;
-		++iter;
-		const MemoryRegion* nextRegion = (iter == s_activeMemoryRegions.end()) ? NULL : &*iter;
-
-		UpdateRegionT<stepType, compareType>(region, nextRegion);
+		case '<': return MemorySearch::Less;
+		case '>': return MemorySearch::More;
+		case 'l': return MemorySearch::LessEqual;
+		case 'm': return MemorySearch::MoreEqual;
+		case '!': return MemorySearch::Unequal;
+		case 'd': return MemorySearch::DiffBy;
+		case '%': return MemorySearch::Modulo;
+		default: return MemorySearch::Equal;
 	}
-
-	s_prevValuesNeedUpdate = false;
 }
 
-template<typename stepType, typename compareType>
-int CountRegionItemsT()
+// tells the search which items the window is showing
+static void SetSearchType()
 {
-	AutoCritSect cs(&s_activeMemoryRegionsCS);
-	if(sizeof(stepType) == 1)
-	{
-		if(s_activeMemoryRegions.empty())
-			return 0;
-
-		if(s_itemIndicesInvalid)
-			CalculateItemIndices(sizeof(stepType));
-
-		MemoryRegion& lastRegion = s_activeMemoryRegions.back();
-		return lastRegion.itemIndex + lastRegion.size;
-	}
-	else // the branch above is faster but won't work if the step size isn't 1
-	{
-		int total = 0;
-		for(MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
-		{
-			MemoryRegion& region = *iter;
-			int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
-			total += (region.size - startSkipSize + (sizeof(stepType)-1)) / sizeof(stepType);
-		}
-		return total;
-	}
+	int size = rs_type_size == 'b' ? 1 : rs_type_size == 'w' ? 2 : 4;
+	int step = (rs_type_size=='b' || !noMisalign) ? 1 : 2;
+	s_search->setType(size, rs_t == 's', step);
 }
 
-// returns information about the item in the form of a "fake" region
-// that has the item in it and nothing else
-template<typename stepType, typename compareType>
-void ItemIndexToVirtualRegion(unsigned int itemIndex, MemoryRegion& virtualRegion)
+static unsigned int GetHardwareAddressFromItemIndex(unsigned int itemIndex)
 {
-	if(s_itemIndicesInvalid)
-		CalculateItemIndices(sizeof(stepType));
-
-	if(itemIndex >= s_maxItemIndex)
-	{
-		memset(&virtualRegion, 0, sizeof(MemoryRegion));
-		return;
-	}
-
-	const MemoryRegion* regionPtr = s_itemIndexToRegionPointer[itemIndex];
-	const MemoryRegion& region = *regionPtr;
-
-	int bytesWithinRegion = (itemIndex - region.itemIndex) * sizeof(stepType);
-	int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
-	bytesWithinRegion += startSkipSize;
-	
-	virtualRegion.size = sizeof(compareType);
-	virtualRegion.hardwareAddress = region.hardwareAddress + bytesWithinRegion;
-	virtualRegion.softwareAddress = region.softwareAddress + bytesWithinRegion;
-	virtualRegion.virtualIndex = region.virtualIndex + bytesWithinRegion;
-	virtualRegion.itemIndex = itemIndex;
-	return;
-}
-
-template<typename stepType, typename compareType>
-unsigned int ItemIndexToVirtualIndex(unsigned int itemIndex)
-{
-	MemoryRegion virtualRegion;
-	ItemIndexToVirtualRegion<stepType,compareType>(itemIndex, virtualRegion);
-	return virtualRegion.virtualIndex;
-}
-
-template<typename T>
-T ReadLocalValue(const unsigned char* data)
-{
-	return *(const T*)data;
-}
-//template<> signed char ReadLocalValue(const unsigned char* data) { return *data; }
-//template<> unsigned char ReadLocalValue(const unsigned char* data) { return *data; }
-
-
-template<typename stepType, typename compareType>
-compareType GetPrevValueFromVirtualIndex(unsigned int virtualIndex)
-{
-	return ReadLocalValue<compareType>(s_prevValues + virtualIndex);
-	//return *(compareType*)(s_prevValues+virtualIndex);
-}
-template<typename stepType, typename compareType>
-compareType GetCurValueFromVirtualIndex(unsigned int virtualIndex)
-{
-	return ReadLocalValue<compareType>(s_curValues + virtualIndex);
-//	return *(compareType*)(s_curValues+virtualIndex);
-}
-template<typename stepType, typename compareType>
-unsigned short GetNumChangesFromVirtualIndex(unsigned int virtualIndex)
-{
-	unsigned short num = s_numChanges[virtualIndex];
-	//for(unsigned int i = 1; i < sizeof(stepType); i++)
-	//	if(num < s_numChanges[virtualIndex+i])
-	//		num = s_numChanges[virtualIndex+i];
-	return num;
-}
-
-template<typename stepType, typename compareType>
-compareType GetPrevValueFromItemIndex(unsigned int itemIndex)
-{
-	int virtualIndex = ItemIndexToVirtualIndex<stepType,compareType>(itemIndex);
-	return GetPrevValueFromVirtualIndex<stepType,compareType>(virtualIndex);
-}
-template<typename stepType, typename compareType>
-compareType GetCurValueFromItemIndex(unsigned int itemIndex)
-{
-	int virtualIndex = ItemIndexToVirtualIndex<stepType,compareType>(itemIndex);
-	return GetCurValueFromVirtualIndex<stepType,compareType>(virtualIndex);
-}
-template<typename stepType, typename compareType>
-unsigned short GetNumChangesFromItemIndex(unsigned int itemIndex)
-{
-	int virtualIndex = ItemIndexToVirtualIndex<stepType,compareType>(itemIndex);
-	return GetNumChangesFromVirtualIndex<stepType,compareType>(virtualIndex);
-}
-template<typename stepType, typename compareType>
-unsigned int GetHardwareAddressFromItemIndex(unsigned int itemIndex)
-{
-	MemoryRegion virtualRegion;
-	ItemIndexToVirtualRegion<stepType,compareType>(itemIndex, virtualRegion);
-	return virtualRegion.hardwareAddress;
-}
-
-// this one might be unreliable, haven't used it much
-template<typename stepType, typename compareType>
-unsigned int HardwareAddressToItemIndex(HWAddressType hardwareAddress)
-{
-	if(s_itemIndicesInvalid)
-		CalculateItemIndices(sizeof(stepType));
-
-	for(MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); ++iter)
-	{
-		MemoryRegion& region = *iter;
-		if(hardwareAddress >= region.hardwareAddress && hardwareAddress < region.hardwareAddress + region.size)
-		{
-			int indexWithinRegion = (hardwareAddress - region.hardwareAddress) / sizeof(stepType);
-			return region.itemIndex + indexWithinRegion;
-		}
-	}
-
-	return -1;
+	if(!s_search)
+		return 0;
+	AutoCritSect cs(&s_searchCS);
+	unsigned int address = s_search->addressOf(itemIndex);
+	return address == 0xFFFFFFFF ? 0 : address;
 }
-
-
-
-// workaround for MSVC 7 that doesn't support varadic C99 macros
-#define CALL_WITH_T_SIZE_TYPES_0(functionName, sizeTypeID, isSigned, requiresAligned) \
-	(sizeTypeID == 'b' \
-		? (isSigned \
-			? functionName<char, signed char>() \
-			: functionName<char, unsigned char>()) \
-	: sizeTypeID == 'w' \
-		? (isSigned \
-			? (requiresAligned \
-				? functionName<short, signed short>() \
-				: functionName<char, signed short>()) \
-			: (requiresAligned \
-				? functionName<short, unsigned short>() \
-				: functionName<char, unsigned short>())) \
-	: sizeTypeID == 'd' \
-		? (isSigned \
-			? (requiresAligned \
-				? functionName<short, signed long>() \
-				: functionName<char, signed long>()) \
-			: (requiresAligned \
-				? functionName<short, unsigned long>() \
-				: functionName<char, unsigned long>())) \
-	: functionName<char, signed char>())
-
-#define CALL_WITH_T_SIZE_TYPES_1(functionName, sizeTypeID, isSigned, requiresAligned, p0) \
-	(sizeTypeID == 'b' \
-		? (isSigned \
-			? functionName<char, signed char>(p0) \
-			: functionName<char, unsigned char>(p0)) \
-	: sizeTypeID == 'w' \
-		? (isSigned \
-			? (requiresAligned \
-				? functionName<short, signed short>(p0) \
-				: functionName<char, signed short>(p0)) \
-			: (requiresAligned \
-				? functionName<short, unsigned short>(p0) \
-				: functionName<char, unsigned short>(p0))) \
-	: sizeTypeID == 'd' \
-		? (isSigned \
-			? (requiresAligned \
-				? functionName<short, signed long>(p0) \
-				: functionName<char, signed long>(p0)) \
-			: (requiresAligned \
-				? functionName<short, unsigned long>(p0) \
-				: functionName<char, unsigned long>(p0))) \
-	: functionName<char, signed char>(p0))
-
-#define CALL_WITH_T_SIZE_TYPES_3(functionName, sizeTypeID, isSigned, requiresAligned, p0, p1, p2) \
-	(sizeTypeID == 'b' \
-		? (isSigned \
-			? functionName<char, signed char>(p0, p1, p2) \
-			: functionName<char, unsigned char>(p0, p1, p2)) \
-	: sizeTypeID == 'w' \
-		? (isSigned \
-			? (requiresAligned \
-				? functionName<short, signed short>(p0, p1, p2) \
-				: functionName<char, signed short>(p0, p1, p2)) \
-			: (requiresAligned \
-				? functionName<short, unsigned short>(p0, p1, p2) \
-				: functionName<char, unsigned short>(p0, p1, p2))) \
-	: sizeTypeID == 'd' \
-		? (isSigned \
-			? (requiresAligned \
-				? functionName<short, signed long>(p0, p1, p2) \
-				: functionName<char, signed long>(p0, p1, p2)) \
-			: (requiresAligned \
-				? functionName<short, unsigned long>(p0, p1, p2) \
-				: functionName<char, unsigned long>(p0, p1, p2))) \
-	: functionName<char, signed char>(p0, p1, p2))
-
-#define CALL_WITH_T_SIZE_TYPES_4(functionName, sizeTypeID, isSigned, requiresAligned, p0, p1, p2, p3) \
-	(sizeTypeID == 'b' \
-		? (isSigned \
-			? functionName<char, signed char>(p0, p1, p2, p3) \
-			: functionName<char, unsigned char>(p0, p1, p2, p3)) \
-	: sizeTypeID == 'w' \
-		? (isSigned \
-			? (requiresAligned \
-				? functionName<short, signed short>(p0, p1, p2, p3) \
-				: functionName<char, signed short>(p0, p1, p2, p3)) \
-			: (requiresAligned \
-				? functionName<short, unsigned short>(p0, p1, p2, p3) \
-				: functionName<char, unsigned short>(p0, p1, p2, p3))) \
-	: sizeTypeID == 'd' \
-		? (isSigned \
-			? (requiresAligned \
-				? functionName<short, signed long>(p0, p1, p2, p3) \
-				: functionName<char, signed long>(p0, p1, p2, p3)) \
-			: (requiresAligned \
-				? functionName<short, unsigned long>(p0, p1, p2, p3) \
-				: functionName<char, unsigned long>(p0, p1, p2, p3))) \
-	: functionName<char, signed char>(p0, p1, p2, p3))
-
-// version that takes a forced comparison type
-#define CALL_WITH_T_STEP_3(functionName, sizeTypeID, type, requiresAligned, p0, p1, p2) \
-	(sizeTypeID == 'b' \
-		? functionName<char, type>(p0, p1, p2) \
-	: sizeTypeID == 'w' \
-		? (requiresAligned \
-			? functionName<short, type>(p0, p1, p2) \
-			: functionName<char, type>(p0, p1, p2)) \
-	: sizeTypeID == 'd' \
-		? (requiresAligned \
-			? functionName<short, type>(p0, p1, p2) \
-			: functionName<char, type>(p0, p1, p2)) \
-	: functionName<char, type>(p0, p1, p2))
-
-// version that takes a forced comparison type
-#define CALL_WITH_T_STEP_4(functionName, sizeTypeID, type, requiresAligned, p0, p1, p2, p3) \
-	(sizeTypeID == 'b' \
-		? functionName<char, type>(p0, p1, p2, p3) \
-	: sizeTypeID == 'w' \
-		? (requiresAligned \
-			? functionName<short, type>(p0, p1, p2, p3) \
-			: functionName<char, type>(p0, p1, p2, p3)) \
-	: sizeTypeID == 'd' \
-		? (requiresAligned \
-			? functionName<short, type>(p0, p1, p2, p3) \
-			: functionName<char, type>(p0, p1, p2, p3)) \
-	: functionName<char, type>(p0, p1, p2, p3))
-
-// basic comparison functions:
-template <typename T> inline bool LessCmp (T x, T y, T i)        { return x < y; }
-template <typename T> inline bool MoreCmp (T x, T y, T i)        { return x > y; }
-template <typename T> inline bool LessEqualCmp (T x, T y, T i)   { return x <= y; }
-template <typename T> inline bool MoreEqualCmp (T x, T y, T i)   { return x >= y; }
-template <typename T> inline bool EqualCmp (T x, T y, T i)       { return x == y; }
-template <typename T> inline bool UnequalCmp (T x, T y, T i)     { return x != y; }
-template <typename T> inline bool DiffByCmp (T x, T y, T p)      { return x - y == p || y - x == p; }
-template <typename T> inline bool ModIsCmp (T x, T y, T p)       { return p && x % p == y; }
-
-// compare-to type functions:
-template<typename stepType, typename T>
-void SearchRelative (bool(*cmpFun)(T,T,T), T ignored, T param)
+static unsigned int GetCurValueFromItemIndex(unsigned int itemIndex)
 {
-	for(MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); )
-	{
-		MemoryRegion& region = *iter;
-		int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
-		unsigned int start = region.virtualIndex + startSkipSize;
-		unsigned int end = region.virtualIndex + region.size;
-		for(unsigned int i = start, hwaddr = region.hardwareAddress; i < end; i += sizeof(stepType), hwaddr += sizeof(stepType))
-			if(!cmpFun(GetCurValueFromVirtualIndex<stepType,T>(i), GetPrevValueFromVirtualIndex<stepType,T>(i), param))
-				if(2 == DeactivateRegion(region, iter, hwaddr, sizeof(stepType)))
-					goto outerContinue;
-		++iter;
-outerContinue:
-		continue;
-	}
+	return s_search ? s_search->current(GetHardwareAddressFromItemIndex(itemIndex)) : 0;
 }
-template<typename stepType, typename T>
-void SearchSpecific (bool(*cmpFun)(T,T,T), T value, T param)
+static unsigned int GetPrevValueFromItemIndex(unsigned int itemIndex)
 {
-	for(MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); )
-	{
-		MemoryRegion& region = *iter;
-		int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
-		unsigned int start = region.virtualIndex + startSkipSize;
-		unsigned int end = region.virtualIndex + region.size;
-		for(unsigned int i = start, hwaddr = region.hardwareAddress; i < end; i += sizeof(stepType), hwaddr += sizeof(stepType))
-			if(!cmpFun(GetCurValueFromVirtualIndex<stepType,T>(i), value, param))
-				if(2 == DeactivateRegion(region, iter, hwaddr, sizeof(stepType)))
-					goto outerContinue;
-		++iter;
-outerContinue:
-		continue;
-	}
+	return s_search ? s_search->previous(GetHardwareAddressFromItemIndex(itemIndex)) : 0;
 }
-template<typename stepType, typename T>
-void SearchAddress (bool(*cmpFun)(T,T,T), T address, T param)
+static unsigned short GetNumChangesFromItemIndex(unsigned int itemIndex)
 {
-	for(MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); )
-	{
-		MemoryRegion& region = *iter;
-		int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
-		unsigned int start = region.virtualIndex + startSkipSize;
-		unsigned int end = region.virtualIndex + region.size;
-		for(unsigned int i = start, hwaddr = region.hardwareAddress; i < end; i += sizeof(stepType), hwaddr += sizeof(stepType))
-			if(!cmpFun(hwaddr, address, param))
-				if(2 == DeactivateRegion(region, iter, hwaddr, sizeof(stepType)))
-					goto outerContinue;
-		++iter;
-outerContinue:
-		continue;
-	}
+	if(!s_search || itemIndex >= (unsigned int)ResultCount)
+		return 0;
+	return s_search->changes(GetHardwareAddressFromItemIndex(itemIndex));
 }
-template<typename stepType, typename T>
-void SearchChanges (bool(*cmpFun)(T,T,T), T changes, T param)
+static int HardwareAddressToItemIndex(HWAddressType hardwareAddress)
 {
-	for(MemoryList::iterator iter = s_activeMemoryRegions.begin(); iter != s_activeMemoryRegions.end(); )
-	{
-		MemoryRegion& region = *iter;
-		int startSkipSize = ((unsigned int)(sizeof(stepType) - region.hardwareAddress)) % sizeof(stepType);
-		unsigned int start = region.virtualIndex + startSkipSize;
-		unsigned int end = region.virtualIndex + region.size;
-		for(unsigned int i = start, hwaddr = region.hardwareAddress; i < end; i += sizeof(stepType), hwaddr += sizeof(stepType))
-			if(!cmpFun(GetNumChangesFromVirtualIndex<stepType,T>(i), changes, param))
-				if(2 == DeactivateRegion(region, iter, hwaddr, sizeof(stepType)))
-					goto outerContinue;
-		++iter;
-outerContinue:
-		continue;
-	}
+	if(!s_search)
+		return -1;
+	AutoCritSect cs(&s_searchCS);
+	return s_search->indexOf(hardwareAddress);
 }
 
-char rs_c='s';
-char rs_o='=';
-char rs_t='s';
-int rs_param=0, rs_val=0, rs_val_valid=0;
-char rs_type_size = 'b', rs_last_type_size = rs_type_size;
-bool noMisalign = true, rs_last_no_misalign = noMisalign;
-//bool littleEndian = false;
-int last_rs_possible = -1;
-int last_rs_regions = -1;
-
 void prune(char c,char o,char t,int v,int p)
 {
-	// repetition-reducing macros
-	#define DO_SEARCH(sf) \
-	switch (o) \
-	{ \
-		case '<': DO_SEARCH_2(LessCmp,sf); break; \
-		case '>': DO_SEARCH_2(MoreCmp,sf); break; \
-		case '=': DO_SEARCH_2(EqualCmp,sf); break; \
-		case '!': DO_SEARCH_2(UnequalCmp,sf); break; \
-		case 'l': DO_SEARCH_2(LessEqualCmp,sf); break; \
-		case 'm': DO_SEARCH_2(MoreEqualCmp,sf); break; \
-		case 'd': DO_SEARCH_2(DiffByCmp,sf); break; \
-		case '%': DO_SEARCH_2(ModIsCmp,sf); break; \
-		default: assert(!"Invalid operator for this search type."); break; \
-	}
+	if(!s_search)
+		return;
 
 	// perform the search, eliminating nonmatching values
-	switch (c)
-	{
-		#define DO_SEARCH_2(CmpFun,sf) CALL_WITH_T_SIZE_TYPES_3(sf, rs_type_size, t, noMisalign, CmpFun,v,p)
-		case 'r': DO_SEARCH(SearchRelative); break;
-		case 's': DO_SEARCH(SearchSpecific); break;
-
-		#undef DO_SEARCH_2
-		#define DO_SEARCH_2(CmpFun,sf) CALL_WITH_T_STEP_3(sf, rs_type_size, unsigned int, noMisalign, CmpFun,v,p)
-		case 'a': DO_SEARCH(SearchAddress); break;
-
-		#undef DO_SEARCH_2
-		#define DO_SEARCH_2(CmpFun,sf) CALL_WITH_T_STEP_3(sf, rs_type_size, unsigned short, noMisalign, CmpFun,v,p)
-		case 'n': DO_SEARCH(SearchChanges); break;
-
-		default: assert(!"Invalid search comparison type."); break;
-	}
-
-	s_prevValuesNeedUpdate = true;
+	EnterCriticalSection(&s_searchCS);
+	s_search->search(SearchKind(c), SearchOp(o), v, p);
+	LeaveCriticalSection(&s_searchCS);
 
 	int prevNumItems = last_rs_possible;
 
@@ -786,30 +160,6 @@ void prune(char c,char o,char t,int v,int p)
 	}
 }
 
-
-
-
-template<typename stepType, typename T>
-bool CompareRelativeAtItem (bool(*cmpFun)(T,T,T), int itemIndex, T ignored, T param)
-{
-	return cmpFun(GetCurValueFromItemIndex<stepType,T>(itemIndex), GetPrevValueFromItemIndex<stepType,T>(itemIndex), param);
-}
-template<typename stepType, typename T>
-bool CompareSpecificAtItem (bool(*cmpFun)(T,T,T), int itemIndex, T value, T param)
-{
-	return cmpFun(GetCurValueFromItemIndex<stepType,T>(itemIndex), value, param);
-}
-template<typename stepType, typename T>
-bool CompareAddressAtItem (bool(*cmpFun)(T,T,T), int itemIndex, T address, T param)
-{
-	return cmpFun(GetHardwareAddressFromItemIndex<stepType,T>(itemIndex), address, param);
-}
-template<typename stepType, typename T>
-bool CompareChangesAtItem (bool(*cmpFun)(T,T,T), int itemIndex, T changes, T param)
-{
-	return cmpFun(GetNumChangesFromItemIndex<stepType,T>(itemIndex), changes, param);
-}
-
 int ReadControlInt(int controlID, bool forceHex, BOOL& success)
 {
 	int rv = 0;
@@ -931,25 +281,11 @@ bool Set_RS_Val()
 
 bool IsSatisfied(int itemIndex)
 {
-	if(!rs_val_valid)
+	if(!rs_val_valid || !s_search)
 		return true;
-	int o = rs_o;
-	switch (rs_c)
-	{
-		#undef DO_SEARCH_2
-		#define DO_SEARCH_2(CmpFun,sf) return CALL_WITH_T_SIZE_TYPES_4(sf, rs_type_size,(rs_t=='s'),noMisalign, CmpFun,itemIndex,rs_val,rs_param);
-		case 'r': DO_SEARCH(CompareRelativeAtItem); break;
-		case 's': DO_SEARCH(CompareSpecificAtItem); break;
-
-		#undef DO_SEARCH_2
-		#define DO_SEARCH_2(CmpFun,sf) return CALL_WITH_T_STEP_4(sf, rs_type_size, unsigned int, noMisalign, CmpFun,itemIndex,rs_val,rs_param);
-		case 'a': DO_SEARCH(CompareAddressAtItem); break;
-
-		#undef DO_SEARCH_2
-		#define DO_SEARCH_2(CmpFun,sf) return CALL_WITH_T_STEP_4(sf, rs_type_size, unsigned short, noMisalign, CmpFun,itemIndex,rs_val,rs_param);
-		case 'n': DO_SEARCH(CompareChangesAtItem); break;
-	}
-	return false;
+	unsigned int address = GetHardwareAddressFromItemIndex(itemIndex);
+	AutoCritSect cs(&s_searchCS);
+	return s_search->satisfies(address, SearchKind(rs_c), SearchOp(rs_o), rs_val, rs_param);
 }
 
 
@@ -1015,73 +351,65 @@ void UpdatePossibilities(int rs_possible, int regions);
 
 void CompactAddrs()
 {
-	int size = (rs_type_size=='b' || !noMisalign) ? 1 : 2;
 	int prevResultCount = ResultCount;
+	int regions = 0;
 
-	CalculateItemIndices(size);
-	ResultCount = CALL_WITH_T_SIZE_TYPES_0(CountRegionItemsT, rs_type_size,rs_t=='s',noMisalign);
+	if(s_search)
+	{
+		AutoCritSect cs(&s_searchCS);
+		ResultCount = s_search->count();
+		regions = s_search->regions();
+	}
+	else
+		ResultCount = 0;
 
-	UpdatePossibilities(ResultCount, (int)s_activeMemoryRegions.size());
+	UpdatePossibilities(ResultCount, regions);
 
 	if(ResultCount != prevResultCount)
 		ListView_SetItemCount(GetDlgItem(RamSearchHWnd,IDC_RAMLIST),ResultCount);
 }
 
-void soft_reset_address_info ()
+// starts the search over from the values in ram now
+static void ResetSearch()
 {
-	s_prevValuesNeedUpdate = false;
-	ResetMemoryRegions();
 	if(!RamSearchHWnd)
 	{
-		EnterCriticalSection(&s_activeMemoryRegionsCS);
-		s_activeMemoryRegions.clear();
-		LeaveCriticalSection(&s_activeMemoryRegionsCS);
+		// the search starts over when the window opens again
 		ResultCount = 0;
+		return;
 	}
-	else
-	{
-		// force s_prevValues to be valid
-		signal_new_frame();
-		s_prevValuesNeedUpdate = true;
-		signal_new_frame();
-	}
-	if(s_numChanges)
-		memset(s_numChanges, 0, (sizeof(*s_numChanges)*(MAX_RAM_SIZE)));
+	if(!s_search)
+		s_search = new MemorySearch();
+	EnterCriticalSection(&s_searchCS);
+	SetSearchType();
+	s_search->reset();
+	LeaveCriticalSection(&s_searchCS);
 	CompactAddrs();
 }
+
+void soft_reset_address_info ()
+{
+	ResetSearch();
+}
 void reset_address_info ()
 {
 	SetRamSearchUndoType(RamSearchHWnd, 0);
-	EnterCriticalSection(&s_activeMemoryRegionsCS);
-	s_activeMemoryRegionsBackup.clear(); // not necessary, but we'll take the time hit here instead of at the next thing that sets up an undo
-	LeaveCriticalSection(&s_activeMemoryRegionsCS);
-	if(s_prevValues)
-		memcpy(s_prevValues, s_curValues, (sizeof(*s_prevValues)*(MAX_RAM_SIZE)));
-	s_prevValuesNeedUpdate = false;
-	ResetMemoryRegions();
-	if(!RamSearchHWnd)
-	{
-		EnterCriticalSection(&s_activeMemoryRegionsCS);
-		s_activeMemoryRegions.clear();
-		LeaveCriticalSection(&s_activeMemoryRegionsCS);
-		ResultCount = 0;
-	}
-	else
-	{
-		// force s_prevValues to be valid
-		signal_new_frame();
-		s_prevValuesNeedUpdate = true;
-		signal_new_frame();
-	}
-	memset(s_numChanges, 0, (sizeof(*s_numChanges)*(MAX_RAM_SIZE)));
-	CompactAddrs();
+	ResetSearch();
 }
 
 void signal_new_frame ()
 {
-	EnterCriticalSection(&s_activeMemoryRegionsCS);
-	CALL_WITH_T_SIZE_TYPES_0(UpdateRegionsT, rs_type_size, rs_t=='s', noMisalign);
-	LeaveCriticalSection(&s_activeMemoryRegionsCS);
+	if(!s_search)
+		return;
+	EnterCriticalSection(&s_searchCS);
+	s_search->update();
+	LeaveCriticalSection(&s_searchCS);
+}
+
+// whether the previous values will be taken from the current ones at the next frame
+static bool PreviousPending()
+{
+	return s_search && s_search->previousPending();
 }
 
 
@@ -1184,8 +512,9 @@ void signal_new_size ()
 	unsigned int itemsPerPage = ListView_GetCountPerPage(lv);
 	unsigned int oldTopIndex = ListView_GetTopIndex(lv);
 	unsigned int oldSelectionIndex = ListView_GetSelectionMark(lv);
-	unsigned int oldTopAddr = CALL_WITH_T_SIZE_TYPES_1(GetHardwareAddressFromItemIndex, rs_last_type_size,rs_t=='s',rs_last_no_misalign, oldTopIndex);
-	unsigned int oldSelectionAddr = CALL_WITH_T_SIZE_TYPES_1(GetHardwareAddressFromItemIndex, rs_last_type_size,rs_t=='s',rs_last_no_misalign, oldSelectionIndex);
+	// the search still has the old item type here
+	unsigned int oldTopAddr = GetHardwareAddressFromItemIndex(oldTopIndex);
+	unsigned int oldSelectionAddr = GetHardwareAddressFromItemIndex(oldSelectionIndex);
 
 	std::vector<AddrRange> selHardwareAddrs;
 	if(numberOfItemsChanged)
@@ -1199,7 +528,7 @@ void signal_new_size ()
 		for(int i = 0; i < selCount; ++i)
 		{
 			watchIndex = ListView_GetNextItem(lv, watchIndex, LVNI_SELECTED);
-			int addr = CALL_WITH_T_SIZE_TYPES_1(GetHardwareAddressFromItemIndex, rs_last_type_size,rs_t=='s',rs_last_no_misalign, watchIndex);
+			int addr = GetHardwareAddressFromItemIndex(watchIndex);
 			if(!selHardwareAddrs.empty() && addr == selHardwareAddrs.back().End())
 				selHardwareAddrs.back().size += size;
 			else if (!(noMisalign && oldSize < newSize && addr % newSize != 0))
@@ -1207,6 +536,12 @@ void signal_new_size ()
 		}
 	}
 
+	if(s_search)
+	{
+		EnterCriticalSection(&s_searchCS);
+		SetSearchType();
+		LeaveCriticalSection(&s_searchCS);
+	}
 	CompactAddrs();
 
 	rs_last_type_size = rs_type_size;
@@ -1215,7 +550,7 @@ void signal_new_size ()
 	if(numberOfItemsChanged)
 	{
 		// restore selection ranges
-		unsigned int newTopIndex = CALL_WITH_T_SIZE_TYPES_1(HardwareAddressToItemIndex, rs_type_size,rs_t=='s',noMisalign, oldTopAddr);
+		unsigned int newTopIndex = HardwareAddressToItemIndex(oldTopAddr);
 		unsigned int newBottomIndex = newTopIndex + itemsPerPage - 1;
 		SendMessage(lv, WM_SETREDRAW, FALSE, 0);
 		ListView_SetItemState(lv, -1, 0, LVIS_SELECTED|LVIS_FOCUSED); // deselect all
@@ -1223,10 +558,10 @@ void signal_new_size ()
 		{
 			// calculate index ranges of this selection
 			const AddrRange& range = selHardwareAddrs[i];
-			int selRangeTop = CALL_WITH_T_SIZE_TYPES_1(HardwareAddressToItemIndex, rs_type_size,rs_t=='s',noMisalign, range.addr);
+			int selRangeTop = HardwareAddressToItemIndex(range.addr);
 			int selRangeBottom = -1;
 			for(int endAddr = range.End()-1; endAddr >= selRangeTop && selRangeBottom == -1; endAddr--)
-				selRangeBottom = CALL_WITH_T_SIZE_TYPES_1(HardwareAddressToItemIndex, rs_type_size,rs_t=='s',noMisalign, endAddr);
+				selRangeBottom = HardwareAddressToItemIndex(endAddr);
 			if(selRangeBottom == -1)
 				selRangeBottom = selRangeTop;
 			if(selRangeTop == -1)
@@ -1316,11 +651,11 @@ void Update_RAM_Search() //keeps RAM values up to date in the search and watch w
 				AutoSearchAutoRetry = true;
 		}
 		reset_address_info();
-		prevValuesNeededUpdate = s_prevValuesNeedUpdate;
+		prevValuesNeededUpdate = PreviousPending();
 	}
 	else
 	{
-		prevValuesNeededUpdate = s_prevValuesNeedUpdate;
+		prevValuesNeededUpdate = PreviousPending();
 		if (RamSearchHWnd)
 		{
 			// update active RAM values
@@ -1340,7 +675,7 @@ void Update_RAM_Search() //keeps RAM values up to date in the search and watch w
 	if(RamSearchHWnd)
 	{
 		HWND lv = GetDlgItem(RamSearchHWnd,IDC_RAMLIST);
-		if(prevValuesNeededUpdate != s_prevValuesNeedUpdate)
+		if(prevValuesNeededUpdate != PreviousPending())
 		{
 			// previous values got updated, refresh everything visible
 			ListView_Update(lv, -1);
@@ -1354,7 +689,7 @@ void Update_RAM_Search() //keeps RAM values up to date in the search and watch w
 			int start = -1;
 			for(int i = top; i <= top+count; i++)
 			{
-				int changeNum = CALL_WITH_T_SIZE_TYPES_1(GetNumChangesFromItemIndex, rs_type_size,rs_t=='s',noMisalign, i); //s_numChanges[i];
+				int changeNum = GetNumChangesFromItemIndex(i);
 				int changed = changeNum != changes[i-top];
 				if(changed)
 					changes[i-top] = changeNum;
@@ -1519,7 +854,12 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
 					break;
 			}
 
-			s_prevValuesNeedUpdate = true;
+			if(s_search)
+			{
+				EnterCriticalSection(&s_searchCS);
+				s_search->updatePrevious();
+				LeaveCriticalSection(&s_searchCS);
+			}
 
 			SendDlgItemMessage(hDlg,IDC_C_AUTOSEARCH,BM_SETCHECK,AutoSearch?BST_CHECKED:BST_UNCHECKED,0);
 			//const char* names[5] = {"Address","Value","Previous","Changes","Notes"};
@@ -1551,7 +891,7 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
 
 			// force possibility count to refresh
 			last_rs_possible--;
-			UpdatePossibilities(ResultCount, (int)s_activeMemoryRegions.size());
+			UpdatePossibilities(ResultCount, s_search ? (int)s_search->regions() : 0);
 			
 			rs_val_valid = Set_RS_Val();
 
@@ -1588,13 +928,13 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
 					{
 						case 0:
 						{
-							int addr = CALL_WITH_T_SIZE_TYPES_1(GetHardwareAddressFromItemIndex, rs_type_size,rs_t=='s',noMisalign, iNum);
+							int addr = GetHardwareAddressFromItemIndex(iNum);
 							sprintf(num,"%08X",addr);
 							Item->item.pszText = num;
 						}	return true;
 						case 1:
 						{
-							int i = CALL_WITH_T_SIZE_TYPES_1(GetCurValueFromItemIndex, rs_type_size,rs_t=='s',noMisalign, iNum);
+							int i = GetCurValueFromItemIndex(iNum);
 							const char* formatString = ((rs_t=='s') ? "%d" : (rs_t=='u') ? "%u" : (rs_type_size=='d' ? "%08X" : rs_type_size=='w' ? "%04X" : "%02X"));
 							switch (rs_type_size)
 							{
@@ -1607,7 +947,7 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
 						}	return true;
 						case 2:
 						{
-							int i = CALL_WITH_T_SIZE_TYPES_1(GetPrevValueFromItemIndex, rs_type_size,rs_t=='s',noMisalign, iNum);
+							int i = GetPrevValueFromItemIndex(iNum);
 							const char* formatString = ((rs_t=='s') ? "%d" : (rs_t=='u') ? "%u" : (rs_type_size=='d' ? "%08X" : rs_type_size=='w' ? "%04X" : "%02X"));
 							switch (rs_type_size)
 							{
@@ -1620,7 +960,7 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
 						}	return true;
 						case 3:
 						{
-							int i = CALL_WITH_T_SIZE_TYPES_1(GetNumChangesFromItemIndex, rs_type_size,rs_t=='s',noMisalign, iNum);
+							int i = GetNumChangesFromItemIndex(iNum);
 							sprintf(num,"%d",i);
 
 							Item->item.pszText = num;
@@ -1776,7 +1116,7 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
 					int watchItemIndex = ListView_GetNextItem(ramListControl, -1, LVNI_SELECTED);
 					while (watchItemIndex >= 0)
 					{
-						unsigned long address = CALL_WITH_T_SIZE_TYPES_1(GetHardwareAddressFromItemIndex, rs_type_size,rs_t=='s',noMisalign, watchItemIndex);
+						unsigned long address = GetHardwareAddressFromItemIndex(watchItemIndex);
 
 						int sizeType = -1;
 						if(rs_type_size == 'b')
@@ -1816,7 +1156,12 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
 					{rv = true; break;}
 				}
 				case IDC_C_RESET_CHANGES:
-					memset(s_numChanges, 0, (sizeof(*s_numChanges)*(MAX_RAM_SIZE)));
+					if(s_search)
+					{
+						EnterCriticalSection(&s_searchCS);
+						s_search->resetChanges();
+						LeaveCriticalSection(&s_searchCS);
+					}
 					ListView_Update(GetDlgItem(hDlg,IDC_RAMLIST), -1);
 					//SetRamSearchUndoType(hDlg, 0);
 					{rv = true; break;}
@@ -1824,21 +1169,10 @@ LRESULT CALLBACK RamSearchProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
 					if(s_undoType>0)
 					{
 //						Clear_Sound_Buffer();
-						EnterCriticalSection(&s_activeMemoryRegionsCS);
-						if(s_activeMemoryRegions.size() < tooManyRegionsForUndo)
-						{
-							MemoryList tempMemoryList = s_activeMemoryRegions;
-							s_activeMemoryRegions = s_activeMemoryRegionsBackup;
-							s_activeMemoryRegionsBackup = tempMemoryList;
-							LeaveCriticalSection(&s_activeMemoryRegionsCS);
-							SetRamSearchUndoType(hDlg, 3 - s_undoType);
-						}
-						else
-						{
-							s_activeMemoryRegions = s_activeMemoryRegionsBackup;
-							LeaveCriticalSection(&s_activeMemoryRegionsCS);
-							SetRamSearchUndoType(hDlg, -1);
-						}
+						EnterCriticalSection(&s_searchCS);
+						s_search->undo();
+						LeaveCriticalSection(&s_searchCS);
+						SetRamSearchUndoType(hDlg, 3 - s_undoType);
 						CompactAddrs();
 						ListView_SetItemState(GetDlgItem(hDlg,IDC_RAMLIST), -1, 0, LVIS_SELECTED); // deselect all
 						ListView_SetSelectionMark(GetDlgItem(hDlg,IDC_RAMLIST), 0);
@@ -1893,7 +1227,7 @@ invalid_field:
 					while (watchItemIndex >= 0)
 					{
 						AddressWatcher tempWatch;
-						tempWatch.Address = CALL_WITH_T_SIZE_TYPES_1(GetHardwareAddressFromItemIndex, rs_type_size,rs_t=='s',noMisalign, watchItemIndex);
+						tempWatch.Address = GetHardwareAddressFromItemIndex(watchItemIndex);
 						tempWatch.Size = rs_type_size;
 						tempWatch.Type = rs_t;
 						tempWatch.WrongEndian = 0; //Replace when I get little endian working
@@ -1923,51 +1257,27 @@ invalid_field:
 					int selCount = ListView_GetSelectedCount(ramListControl);
 					int watchIndex = -1;
 
-					// time-saving trick #1:
 					// condense the selected items into an array of address ranges
 					std::vector<AddrRange> selHardwareAddrs;
 					for(int i = 0, j = 1024; i < selCount; ++i, --j)
 					{
 						watchIndex = ListView_GetNextItem(ramListControl, watchIndex, LVNI_SELECTED);
-						int addr = CALL_WITH_T_SIZE_TYPES_1(GetHardwareAddressFromItemIndex, rs_type_size,rs_t=='s',noMisalign, watchIndex);
+						int addr = GetHardwareAddressFromItemIndex(watchIndex);
 						if(!selHardwareAddrs.empty() && addr == selHardwareAddrs.back().End())
 							selHardwareAddrs.back().size += size;
 						else
 							selHardwareAddrs.push_back(AddrRange(addr,size));
 
-						if(!j) UpdateRamSearchProgressBar(i * 50 / selCount), j = 1024;
+						if(!j) UpdateRamSearchProgressBar(i * 100 / selCount), j = 1024;
 					}
 
 					// now deactivate the ranges
-
-					// time-saving trick #2:
-					// take advantage of the fact that the listbox items must be in the same order as the regions
-					MemoryList::iterator iter = s_activeMemoryRegions.begin();
-					int numHardwareAddrRanges = selHardwareAddrs.size();
-					for(int i = 0, j = 16; i < numHardwareAddrRanges; ++i, --j)
-					{
-						int addr = selHardwareAddrs[i].addr;
-						int size = selHardwareAddrs[i].size;
-						bool affected = false;
-						while(iter != s_activeMemoryRegions.end())
-						{
-							MemoryRegion& region = *iter;
-							int affNow = DeactivateRegion(region, iter, addr, size);
-							if(affNow)
-								affected = true;
-							else if(affected)
-								break;
-							if(affNow != 2)
-								++iter;
-						}
-
-						if(!j) UpdateRamSearchProgressBar(50 + (i * 50 / selCount)), j = 16;
-					}
+					EnterCriticalSection(&s_searchCS);
+					for(unsigned int i = 0; i < selHardwareAddrs.size(); ++i)
+						s_search->eliminate(selHardwareAddrs[i].addr, selHardwareAddrs[i].size);
+					LeaveCriticalSection(&s_searchCS);
 					UpdateRamSearchTitleBar();
 
-					// careful -- if the above two time-saving tricks aren't working,
-					// the runtime can absolutely explode (seconds -> hours) when there are lots of regions
-
 					ListView_SetItemState(ramListControl, -1, 0, LVIS_SELECTED); // deselect all
 					signal_new_size();
 					{rv = true; break;}
@@ -2077,29 +1387,27 @@ void SetRamSearchUndoType(HWND hDlg, int type)
 
 void RamSearchSaveUndoStateIfNotTooBig(HWND hDlg)
 {
-	EnterCriticalSection(&s_activeMemoryRegionsCS);
-	if(s_activeMemoryRegions.size() < tooManyRegionsForUndo)
+	if(!s_search)
 	{
-		s_activeMemoryRegionsBackup = s_activeMemoryRegions;
-		LeaveCriticalSection(&s_activeMemoryRegionsCS);
-		SetRamSearchUndoType(hDlg, 1);
-	}
-	else
-	{
-		LeaveCriticalSection(&s_activeMemoryRegionsCS);
 		SetRamSearchUndoType(hDlg, 0);
+		return;
 	}
+	EnterCriticalSection(&s_searchCS);
+	s_search->saveUndo();
+	LeaveCriticalSection(&s_searchCS);
+	SetRamSearchUndoType(hDlg, 1);
 }
 
 struct InitRamSearch
 {
 	InitRamSearch()
 	{
-		InitializeCriticalSection(&s_activeMemoryRegionsCS);
+		InitializeCriticalSection(&s_searchCS);
 	}
 	~InitRamSearch()
 	{
-		DeleteCriticalSection(&s_activeMemoryRegionsCS);
+		DeleteCriticalSection(&s_searchCS);
+		delete s_search;
 	}
 } initRamSearch;
 
@@ -1,11 +1,286 @@
 #include "PsxCommon.h"
+#include <vector>
+#include <algorithm>
 
 #ifdef WIN32
 #include "Win32.h"
 #endif
 
+//------------------------------------------------------
+// Whenever the cheats change they're compiled into a flat list of patches, which is run straight on
+// main ram at every vsync: no memory map lookups and no Lua write hooks for each cheat in each frame.
+//
+// Besides the byte cheats of the cheat editor, GameShark codes can be loaded from a text cheat list,
+// where each code is a "[name]" line ("[*name]" if it starts enabled) followed by its "XXXXXXXX YYYY" lines:
+//   30aaaaaa 00vv  write the byte v to a          80aaaaaa vvvv  write the halfword v to a
+//   20aaaaaa 00vv  add v to the byte at a         21aaaaaa 00vv  subtract v from the byte at a
+//   10aaaaaa vvvv  add v to the halfword at a     11aaaaaa vvvv  subtract v from the halfword at a
+//   E0aaaaaa 00vv  run the next line if the byte at a is == v (E1 !=, E2 <, E3 >)
+//   D0aaaaaa vvvv  the same for the halfword at a (D1 !=, D2 <, D3 >)
+//   D4000000 vvvv  run the next line if the joker buttons held on pad 1 are v
+//   C0aaaaaa vvvv  run the rest of the code if the halfword at a is v
+//   5000nnss iiii  slide: the 30/80 write on the next line is done n times, s bytes apart, adding i to the value each time
+//   C2aaaaaa nnnn  copy n bytes from a to the address on the next line (80bbbbbb 0000)
+//
+// With Config.CheatsOnWrite the plain writes which aren't under a condition are left out of the frame's list,
+// and are put back instead whenever a cpu write lands on them (see PSXjinCheatWriteInform).
+// DMA into a patched address isn't noticed that way, which is why it's optional. The setting isn't in movies,
+// so it's ignored while one is recorded or played.
+//
+// Writes outside of main ram (a byte cheat on the scratchpad) go through the memory map, at every vsync.
+//------------------------------------------------------
+
 // global variables
 struct SCheatData Cheat;
+uint8 *cheatWatch = NULL;
+
+enum CheatOpType {
+	OP_WRITE8, OP_WRITE16, OP_INC8, OP_DEC8, OP_INC16, OP_DEC16,
+	OP_IF8, OP_IF16, OP_JOKER, OP_COPY,
+	OP_MAPWRITE8, OP_MAPWRITE16 // writes outside of main ram
+};
+
+struct CheatOp {
+	u8  type;
+	u8  cmp;    // the conditions: 0 ==, 1 !=, 2 <, 3 >
+	u16 value;  // the copy's length
+	u32 addr;   // offset in main ram
+	u32 src;    // the copy's source offset
+	u32 skip;   // the conditions: how many of the ops which follow to skip when it fails
+};
+
+static std::vector<CheatOp> cheatOps;    // run at every vsync
+static std::vector<CheatOp> watchedOps;  // put back when the cpu writes over them
+static std::vector<std::pair<u32,u32> > watchIndex; // (word of ram, index in watchedOps), sorted
+static bool cheatsDirty = true;
+static bool watchedApplied = false;
+static bool compiledOnWrite = false; // whether the plain writes were compiled into watchedOps
+
+// applying on write changes what the game reads in the middle of a frame, so a movie can't depend on the setting
+static bool CheatsOnWrite()
+{
+	return Config.CheatsOnWrite && Movie.mode == MOVIEMODE_INACTIVE;
+}
+
+// the buttons held on pad 1, numbered the way the GameShark numbers them (L2 is 0001, Left is 8000)
+static u16 JokerButtons()
+{
+	u16 held = Movie.lastPads1[0].buttonStatus ^ 0xffff;
+	return (u16)((held >> 8) | (held << 8));
+}
+
+static bool CheatCompare(u32 a, const CheatOp& op)
+{
+	switch (op.cmp) {
+		case 0: return a == op.value;
+		case 1: return a != op.value;
+		case 2: return a < op.value;
+		default: return a > op.value;
+	}
+}
+
+static void RunCheatOps(const std::vector<CheatOp>& ops)
+{
+	for (size_t i = 0; i < ops.size(); i++) {
+		const CheatOp& op = ops[i];
+		switch (op.type) {
+			case OP_WRITE8:  psxMu8ref(op.addr) = (u8)op.value; break;
+			case OP_WRITE16: psxMu16ref(op.addr) = SWAPu16(op.value); break;
+			case OP_INC8:    psxMu8ref(op.addr) += (u8)op.value; break;
+			case OP_DEC8:    psxMu8ref(op.addr) -= (u8)op.value; break;
+			case OP_INC16:   psxMu16ref(op.addr) = SWAPu16(psxMu16(op.addr) + op.value); break;
+			case OP_DEC16:   psxMu16ref(op.addr) = SWAPu16(psxMu16(op.addr) - op.value); break;
+			case OP_COPY:    memmove(&psxM[op.addr], &psxM[op.src], op.value); break;
+			case OP_IF8:     if (!CheatCompare(psxMu8(op.addr), op)) i += op.skip; break;
+			case OP_IF16:    if (!CheatCompare(psxMu16(op.addr), op)) i += op.skip; break;
+			case OP_JOKER:   if (JokerButtons() != op.value) i += op.skip; break;
+			case OP_MAPWRITE8:  psxMemWrite8(op.addr, (u8)op.value); break;
+			case OP_MAPWRITE16: psxMemWrite16(op.addr, op.value); break;
+		}
+	}
+}
+
+static CheatOp MakeCheatOp(u8 type, u32 addr, u16 value)
+{
+	CheatOp op;
+	op.type = type;
+	op.cmp = 0;
+	op.value = value;
+	op.addr = addr & (type == OP_WRITE16 || type == OP_INC16 || type == OP_DEC16 || type == OP_IF16 ? 0x1ffffe : 0x1fffff);
+	op.src = 0;
+	op.skip = 0;
+	// main ram and its mirrors take up the first 8MB
+	if ((type == OP_WRITE8 || type == OP_WRITE16) && (addr & 0x1fffffff) >= 0x800000) {
+		op.type = type == OP_WRITE8 ? OP_MAPWRITE8 : OP_MAPWRITE16;
+		op.addr = addr;
+	}
+	return op;
+}
+
+static void EmitCheatOp(const CheatOp& op, int depth)
+{
+	if (compiledOnWrite && depth == 0 && (op.type == OP_WRITE8 || op.type == OP_WRITE16))
+		watchedOps.push_back(op);
+	else
+		cheatOps.push_back(op);
+}
+
+// compiles lines[pos] along with the lines it takes in (the rest of the code, for a C0).
+// returns the position of the line after them, or -1 if the code is malformed
+static int CompileCodeLine(const SCheatLine* lines, int pos, int end, int depth)
+{
+	u32 type = lines[pos].address >> 24;
+	u32 addr = lines[pos].address & 0xffffff;
+	u16 value = lines[pos].value;
+
+	switch (type) {
+		case 0x30: EmitCheatOp(MakeCheatOp(OP_WRITE8, addr, value & 0xff), depth); return pos+1;
+		case 0x80: EmitCheatOp(MakeCheatOp(OP_WRITE16, addr, value), depth); return pos+1;
+		case 0x20: EmitCheatOp(MakeCheatOp(OP_INC8, addr, value & 0xff), depth); return pos+1;
+		case 0x21: EmitCheatOp(MakeCheatOp(OP_DEC8, addr, value & 0xff), depth); return pos+1;
+		case 0x10: EmitCheatOp(MakeCheatOp(OP_INC16, addr, value), depth); return pos+1;
+		case 0x11: EmitCheatOp(MakeCheatOp(OP_DEC16, addr, value), depth); return pos+1;
+
+		case 0x50: {
+			if (pos+1 >= end) return -1;
+			u32 count = (addr >> 8) & 0xff, step = addr & 0xff;
+			u32 writeType = lines[pos+1].address >> 24;
+			u32 writeAddr = lines[pos+1].address & 0xffffff;
+			u16 writeValue = lines[pos+1].value;
+			if (writeType != 0x30 && writeType != 0x80) return -1;
+			for (u32 i = 0; i < count; i++, writeAddr += step, writeValue += value) {
+				if (writeType == 0x30)
+					EmitCheatOp(MakeCheatOp(OP_WRITE8, writeAddr, writeValue & 0xff), depth);
+				else
+					EmitCheatOp(MakeCheatOp(OP_WRITE16, writeAddr, writeValue), depth);
+			}
+			return pos+2;
+		}
+
+		case 0xC2: {
+			if (pos+1 >= end) return -1;
+			CheatOp op = MakeCheatOp(OP_COPY, lines[pos+1].address, 0);
+			op.src = addr & 0x1fffff;
+			op.value = (u16)std::min<u32>(value, 0x200000 - std::max<u32>(op.addr, op.src));
+			EmitCheatOp(op, depth);
+			return pos+2;
+		}
+
+		case 0xD0: case 0xD1: case 0xD2: case 0xD3:
+		case 0xE0: case 0xE1: case 0xE2: case 0xE3:
+		case 0xD4: case 0xC0: {
+			if (pos+1 >= end) return -1;
+			CheatOp op = MakeCheatOp(type == 0xD4 ? OP_JOKER : (type & 0xf0) == 0xE0 ? OP_IF8 : OP_IF16, addr,
+				(type & 0xf0) == 0xE0 ? value & 0xff : value);
+			op.cmp = type == 0xC0 || type == 0xD4 ? 0 : type & 3;
+			size_t at = cheatOps.size();
+			cheatOps.push_back(op);
+
+			int next = CompileCodeLine(lines, pos+1, end, depth+1);
+			if (type == 0xC0) {
+				while (next >= 0 && next < end)
+					next = CompileCodeLine(lines, next, end, depth+1);
+			}
+			cheatOps[at].skip = cheatOps.size() - at - 1;
+			return next;
+		}
+	}
+	return -1;
+}
+
+// adds the ops of a code to the lists; a malformed code adds nothing
+static bool CompileCode(const SCheatCode& code)
+{
+	size_t ops = cheatOps.size(), watched = watchedOps.size();
+	int pos = code.first, end = code.first + code.count;
+	while (pos >= 0 && pos < end)
+		pos = CompileCodeLine(Cheat.lines, pos, end, 0);
+	if (pos < 0) {
+		cheatOps.resize(ops);
+		watchedOps.resize(watched);
+		return false;
+	}
+	return true;
+}
+
+// whether a code compiles, leaving the lists as they were
+static bool CodeIsValid(const SCheatCode& code)
+{
+	size_t ops = cheatOps.size(), watched = watchedOps.size();
+	bool ok = CompileCode(code);
+	cheatOps.resize(ops);
+	watchedOps.resize(watched);
+	return ok;
+}
+
+void PSXjinCompileCheats()
+{
+	uint32 i;
+
+	cheatOps.clear();
+	watchedOps.clear();
+	watchIndex.clear();
+	compiledOnWrite = CheatsOnWrite();
+
+	for (i = 0; i < Cheat.num_cheats; i++) {
+		if (!Cheat.c[i].enabled) continue;
+		if (!Cheat.c[i].saved) {
+			Cheat.c[i].saved_byte = psxMs8(Cheat.c[i].address);
+			Cheat.c[i].saved = TRUE;
+		}
+		EmitCheatOp(MakeCheatOp(OP_WRITE8, Cheat.c[i].address, Cheat.c[i].byte), 0);
+	}
+	for (i = 0; i < Cheat.num_codes; i++)
+		if (Cheat.codes[i].enabled)
+			CompileCode(Cheat.codes[i]);
+
+	// a halfword write can touch two words of ram
+	for (i = 0; i < watchedOps.size(); i++) {
+		u32 first = watchedOps[i].addr >> 2;
+		u32 last = (watchedOps[i].addr + (watchedOps[i].type == OP_WRITE16 ? 1 : 0)) >> 2;
+		for (u32 word = first; word <= last; word++)
+			watchIndex.push_back(std::make_pair(word, i));
+	}
+	std::sort(watchIndex.begin(), watchIndex.end());
+
+	if (watchIndex.empty()) {
+		free(cheatWatch);
+		cheatWatch = NULL;
+	}
+	else {
+		if (!cheatWatch)
+			cheatWatch = (uint8 *)malloc(0x200000 >> 5);
+		memset(cheatWatch, 0, 0x200000 >> 5);
+		for (i = 0; i < watchIndex.size(); i++)
+			cheatWatch[watchIndex[i].first >> 3] |= 1 << (watchIndex[i].first & 7);
+	}
+
+	cheatsDirty = false;
+	watchedApplied = false;
+}
+
+// the cheat list, or main ram, has been changed from outside of here: recompile and put everything back at the next vsync
+void PSXjinCheatsChanged()
+{
+	cheatsDirty = true;
+}
+
+void PSXjinCheatWrite(uint32 mem)
+{
+	if (cheatsDirty || !cheatsEnabled || !watchedApplied || compiledOnWrite != CheatsOnWrite())
+		return;
+
+	u32 word = (mem & 0x1fffff) >> 2;
+	std::vector<std::pair<u32,u32> >::iterator it =
+		std::lower_bound(watchIndex.begin(), watchIndex.end(), std::make_pair(word, 0u));
+	for (; it != watchIndex.end() && it->first == word; ++it) {
+		const CheatOp& op = watchedOps[it->second];
+		if (op.type == OP_WRITE8)
+			psxMu8ref(op.addr) = (u8)op.value;
+		else
+			psxMu16ref(op.addr) = SWAPu16(op.value);
+	}
+}
 
 void PSXjinRemoveCheat (uint32 which1)
 {
@@ -24,6 +299,7 @@ void PSXjinDeleteCheat (uint32 which1)
 		memmove (&Cheat.c[which1], &Cheat.c[which1 + 1],
 		         sizeof (Cheat.c [0]) * (Cheat.num_cheats - which1 - 1));
 		Cheat.num_cheats--; //MK: This used to set it to 0??
+		cheatsDirty = true;
 	}
 }
 
@@ -39,6 +315,7 @@ void PSXjinAddCheat (BOOL enable, BOOL save_current_value,
 			Cheat.c [Cheat.num_cheats].saved = TRUE;
 		}
 		Cheat.num_cheats++;
+		cheatsDirty = true;
 	}
 }
 
@@ -47,36 +324,56 @@ void PSXjinDisableCheat (uint32 which1)
 	if (which1 < Cheat.num_cheats && Cheat.c[which1].enabled) {
 		PSXjinRemoveCheat(which1);
 		Cheat.c[which1].enabled = FALSE;
+		cheatsDirty = true;
 	}
 }
 
-void PSXjinApplyCheat(uint32 which1)
+void PSXjinEnableCheat (uint32 which1)
 {
-	uint32 address = Cheat.c[which1].address;
-
-	if (!Cheat.c[which1].saved)
-		Cheat.c[which1].saved_byte = psxMs8(address);
+	if (which1 < Cheat.num_cheats && !Cheat.c[which1].enabled) {
+		Cheat.c[which1].enabled = TRUE;
+		cheatsDirty = true;
+		PSXjinApplyCheats();
+	}
+}
 
-	psxMemWrite8(address,Cheat.c[which1].byte);
-	Cheat.c [which1].saved = TRUE;
+void PSXjinDisableCode (uint32 which1)
+{
+	if (which1 < Cheat.num_codes && Cheat.codes[which1].enabled) {
+		Cheat.codes[which1].enabled = FALSE;
+		cheatsDirty = true;
+	}
 }
 
-void PSXjinEnableCheat (uint32 which1)
+void PSXjinEnableCode (uint32 which1)
 {
-	if (which1 < Cheat.num_cheats && !Cheat.c[which1].enabled) {
-		Cheat.c[which1].enabled = TRUE;
-		PSXjinApplyCheat(which1);
+	if (which1 < Cheat.num_codes && !Cheat.codes[which1].enabled) {
+		Cheat.codes[which1].enabled = TRUE;
+		cheatsDirty = true;
+		PSXjinApplyCheats();
 	}
 }
 
+void PSXjinClearCodes()
+{
+	Cheat.num_codes = 0;
+	Cheat.num_lines = 0;
+	cheatsDirty = true;
+}
+
 void PSXjinApplyCheats()
 {
-	uint32 i;
-	if (!cheatsEnabled)
+	if (!cheatsEnabled) {
+		watchedApplied = false;
 		return;
-	for (i = 0; i < Cheat.num_cheats; i++)
-		if (Cheat.c[i].enabled)
-			PSXjinApplyCheat(i);
+	}
+	if (cheatsDirty || compiledOnWrite != CheatsOnWrite())
+		PSXjinCompileCheats();
+	if (!watchedApplied) {
+		RunCheatOps(watchedOps);
+		watchedApplied = true;
+	}
+	RunCheatOps(cheatOps);
 }
 
 void PSXjinRemoveCheats()
@@ -89,16 +386,115 @@ void PSXjinRemoveCheats()
 		PSXjinRemoveCheat(i);
 }
 
+// ends the code being read from a text cheat list. a code which is a single byte write
+// goes in the editor's list instead, and a malformed one is dropped
+static BOOL EndCodeListEntry()
+{
+	SCheatCode& code = Cheat.codes[Cheat.num_codes];
+	SCheatLine& line = Cheat.lines[code.first];
+
+	if (code.count == 1 && (line.address >> 24) == 0x30 && Cheat.num_cheats < MAX_CHEATS) {
+		PSXjinAddCheat(code.enabled, FALSE, line.address & 0xffffff, (uint8)line.value);
+		Cheat.c[Cheat.num_cheats-1].saved = FALSE;
+		strncpy(Cheat.c[Cheat.num_cheats-1].name, code.name, 21);
+		Cheat.c[Cheat.num_cheats-1].name[21] = 0;
+		Cheat.num_lines = code.first;
+		return TRUE;
+	}
+	if (code.count == 0 || !CodeIsValid(code)) {
+		Cheat.num_lines = code.first;
+		return FALSE;
+	}
+	Cheat.num_codes++;
+	return TRUE;
+}
+
+static BOOL LoadCodeList(FILE *fs)
+{
+	char text [256];
+	BOOL reading = FALSE, ok = TRUE;
+
+	while (fgets (text, sizeof (text), fs)) {
+		char *s = text, *e;
+		while (isspace ((unsigned char)*s)) s++;
+		e = s + strlen (s);
+		while (e > s && isspace ((unsigned char)e[-1])) *--e = 0;
+		if (!*s || *s == ';' || *s == '#')
+			continue;
+
+		if (*s == '[') {
+			if (reading)
+				ok &= EndCodeListEntry();
+			reading = Cheat.num_codes < MAX_CODES;
+			if (!reading) {
+				ok = FALSE;
+				continue;
+			}
+			SCheatCode& code = Cheat.codes[Cheat.num_codes];
+			code.first = Cheat.num_lines;
+			code.count = 0;
+			code.enabled = s[1] == '*';
+			s += code.enabled ? 2 : 1;
+			if (e > s && e[-1] == ']') *--e = 0;
+			strncpy(code.name, s, sizeof (code.name) - 1);
+			code.name[sizeof (code.name) - 1] = 0;
+		}
+		else {
+			unsigned int address, value;
+			if (!reading || Cheat.num_lines >= MAX_CODE_LINES || sscanf (s, "%8x %4x", &address, &value) != 2) {
+				ok = FALSE;
+				continue;
+			}
+			Cheat.lines[Cheat.num_lines].address = address;
+			Cheat.lines[Cheat.num_lines].value = (uint16)value;
+			Cheat.num_lines++;
+			Cheat.codes[Cheat.num_codes].count++;
+		}
+	}
+	if (reading)
+		ok &= EndCodeListEntry();
+	return ok;
+}
+
+static BOOL SaveCodeList(FILE *fs)
+{
+	uint32 i, j;
+
+	for (i = 0; i < Cheat.num_cheats; i++)
+		fprintf (fs, "[%s%s]\n30%06X %04X\n\n", Cheat.c[i].enabled ? "*" : "", Cheat.c[i].name,
+			Cheat.c[i].address & 0xffffff, Cheat.c[i].byte);
+	for (i = 0; i < Cheat.num_codes; i++) {
+		fprintf (fs, "[%s%s]\n", Cheat.codes[i].enabled ? "*" : "", Cheat.codes[i].name);
+		for (j = 0; j < Cheat.codes[i].count; j++)
+			fprintf (fs, "%08X %04X\n", Cheat.lines[Cheat.codes[i].first + j].address, Cheat.lines[Cheat.codes[i].first + j].value);
+		fprintf (fs, "\n");
+	}
+	return (fclose (fs) == 0);
+}
+
+// a cheat list is either the binary list of byte cheats, or a text list of GameShark codes (see the top of the file)
 BOOL PSXjinLoadCheatFile (const char *filename)
 {
 	FILE *fs = fopen (filename, "rb");
 	uint8 data [28];
+	int first;
 
 	Cheat.num_cheats = 0;
+	PSXjinClearCodes();
 
 	if (!fs)
 		return (FALSE);
 
+	do first = fgetc (fs); while (first == ' ' || first == '\t' || first == '\r' || first == '\n');
+	if (first == '[' || first == ';' || first == '#') {
+		BOOL ok;
+		fseek (fs, 0, SEEK_SET);
+		ok = LoadCodeList (fs);
+		fclose (fs);
+		return ok;
+	}
+	fseek (fs, 0, SEEK_SET);
+
 	while (fread ((void *) data, 1, 28, fs) == 28) {
 		Cheat.c [Cheat.num_cheats].enabled = (data [0] & 4) == 0;
 		Cheat.c [Cheat.num_cheats].byte = data [1];
@@ -115,17 +511,20 @@ BOOL PSXjinLoadCheatFile (const char *filename)
 
 BOOL PSXjinSaveCheatFile (const char *filename)
 {
-	FILE *fs = fopen (filename, "wb");
+	FILE *fs;
 	uint8 data [28];
 	uint32 i;
 
-	if (Cheat.num_cheats == 0) {
+	if (Cheat.num_cheats == 0 && Cheat.num_codes == 0) {
 		(void) remove (filename);
 		return (TRUE);
 	}
 
+	fs = fopen (filename, Cheat.num_codes ? "w" : "wb");
 	if (!fs)
 		return (FALSE);
+	if (Cheat.num_codes)
+		return SaveCodeList (fs);
 
 	for (i = 0; i < Cheat.num_cheats; i++) {
 		memset (data, 0, 28);
@@ -226,7 +625,9 @@ BOOL CHT_LoadCheatFileEmbed(const char *filename)
 	fclose(fp);
 	fclose(fp2);
 
+	// the GameShark codes aren't embedded in movies, so none can be active while one plays
 	Cheat.num_cheats = 0;
+	PSXjinClearCodes();
 
 	fs = gzopen("embcheat.tmp", "rb");
 
@@ -244,6 +645,7 @@ BOOL CHT_LoadCheatFileEmbed(const char *filename)
 	}
 	gzclose(fs);
 	remove("embcheat.tmp");
+	cheatsDirty = true;
 
 	return (TRUE);
 }
@@ -253,4 +655,5 @@ void CHT_ClearCheatFileEmbed() {
 	for (i = 0; i < Cheat.num_cheats; i++)
 		PSXjinDeleteCheat(i);
 	Cheat.num_cheats=0;
+	PSXjinClearCodes();
 }
@@ -13,10 +13,33 @@ struct SCheat
 
 #define MAX_CHEATS 75
 
+// a GameShark code, whose lines are lines[first] to lines[first+count-1] of Cheat.lines
+struct SCheatCode
+{
+	uint32  first;
+	uint32  count;
+	uint8   enabled;
+	char    name [64];
+};
+
+// the top byte of address is the code type
+struct SCheatLine
+{
+	uint32  address;
+	uint16  value;
+};
+
+#define MAX_CODES 256
+#define MAX_CODE_LINES 4096
+
 struct SCheatData
 {
 	struct SCheat  c [MAX_CHEATS];
 	uint32         num_cheats;
+	struct SCheatCode codes [MAX_CODES];
+	uint32         num_codes;
+	struct SCheatLine lines [MAX_CODE_LINES];
+	uint32         num_lines;
 	u8             CRAM [0x200000];
 	u8             *RAM;
 	s32            ALL_BITS [(0x200000 >> 5)];
@@ -51,10 +74,26 @@ void PSXjinDeleteCheat (uint32 which1);
 BOOL PSXjinSaveCheatFile (const char *filename);
 void PSXjinApplyCheats();
 void PSXjinRemoveCheats();
+void PSXjinCheatsChanged();
+void PSXjinCompileCheats();
+void PSXjinEnableCode (uint32 which1);
+void PSXjinDisableCode (uint32 which1);
+void PSXjinClearCodes();
 void PSXjinAddCheat(BOOL enable, BOOL save_current_value, uint32 address, uint8 byte);
 void ScanAddress(const char* str, uint32 *value);
 BOOL CHT_SaveCheatFileEmbed(const char *filename);
 BOOL CHT_LoadCheatFileEmbed(const char *filename);
 void CHT_ClearCheatFileEmbed();
 
+// a bit per word of main ram which a cheat applied on write patches, or NULL
+extern uint8 *cheatWatch;
+void PSXjinCheatWrite(uint32 mem);
+
+// the cpu's writes to main ram tell the cheats applied on write about themselves through here
+static INLINE void PSXjinCheatWriteInform(uint32 mem)
+{
+	if (cheatWatch && (mem & 0x1fffffff) < 0x800000 && (cheatWatch[(mem & 0x1fffff) >> 5] & (1 << ((mem >> 2) & 7))))
+		PSXjinCheatWrite(mem);
+}
+
 #endif /* __CHEAT_H__ */
@@ -0,0 +1,311 @@
+#include "PsxCommon.h"
+#include "cputrace.h"
+
+#define TRACE_VERSION 1
+#define CHUNK_ENTRIES 0x10000
+#define CHUNKS 8
+
+static TraceEntry* chunks[CHUNKS];
+static u32 chunkUsed[CHUNKS];
+
+// chunk numbers count up from 0 for the whole trace; chunk n is kept in chunks[n % CHUNKS]
+static u32 fillChunk, fillPos;
+static u32 handedOff;               // chunks given to the writer (only the cpu thread changes it)
+static volatile LONG chunksReady;   // the same, for the writer to read
+static volatile LONG chunksWritten; // chunks the writer is done with
+static volatile LONG stopping;
+static int pending;                 // instructions begun and not yet finished
+
+// a start or stop asked for during an instruction (by a Lua callback of a memory access) waits for it to finish,
+// since the instruction's entry is still to be written and its opcode table can't be swapped under it
+enum { REQUEST_NONE, REQUEST_START, REQUEST_STOP };
+static int request = REQUEST_NONE;
+static std::string requestFile;
+
+static gzFile traceFile;
+static HANDLE writerThread, chunkReady, chunkFree;
+static bool active = false;
+
+static void WriteChunks()
+{
+	while (chunksWritten < chunksReady) {
+		u32 c = chunksWritten % CHUNKS;
+		gzwrite(traceFile, chunks[c], chunkUsed[c] * sizeof(TraceEntry));
+		InterlockedIncrement(&chunksWritten);
+		SetEvent(chunkFree);
+	}
+}
+
+static DWORD WINAPI TraceWriter(LPVOID)
+{
+	for (;;) {
+		// what's ready is read after stopping, so that the last chunk isn't missed
+		LONG stop = stopping;
+		WriteChunks();
+		if (stop) return 0;
+		WaitForSingleObject(chunkReady, INFINITE);
+	}
+}
+
+// gives the writer the chunks before the one being filled
+static void HandOff()
+{
+	while (handedOff < fillChunk) {
+		handedOff++;
+		InterlockedExchange(&chunksReady, handedOff);
+		SetEvent(chunkReady);
+	}
+}
+
+static void StopNow();
+
+static bool StartNow(const char* filename)
+{
+	if (active) StopNow();
+
+	traceFile = gzopen(filename, "wb1");
+	if (!traceFile) return false;
+
+	TraceHeader header;
+	memcpy(header.magic, "PJTR", 4);
+	header.version = TRACE_VERSION;
+	header.entrySize = sizeof(TraceEntry);
+	gzwrite(traceFile, &header, sizeof(header));
+
+	for (int i = 0; i < CHUNKS; i++) {
+		chunks[i] = (TraceEntry*)malloc(CHUNK_ENTRIES * sizeof(TraceEntry));
+		chunkUsed[i] = CHUNK_ENTRIES;
+	}
+	fillChunk = fillPos = handedOff = 0;
+	chunksReady = chunksWritten = stopping = 0;
+	pending = 0;
+
+	chunkReady = CreateEvent(NULL, FALSE, FALSE, NULL);
+	chunkFree = CreateEvent(NULL, FALSE, FALSE, NULL);
+	writerThread = CreateThread(NULL, 0, TraceWriter, NULL, 0, NULL);
+	active = true;
+	psxIntSetTrace(1);
+	return true;
+}
+
+static void StopNow()
+{
+	if (!active) return;
+	psxIntSetTrace(0);
+	active = false;
+
+	chunkUsed[fillChunk % CHUNKS] = fillPos;
+	fillChunk++;
+	HandOff();
+	InterlockedExchange(&stopping, 1);
+	SetEvent(chunkReady);
+	WaitForSingleObject(writerThread, INFINITE);
+
+	CloseHandle(writerThread);
+	CloseHandle(chunkReady);
+	CloseHandle(chunkFree);
+	gzclose(traceFile);
+	for (int i = 0; i < CHUNKS; i++) {
+		free(chunks[i]);
+		chunks[i] = NULL;
+	}
+}
+
+// while an instruction is pending the start is only asked for, and a file which can't be written is reported when it's tried
+bool TraceStart(const char* filename)
+{
+	if (pending) {
+		request = REQUEST_START;
+		requestFile = filename;
+		return true;
+	}
+	return StartNow(filename);
+}
+
+void TraceStop()
+{
+	if (pending) {
+		request = REQUEST_STOP;
+		return;
+	}
+	request = REQUEST_NONE;
+	StopNow();
+}
+
+static void ApplyRequest()
+{
+	int r = request;
+	request = REQUEST_NONE;
+	if (r == REQUEST_STOP)
+		StopNow();
+	else if (!StartNow(requestFile.c_str()))
+		printf("Couldn't write the trace %s\n", requestFile.c_str());
+}
+
+bool TraceActive()
+{
+	return active;
+}
+
+TraceEntry* TraceBegin()
+{
+	if (fillPos == CHUNK_ENTRIES) {
+		// a chunk can't be written while an instruction in it hasn't finished, so it's handed off in TraceEnd
+		fillChunk++;
+		fillPos = 0;
+		if (!pending) HandOff();
+		while (fillChunk - chunksWritten >= CHUNKS)
+			WaitForSingleObject(chunkFree, INFINITE);
+	}
+	pending++;
+
+	TraceEntry* entry = &chunks[fillChunk % CHUNKS][fillPos++];
+	u32 code = psxRegs.code;
+	u32 op = code >> 26;
+	entry->pc = psxRegs.pc - 4;
+	entry->code = code;
+	entry->cycle = psxRegs.cycle;
+	if ((op >= 0x20 && op <= 0x2e) || op == 0x32 || op == 0x3a)
+		entry->address = psxRegs.GPR.r[(code >> 21) & 31] + (s16)code;
+	else
+		entry->address = 0;
+	return entry;
+}
+
+// the register an instruction writes, or the one a store stores; 0 if there's none
+static int DestReg(u32 code)
+{
+	u32 op = code >> 26, rs = (code >> 21) & 31, rt = (code >> 16) & 31, rd = (code >> 11) & 31;
+
+	switch (op) {
+		case 0x00: // SPECIAL; the code of SYSCALL and BREAK isn't a register
+			return (code & 0x3e) == 0x0c ? 0 : rd;
+		case 0x01: // BLTZAL/BGEZAL
+			return rt & 0x10 ? 31 : 0;
+		case 0x03: // JAL
+			return 31;
+		case 0x10: case 0x12: // MFC0/CFC0, MFC2/CFC2
+			return rs == 0 || rs == 2 ? rt : 0;
+	}
+	if (op >= 0x08 && op <= 0x0f) return rt;
+	if (op >= 0x20 && op <= 0x2e) return rt;
+	return 0;
+}
+
+void TraceEnd(TraceEntry* entry)
+{
+	entry->value = psxRegs.GPR.r[DestReg(entry->code)];
+	if (--pending == 0) {
+		if (handedOff < fillChunk)
+			HandOff();
+		if (request != REQUEST_NONE)
+			ApplyRequest();
+	}
+}
+
+//------------------------------------------------------
+// reading traces
+
+class TraceReader
+{
+public:
+	TraceReader(const char* filename) : pos(0), count(0)
+	{
+		TraceHeader header;
+		file = gzopen(filename, "rb");
+		if (file && (gzread(file, &header, sizeof(header)) != sizeof(header) || memcmp(header.magic, "PJTR", 4) ||
+		             header.version != TRACE_VERSION || header.entrySize != sizeof(TraceEntry))) {
+			gzclose(file);
+			file = NULL;
+		}
+	}
+	~TraceReader() { if (file) gzclose(file); }
+
+	bool ok() const { return file != NULL; }
+
+	// the next entry, or NULL at the end of the trace
+	const TraceEntry* next()
+	{
+		if (pos == count) {
+			int bytes = gzread(file, buffer, sizeof(buffer));
+			count = bytes > 0 ? bytes / sizeof(TraceEntry) : 0;
+			pos = 0;
+			if (!count) return NULL;
+		}
+		return &buffer[pos++];
+	}
+
+private:
+	gzFile file;
+	TraceEntry buffer[4096];
+	u32 pos, count;
+};
+
+static void PrintEntry(const char* prefix, u32 index, const TraceEntry& e)
+{
+	printf("%s%10u  cycle %08x  %08x: %08x  %-32s", prefix, index, e.cycle, e.pc, e.code, disR3000AF(e.code, e.pc));
+	if (e.address) printf("  [%08x]", e.address);
+	if (DestReg(e.code)) printf("  r%d=%08x", DestReg(e.code), e.value);
+	printf("\n");
+}
+
+int TraceDump(const char* filename, u32 first, u32 count)
+{
+	TraceReader trace(filename);
+	if (!trace.ok()) {
+		printf("%s isn't a trace\n", filename);
+		return 2;
+	}
+	const TraceEntry* e;
+	for (u32 index = 0; count && (e = trace.next()); index++) {
+		if (index >= first) {
+			PrintEntry("", index, *e);
+			count--;
+		}
+	}
+	return 0;
+}
+
+int TraceDiff(const char* filenameA, const char* filenameB)
+{
+	TraceReader a(filenameA), b(filenameB);
+	if (!a.ok() || !b.ok()) {
+		printf("%s isn't a trace\n", a.ok() ? filenameB : filenameA);
+		return 2;
+	}
+
+	// the instructions before the difference, which are the same in both
+	const int CONTEXT = 16;
+	TraceEntry context[CONTEXT];
+
+	for (u32 index = 0; ; index++) {
+		const TraceEntry* ea = a.next();
+		const TraceEntry* eb = b.next();
+		if (!ea && !eb) {
+			printf("The traces are the same (%u instructions)\n", index);
+			return 0;
+		}
+		if (ea && eb && !memcmp(ea, eb, sizeof(TraceEntry))) {
+			context[index % CONTEXT] = *ea;
+			continue;
+		}
+
+		if (!ea || !eb) {
+			printf("%s ends after %u instructions, where the other goes on\n", ea ? filenameB : filenameA, index);
+		}
+		else {
+			printf("The traces differ at instruction %u in the", index);
+			if (ea->pc != eb->pc) printf(" pc");
+			if (ea->code != eb->code) printf(" opcode");
+			if (ea->cycle != eb->cycle) printf(" cycle");
+			if (ea->address != eb->address) printf(" address");
+			if (ea->value != eb->value) printf(" value");
+			printf("\n");
+		}
+		for (u32 i = index > CONTEXT ? index - CONTEXT : 0; i < index; i++)
+			PrintEntry("  ", i, context[i % CONTEXT]);
+		if (ea) PrintEntry("A ", index, *ea);
+		if (eb) PrintEntry("B ", index, *eb);
+		return 1;
+	}
+}
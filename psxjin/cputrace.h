@@ -0,0 +1,43 @@
+#ifndef __CPUTRACE_H__
+#define __CPUTRACE_H__
+
+// An instruction-level trace of the cpu, for finding where two builds (or two runs) stop doing the same thing.
+//
+// While a trace is recorded every instruction is put in a ring of chunks, which a thread of its own
+// compresses into the file, so the cpu only stops for the disk when it gets a whole ring ahead of it.
+// The file is gzipped: a TraceHeader, then a TraceEntry per instruction, in the order they were run
+// (the delay slot of a branch comes after the branch).
+
+struct TraceHeader
+{
+	char magic[4]; // "PJTR"
+	u32 version;
+	u32 entrySize;
+};
+
+struct TraceEntry
+{
+	u32 pc;
+	u32 code;
+	u32 cycle;
+	u32 address; // of a load or store, 0 for the other instructions
+	u32 value;   // what's in the register the instruction wrote (or stored) after it ran, 0 if there isn't one
+};
+
+bool TraceStart(const char* filename);
+void TraceStop();
+bool TraceActive();
+
+// around each instruction while a trace is recorded; instructions may be nested (a branch runs its delay slot)
+TraceEntry* TraceBegin();
+void TraceEnd(TraceEntry* entry);
+
+// the command line tools: print a part of a trace, with the instructions disassembled,
+// or the first place where two traces differ. They return the process' exit code
+int TraceDump(const char* filename, u32 first, u32 count);
+int TraceDiff(const char* filenameA, const char* filenameB);
+
+// implemented by the interpreter: runs every opcode through the tracer, or stops doing so
+void psxIntSetTrace(int on);
+
+#endif /* __CPUTRACE_H__ */
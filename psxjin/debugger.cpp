@@ -0,0 +1,181 @@
+#include "PsxCommon.h"
+#include "debugger.h"
+
+// a bit for each type of breakpoint on each 4KB page of the physical address space, so that
+// the instructions and accesses which are nowhere near a breakpoint are let through without looking at the list
+#define PAGE_SHIFT 12
+static u8 pages[0x20000000 >> PAGE_SHIFT];
+
+static std::vector<Breakpoint> breakpoints;
+static int nextId = 1;
+static int armedTypes;
+
+static DebugHandler cycleHandler;
+static void* cycleParam;
+static u32 cycleTarget;
+
+// the pc a pausing breakpoint stopped at, so that the cpu doesn't stop there again as soon as it's unpaused
+static u32 resumePC = 0xffffffff;
+
+int dbgExecArmed = 0;
+
+static void Rearm()
+{
+	armedTypes = 0;
+	memset(pages, 0, sizeof(pages));
+	for (size_t i = 0; i < breakpoints.size(); i++) {
+		const Breakpoint& bp = breakpoints[i];
+		if (!bp.enabled) continue;
+		armedTypes |= bp.type;
+		for (u32 page = bp.start >> PAGE_SHIFT; page <= bp.end >> PAGE_SHIFT; page++)
+			pages[page] |= bp.type;
+	}
+	dbgExecArmed = (armedTypes & BP_EXEC) || cycleHandler;
+	psxIntSetWatch(armedTypes & BP_READ, armedTypes & BP_WRITE);
+}
+
+int DebugAddBreakpoint(int type, u32 start, u32 end, DebugHandler handler, void* param, DebugCondition condition, u32 ignoreHits)
+{
+	Breakpoint bp;
+	bp.id = nextId++;
+	bp.type = type & (BP_EXEC | BP_READ | BP_WRITE);
+	bp.start = start & 0x1fffffff;
+	bp.end = end & 0x1fffffff;
+	if (bp.end < bp.start) bp.end = bp.start;
+	bp.enabled = true;
+	bp.hits = 0;
+	bp.ignoreHits = ignoreHits;
+	bp.condition = condition;
+	bp.handler = handler;
+	bp.param = param;
+	breakpoints.push_back(bp);
+	Rearm();
+	return bp.id;
+}
+
+void DebugRemoveBreakpoint(int id)
+{
+	for (size_t i = 0; i < breakpoints.size(); i++) {
+		if (breakpoints[i].id == id) {
+			breakpoints.erase(breakpoints.begin() + i);
+			Rearm();
+			return;
+		}
+	}
+}
+
+void DebugRemoveBreakpoints(DebugHandler handler)
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < breakpoints.size(); i++)
+		if (breakpoints[i].handler != handler)
+			breakpoints[kept++] = breakpoints[i];
+	breakpoints.resize(kept);
+	Rearm();
+}
+
+void DebugClearBreakpoints()
+{
+	breakpoints.clear();
+	Rearm();
+}
+
+void DebugEnableBreakpoint(int id, bool enabled)
+{
+	Breakpoint* bp = DebugFindBreakpoint(id);
+	if (bp && bp->enabled != enabled) {
+		bp->enabled = enabled;
+		Rearm();
+	}
+}
+
+Breakpoint* DebugFindBreakpoint(int id)
+{
+	for (size_t i = 0; i < breakpoints.size(); i++)
+		if (breakpoints[i].id == id)
+			return &breakpoints[i];
+	return NULL;
+}
+
+const std::vector<Breakpoint>& DebugBreakpoints()
+{
+	return breakpoints;
+}
+
+void DebugBreakAtCycle(u32 cycle, DebugHandler handler, void* param)
+{
+	cycleTarget = cycle;
+	cycleHandler = handler;
+	cycleParam = param;
+	dbgExecArmed = (armedTypes & BP_EXEC) || cycleHandler;
+}
+
+static void Pause(u32 address, int type)
+{
+	char msg[64];
+	sprintf(msg, "Break: %s %08x at %08x", type == BP_EXEC ? "exec" : type == BP_READ ? "read" : "write",
+		address, type == BP_EXEC ? psxRegs.pc : psxRegs.pc - 4);
+	GPUdisplayText(msg);
+	iPause = 1;
+	iFrameAdvance = 0;
+	if (type == BP_EXEC)
+		resumePC = psxRegs.pc;
+}
+
+static void CheckRange(u32 address, int size, int type)
+{
+	u32 first = address & 0x1fffffff, last = first + size - 1;
+	int hit[16], count = 0;
+
+	// the handlers may add and remove breakpoints, so the ones which were hit are found first
+	for (size_t i = 0; i < breakpoints.size() && count < 16; i++) {
+		Breakpoint& bp = breakpoints[i];
+		if (!bp.enabled || !(bp.type & type) || bp.end < first || bp.start > last)
+			continue;
+		if (bp.condition && !bp.condition(address, bp.param))
+			continue;
+		if (++bp.hits <= bp.ignoreHits)
+			continue;
+		hit[count++] = bp.id;
+	}
+
+	for (int i = 0; i < count; i++) {
+		Breakpoint* bp = DebugFindBreakpoint(hit[i]);
+		if (!bp) continue; // an earlier handler removed it
+		if (bp->handler)
+			bp->handler(bp->id, address, size, type, bp->param);
+		else
+			Pause(address, type);
+	}
+}
+
+// called before each instruction while dbgExecArmed is set
+void DebugExecCheck()
+{
+	u32 pc = psxRegs.pc;
+
+	// nothing runs while paused
+	if (iPause && !iFrameAdvance)
+		return;
+
+	if (cycleHandler && (s32)(psxRegs.cycle - cycleTarget) >= 0) {
+		DebugHandler handler = cycleHandler;
+		cycleHandler = NULL;
+		dbgExecArmed = armedTypes & BP_EXEC;
+		handler(-1, pc, 4, BP_EXEC, cycleParam);
+	}
+
+	if (pc == resumePC) {
+		resumePC = 0xffffffff;
+		return;
+	}
+	if (pages[(pc & 0x1fffffff) >> PAGE_SHIFT] & BP_EXEC)
+		CheckRange(pc, 4, BP_EXEC);
+}
+
+// called by the interpreter's watching loads and stores; the reads before they happen and the writes after
+void DebugMemCheck(u32 address, int size, int type)
+{
+	if (pages[(address & 0x1fffffff) >> PAGE_SHIFT] & type)
+		CheckRange(address, size, type);
+}
@@ -0,0 +1,54 @@
+#ifndef __DEBUGGER_H__
+#define __DEBUGGER_H__
+
+#include <vector>
+
+// Execution breakpoints and memory watchpoints.
+//
+// Nothing is checked while there are none: the cpu runs its plain loop, and calls DebugExecCheck before
+// each instruction only while dbgExecArmed is set, and the interpreter swaps its load and store opcodes
+// for ones which call DebugMemCheck only while there are watchpoints of that kind (see psxIntSetWatch).
+// Addresses are physical (any mirror or segment of an address matches it), and the ranges are inclusive.
+
+enum { BP_EXEC = 1, BP_READ = 2, BP_WRITE = 4 };
+
+// a condition is asked each time its breakpoint is reached, and only if it's true does the hit count
+typedef bool (*DebugCondition)(u32 address, void* param);
+// what a breakpoint does when it's hit; the id is -1 for DebugBreakAtCycle
+typedef void (*DebugHandler)(int id, u32 address, int size, int type, void* param);
+
+struct Breakpoint
+{
+	int id;
+	int type;            // BP_EXEC, BP_READ and/or BP_WRITE
+	u32 start, end;
+	bool enabled;
+	u32 hits;            // times it was reached with its condition true
+	u32 ignoreHits;      // hits which go by before it does anything
+	DebugCondition condition;
+	DebugHandler handler; // NULL pauses the emulator
+	void* param;
+};
+
+// returns the id of the new breakpoint
+int DebugAddBreakpoint(int type, u32 start, u32 end, DebugHandler handler = NULL, void* param = NULL,
+                       DebugCondition condition = NULL, u32 ignoreHits = 0);
+void DebugRemoveBreakpoint(int id);
+// removes every breakpoint which calls the handler
+void DebugRemoveBreakpoints(DebugHandler handler);
+void DebugClearBreakpoints();
+void DebugEnableBreakpoint(int id, bool enabled);
+Breakpoint* DebugFindBreakpoint(int id);
+const std::vector<Breakpoint>& DebugBreakpoints();
+
+// calls the handler once, before the first instruction at or past the cycle; a NULL handler cancels it
+void DebugBreakAtCycle(u32 cycle, DebugHandler handler, void* param = NULL);
+
+extern int dbgExecArmed;
+void DebugExecCheck();
+void DebugMemCheck(u32 address, int size, int type);
+
+// implemented by the interpreter: puts the checking loads and stores in its opcode table, or takes them out
+void psxIntSetWatch(int reads, int writes);
+
+#endif /* __DEBUGGER_H__ */
@@ -41,6 +41,7 @@
 #include "fps.h"
 
 #include "../plugins.h"
+#include "../profiler.h"
 
 unsigned long dwGPUVersion=0;
 int           iGPUHeight=512;
@@ -915,7 +916,11 @@ void updateDisplay(void)                               // UPDATE DISPLAY
 
 	if (dwActFixes&32)                                    // pc fps calculation fix
 	{
-		if (UseFrameLimit) PCFrameCap();                    // -> brake
+		if (UseFrameLimit)
+		{
+			PROFILE_SCOPE(PROF_IDLE);
+			PCFrameCap();                                     // -> brake
+		}
 		if (UseFrameSkip || ulKeybits&KEY_SHOWFPS)
 			PCcalcfps();
 	}
@@ -1148,11 +1153,16 @@ void CALLBACK GPUcursor(int iPlayer,int x,int y)
 
 void CALLBACK GPUupdateLace(void)                      // VSYNC
 {
+	PROFILE_SCOPE(PROF_DISPLAY);
+
 	if (!(dwActFixes&1))
 		lGPUstatusRet^=0x80000000;                           // odd/even bit
 
 	if (!(dwActFixes&32))                                 // std fps limitation?
+	{
+		PROFILE_SCOPE(PROF_IDLE);
 		CheckFrameRate();
+	}
 
 	if (!UseFrameSkip)
 		updateDisplay();
@@ -1535,6 +1545,7 @@ void CALLBACK GPUreadDataMem(u32 * pMem, int iSize)
 
 	if (DataReadMode!=DR_VRAMTRANSFER) return;
 
+	PROFILE_SCOPE(PROF_VRAM);
 	GPUIsBusy;
 
 	// adjust read ptr, if necessary
@@ -1692,6 +1703,7 @@ void CALLBACK GPUwriteDataMem(u32* pMem, int iSize)
 	unsigned long gdata=0;
 	int i=0;
 
+	PROFILE_SCOPE(PROF_VRAM);
 	GPUIsBusy;
 	GPUIsNotReadyForCommands;
 
@@ -1803,7 +1815,9 @@ ENDVRAM:
 			if (gpuDataP == gpuDataC)
 			{
 				gpuDataC=gpuDataP=0;
+				ProfileEnter(PROF_GPU);
 				primFunc[gpuCommand]((unsigned char *)gpuDataM);
+				ProfileLeave();
 
 				if (dwEmuFixes&0x0001 || dwActFixes&0x0400)     // hack for emulating "gpu busy" in some games
 					iFakePrimBusy=4;
@@ -12,9 +12,11 @@
 #include <fcntl.h>
 #include <time.h>
 #include <string.h>
+#include <ctype.h>
 #include <zlib.h>
 
 #include <string>
+#include <vector>
 
 #include "cdriso.h"
 #include "cueparse.h"
@@ -33,6 +35,78 @@ int fmode;						// 0 - file / 1 - Zfile
 char *Ztable;
 
 FILE *cdHandle = NULL;
+
+//the image is also mapped into memory when possible, so that reading a sector only has to return a pointer into it.
+//if it can't be mapped (for instance, no room in the address space for a big image) we read it through cdHandle instead.
+static HANDLE mapFile = INVALID_HANDLE_VALUE;
+static HANDLE mapHandle = NULL;
+static unsigned char *mapView = NULL;
+static __int64 mapSize = 0;
+//where cdHandle would be after the last read, for the odd reads which don't seek
+static __int64 readPos = 0;
+
+//readahead: once the cdrom is reading consecutive sectors, a background thread reads the next few into a ring
+//before they are asked for, so the emu thread doesn't wait on the disk. for a mapped image it only touches the pages.
+//sectors are still delivered whenever the cdrom asks for them, so this has no effect on emulation timing.
+#define READAHEAD_SECTORS 32
+
+struct ReadaheadSlot {
+	int sector;       // -1 if empty
+	unsigned char data[CD_FRAMESIZE_RAW]; // the whole raw sector, since cd audio wants all of it
+};
+
+static ReadaheadSlot raSlots[READAHEAD_SECTORS]; // sector s goes in slot s % READAHEAD_SECTORS
+static CRITICAL_SECTION raLock;
+static bool raLockInit = false; // CDRinit is called again on resets, while the readahead may be running
+static HANDLE raThread = NULL;
+static HANDLE raWake = NULL;
+static volatile bool raTerminate;
+static int raWant = -1;           // the first sector the thread should have ready, -1 when it is idle
+static unsigned long raGeneration; // bumped by a seek so that reads already underway are thrown away
+static int raLastSector = -2;
+static std::string raFileName;
+static FILE *raHandle = NULL;     // the thread's own handle, when the image isn't mapped
+unsigned long CDRreadaheadHits, CDRreadaheadMisses;
+static std::string imageKey; // the image's path, size and modification time, so that what's cached about a disc can be kept for it
+
+//.Z images: every sector is compressed with zlib on its own, and the .Z.table file holds a 4 byte offset
+//and a 2 byte compressed length for each one, so any sector can be read directly.
+//decompressed sectors are kept in an LRU cache, which the readahead fills ahead of sequential reads.
+#define ZCACHE_SECTORS 256
+
+struct ZcacheEntry {
+	int sector;       // -1 if empty
+	int prev, next;   // neighbours in the LRU list, -1 at the ends
+	unsigned char data[CD_FRAMESIZE_RAW];
+};
+
+static ZcacheEntry zcache[ZCACHE_SECTORS];
+static int zcacheHead, zcacheTail; // most and least recently used
+static int *zcacheIndex = NULL;    // for every sector, its cache entry or -1
+static int Zsectors;               // the number of sectors in the image
+
+//the track table. sectors are numbered the way MSF2SECT numbers them, so 00:02:00 is sector 0.
+//a cue sheet can spread the tracks over several files, which follow one another on the disc.
+//the first file is the image read through cdHandle (and the mapping, or the .Z table) as before,
+//the others get their own mapping, or a handle of their own if they can't be mapped.
+struct CdFile {
+	FILE *handle;
+	HANDLE mapFile, mapHandle;
+	unsigned char *mapView;
+	int start;        // the disc sector the file starts at
+	int sectors;
+};
+
+struct CdTrack {
+	int start;        // the sector of index 01
+	int end;          // one past its last sector
+	int file;         // which of cdFiles it is in
+	bool audio;
+};
+
+static std::vector<CdFile> cdFiles;
+static std::vector<CdTrack> cdTracks;
+static unsigned char cddaBuffer[CD_FRAMESIZE_RAW]; // for audio sectors which can't be returned straight from a mapping
 char *methods[] = {
 	".Z  - compress faster",
 	".bz - compress better"
@@ -42,11 +116,22 @@ char *LibName = "TAS ISO Plugin";
 
 
 
+static void StopReadahead();
+
 long CDRinit(void) {
+	if (!raLockInit) {
+		InitializeCriticalSection(&raLock);
+		raLockInit = true;
+	}
 	return 0;
 }
 
 long CDRshutdown(void) {
+	StopReadahead();
+	if (raLockInit) {
+		DeleteCriticalSection(&raLock);
+		raLockInit = false;
+	}
 	return 0;
 }
 
@@ -80,66 +165,535 @@ int UseCue()
 	return 0;
 }
 
-long CDRopen(char filename[256]) {
-	/*struct stat buf;	
-	UpdateZmode();    
-	if (Zmode) {
-		FILE *f;
-		char table[256];
-
-		fmode = Zmode;
-		strcpy(table, filename);
-		if (Zmode == 1) strcat(table, ".table");
-		else strcat(table, ".index");
-		if (stat(table, &buf) == -1) {		
-			printf("Error loading %s\n", table);
-			cdHandle = NULL;
-			return 0;
+static void UnmapFile(HANDLE &file, HANDLE &handle, unsigned char *&view) {
+	if (view) UnmapViewOfFile(view);
+	if (handle) CloseHandle(handle);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	view = NULL;
+	handle = NULL;
+	file = INVALID_HANDLE_VALUE;
+}
+
+// maps a whole file, returning its size, or 0 if it couldn't be mapped
+static __int64 MapFile(const char *filename, HANDLE &file, HANDLE &handle, unsigned char *&view) {
+	file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (file == INVALID_HANDLE_VALUE) return 0;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 || size.QuadPart != (SIZE_T)size.QuadPart) {
+		UnmapFile(file, handle, view);
+		return 0;
+	}
+
+	handle = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (handle) view = (unsigned char*)MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+	if (!view) {
+		printf("Couldn't map %s, reading it from the file instead\n", filename);
+		UnmapFile(file, handle, view);
+		return 0;
+	}
+
+	return size.QuadPart;
+}
+
+static void UnmapImage() {
+	UnmapFile(mapFile, mapHandle, mapView);
+	mapSize = readPos = 0;
+}
+
+static void MapImage(const char *filename) {
+	UnmapImage();
+	mapSize = MapFile(filename, mapFile, mapHandle, mapView);
+}
+
+static void ZcacheReset() {
+	free(zcacheIndex);
+	zcacheIndex = (int*)malloc(Zsectors * sizeof(int));
+	for (int i = 0; i < Zsectors; i++)
+		zcacheIndex[i] = -1;
+	for (int i = 0; i < ZCACHE_SECTORS; i++) {
+		zcache[i].sector = -1;
+		zcache[i].prev = i - 1;
+		zcache[i].next = i + 1 < ZCACHE_SECTORS ? i + 1 : -1;
+	}
+	zcacheHead = 0;
+	zcacheTail = ZCACHE_SECTORS - 1;
+}
+
+static void ZcacheUnlink(int i) {
+	if (zcache[i].prev >= 0) zcache[zcache[i].prev].next = zcache[i].next;
+	else zcacheHead = zcache[i].next;
+	if (zcache[i].next >= 0) zcache[zcache[i].next].prev = zcache[i].prev;
+	else zcacheTail = zcache[i].prev;
+}
+
+static void ZcachePushFront(int i) {
+	zcache[i].prev = -1;
+	zcache[i].next = zcacheHead;
+	if (zcacheHead >= 0) zcache[zcacheHead].prev = i;
+	zcacheHead = i;
+	if (zcacheTail < 0) zcacheTail = i;
+}
+
+// these two must be called with raLock held, since the readahead thread fills the cache too
+static bool ZcacheGet(int sector, unsigned char *data) {
+	int i = zcacheIndex[sector];
+	if (i < 0) return false;
+	memcpy(data, zcache[i].data, CD_FRAMESIZE_RAW);
+	ZcacheUnlink(i);
+	ZcachePushFront(i);
+	return true;
+}
+
+static void ZcachePut(int sector, const unsigned char *data) {
+	if (zcacheIndex[sector] >= 0) return;
+	int i = zcacheTail;
+	ZcacheUnlink(i);
+	if (zcache[i].sector >= 0) zcacheIndex[zcache[i].sector] = -1;
+	zcache[i].sector = sector;
+	zcacheIndex[sector] = i;
+	memcpy(zcache[i].data, data, CD_FRAMESIZE_RAW);
+	ZcachePushFront(i);
+}
+
+// reads and decompresses one whole sector of a .Z image
+static bool ZreadSector(FILE *f, int sector, unsigned char *data) {
+	if (sector < 0 || sector >= Zsectors) return false;
+
+	unsigned long pos = *(unsigned long*)&Ztable[sector * 6];
+	unsigned short p = *(unsigned short*)&Ztable[sector * 6 + 4];
+	unsigned char Zbuf[CD_FRAMESIZE_RAW * 2];
+	if (p > sizeof(Zbuf)) return false;
+
+	fseek(f, pos, SEEK_SET);
+	if (fread(Zbuf, 1, p, f) != p) return false;
+
+	uLongf size = CD_FRAMESIZE_RAW;
+	return uncompress(data, &size, Zbuf, p) == Z_OK && size == CD_FRAMESIZE_RAW;
+}
+
+static bool LoadZtable(const char *filename) {
+	std::string table = std::string(filename) + ".table";
+	FILE *f = fopen(table.c_str(), "rb");
+	if (f == NULL) return false;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	Ztable = (char*)malloc(size);
+	if (Ztable == NULL || fread(Ztable, 1, size, f) != (size_t)size) {
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+
+	Zsectors = size / 6;
+	ZcacheReset();
+	return true;
+}
+
+static bool IsZimage(const char *filename) {
+	int len = strlen(filename);
+	return len >= 2 && !strncmp(filename+(len-2), ".Z", 2);
+}
+
+static bool ReadaheadRead(int sector, unsigned char *data) {
+	__int64 pos = (__int64)sector * CD_FRAMESIZE_RAW + 12;
+	if (mapView) {
+		if (pos + DATA_SIZE > mapSize) return false;
+		//just fault the pages in
+		volatile unsigned char sink;
+		for (__int64 p = pos & ~4095; p < pos + DATA_SIZE; p += 4096)
+			sink = mapView[p];
+		return true;
+	}
+	if (raHandle == NULL) return false;
+	if (fmode == 1) {
+		if (!ZreadSector(raHandle, sector, data)) return false;
+		EnterCriticalSection(&raLock);
+		ZcachePut(sector, data);
+		LeaveCriticalSection(&raLock);
+		return true;
+	}
+	fseek(raHandle, (long)(pos - 12), SEEK_SET);
+	return fread(data, 1, CD_FRAMESIZE_RAW, raHandle) == CD_FRAMESIZE_RAW;
+}
+
+static DWORD WINAPI ReadaheadThread(LPVOID) {
+	static unsigned char data[CD_FRAMESIZE_RAW];
+
+	while (!raTerminate) {
+		WaitForSingleObject(raWake, INFINITE);
+
+		while (!raTerminate) {
+			int sector = -1;
+			EnterCriticalSection(&raLock);
+			unsigned long generation = raGeneration;
+			if (raWant >= 0)
+				for (int i = raWant; i < raWant + READAHEAD_SECTORS; i++)
+					if (raSlots[i % READAHEAD_SECTORS].sector != i) { sector = i; break; }
+			LeaveCriticalSection(&raLock);
+			if (sector < 0) break;
+
+			bool ok = ReadaheadRead(sector, data);
+
+			EnterCriticalSection(&raLock);
+			if (generation == raGeneration) {
+				if (ok) {
+					ReadaheadSlot &slot = raSlots[sector % READAHEAD_SECTORS];
+					if (!mapView && !fmode) memcpy(slot.data, data, CD_FRAMESIZE_RAW);
+					slot.sector = sector;
+				}
+				else raWant = -1; // the end of the image
+			}
+			LeaveCriticalSection(&raLock);
 		}
-		f = fopen(table, "rb");
-		Ztable = (char*)malloc(buf.st_size);
-		if (Ztable == NULL) {
-			cdHandle = NULL;
-			return 0;
+	}
+	return 0;
+}
+
+static void StartReadahead(const char *filename) {
+	for (int i = 0; i < READAHEAD_SECTORS; i++)
+		raSlots[i].sector = -1;
+	raWant = -1;
+	raLastSector = -2;
+	CDRreadaheadHits = CDRreadaheadMisses = 0;
+
+	raFileName = filename;
+	if (!mapView) raHandle = fopen(filename, "rb");
+
+	raTerminate = false;
+	raWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+	DWORD threadId;
+	raThread = CreateThread(NULL, 0, ReadaheadThread, NULL, 0, &threadId);
+}
+
+static void StopReadahead() {
+	if (raThread) {
+		raTerminate = true;
+		SetEvent(raWake);
+		WaitForSingleObject(raThread, INFINITE);
+		CloseHandle(raThread);
+		CloseHandle(raWake);
+		raThread = raWake = NULL;
+	}
+	if (raHandle) {
+		fclose(raHandle);
+		raHandle = NULL;
+	}
+}
+
+// called when the cdrom seeks, since the sectors after the last one read won't be wanted now
+void CDRcancelReadahead() {
+	if (!raThread) return;
+	EnterCriticalSection(&raLock);
+	raGeneration++;
+	raWant = -1;
+	LeaveCriticalSection(&raLock);
+	raLastSector = -2;
+}
+
+// returns true (and the sector's data, if there is anywhere to put it) if the sector has already been read ahead.
+// the data is the part after the sync bytes, or the whole raw sector if raw is set
+static bool ReadaheadTake(int sector, unsigned char *data, bool raw = false) {
+	if (!raThread || sector < 0) return false;
+	EnterCriticalSection(&raLock);
+	ReadaheadSlot &slot = raSlots[sector % READAHEAD_SECTORS];
+	bool hit = slot.sector == sector;
+	if (hit && data) {
+		if (raw) memcpy(data, slot.data, CD_FRAMESIZE_RAW);
+		else memcpy(data, slot.data + 12, DATA_SIZE);
+	}
+	LeaveCriticalSection(&raLock);
+
+	if (hit) CDRreadaheadHits++;
+	else CDRreadaheadMisses++;
+	return hit;
+}
+
+// tells the readahead which sector was just read, so it can start on the ones after it if the reads are sequential
+static void ReadaheadNotify(int sector) {
+	if (!raThread) return;
+	if (sector == raLastSector + 1) {
+		EnterCriticalSection(&raLock);
+		raWant = sector + 1;
+		LeaveCriticalSection(&raLock);
+		SetEvent(raWake);
+	}
+	else CDRcancelReadahead();
+	raLastSector = sector;
+}
+
+static void CloseTracks() {
+	for (size_t i = 1; i < cdFiles.size(); i++) {
+		if (cdFiles[i].handle) fclose(cdFiles[i].handle);
+		UnmapFile(cdFiles[i].mapFile, cdFiles[i].mapHandle, cdFiles[i].mapView);
+	}
+	cdFiles.clear();
+	cdTracks.clear();
+}
+
+static int FileSectors(FILE *f) {
+	long pos = ftell(f);
+	fseek(f, 0, SEEK_END);
+	int sectors = ftell(f) / CD_FRAMESIZE_RAW;
+	fseek(f, pos, SEEK_SET);
+	return sectors;
+}
+
+// the first file is already open as cdHandle
+static void AddFirstFile() {
+	CdFile file = { NULL, INVALID_HANDLE_VALUE, NULL, NULL, 0 };
+	if (fmode == 1) file.sectors = Zsectors;
+	else if (mapView) file.sectors = (int)(mapSize / CD_FRAMESIZE_RAW);
+	else file.sectors = FileSectors(cdHandle);
+	cdFiles.push_back(file);
+}
+
+static bool AddFile(const char *filename) {
+	CdFile file = { NULL, INVALID_HANDLE_VALUE, NULL, NULL, 0 };
+	__int64 size = MapFile(filename, file.mapFile, file.mapHandle, file.mapView);
+	if (size) file.sectors = (int)(size / CD_FRAMESIZE_RAW);
+	else {
+		file.handle = fopen(filename, "rb");
+		if (file.handle == NULL) return false;
+		file.sectors = FileSectors(file.handle);
+	}
+	const CdFile &last = cdFiles.back();
+	file.start = last.start + last.sectors;
+	cdFiles.push_back(file);
+	return true;
+}
+
+static int CueSector(const CueTimestamp &t) {
+	return (t.mm * 60 + t.ss) * 75 + t.ff;
+}
+
+// lays the cue sheet's tracks out on the disc, opening the files after the first one
+static bool BuildTrackTable(CueData *cue) {
+	AddFirstFile();
+	if (cue == NULL) {
+		CdTrack track = { 0, cdFiles[0].sectors, 0, false };
+		cdTracks.push_back(track);
+		return true;
+	}
+
+	std::string lastFile;
+	for (TTrackMap::iterator it(cue->tracks.begin()); it != cue->tracks.end(); ++it) {
+		CueTrack &cueTrack = it->second;
+		if (it != cue->tracks.begin() && cueTrack.filename != lastFile && !AddFile(cueTrack.filename.c_str())) {
+			SysMessage("Error loading %s\n", cueTrack.filename.c_str());
+			return false;
 		}
-		fread(Ztable, 1, buf.st_size, f);
-		fclose(f);
-	} else {*/
+		lastFile = cueTrack.filename;
+
+		CdTrack track;
+		track.file = cdFiles.size() - 1;
+		track.start = cdFiles[track.file].start;
+		if (cueTrack.indexes.count(1)) track.start += CueSector(cueTrack.indexes[1]);
+		else if (!cueTrack.indexes.empty()) track.start += CueSector(cueTrack.indexes.begin()->second);
+		track.end = cdFiles[track.file].start + cdFiles[track.file].sectors;
+		std::string type = cueTrack.tracktype;
+		for (size_t i = 0; i < type.size(); i++) type[i] = toupper(type[i]);
+		track.audio = type == "AUDIO";
+
+		// a track ends where the next one in the same file begins, pregap included
+		if (!cdTracks.empty() && cdTracks.back().file == track.file) {
+			int pregap = cueTrack.indexes.count(0) ? CueSector(cueTrack.indexes[0]) + cdFiles[track.file].start : track.start;
+			cdTracks.back().end = pregap;
+		}
+		cdTracks.push_back(track);
+	}
+
+	// CDRgetTD hands these out
+	for (size_t i = 0; i < cdTracks.size(); i++) {
+		int start = cdTracks[i].start + 150, end = cdTracks[i].end + 150;
+		Config.CueList[i].StartPosMM = start / 75 / 60;
+		Config.CueList[i].StartPosSS = start / 75 % 60;
+		Config.CueList[i].StartPosFF = start % 75;
+		Config.CueList[i].EndPosMM = end / 75 / 60;
+		Config.CueList[i].EndPosSS = end / 75 % 60;
+		Config.CueList[i].EndPosFF = end % 75;
+	}
+	return true;
+}
+
+static const CdTrack *FindTrack(int sector) {
+	for (size_t i = 0; i < cdTracks.size(); i++)
+		if (sector >= cdTracks[i].start && sector < cdTracks[i].end)
+			return &cdTracks[i];
+	return NULL;
+}
+
+// returns the whole raw sector, either straight from a mapping or read into buffer. NULL if it isn't on the disc
+static const unsigned char *ReadRawSector(int sector, unsigned char *buffer) {
+	int f = cdFiles.size() - 1;
+	while (f > 0 && sector < cdFiles[f].start) f--;
+	if (sector < 0 || f < 0 || sector >= cdFiles[f].start + cdFiles[f].sectors) return NULL;
+
+	if (f == 0) {
+		if (fmode == 1) {
+			EnterCriticalSection(&raLock);
+			bool cached = ZcacheGet(sector, buffer);
+			LeaveCriticalSection(&raLock);
+			if (!cached && !ZreadSector(cdHandle, sector, buffer)) return NULL;
+			return buffer;
+		}
+		if (mapView) {
+			ReadaheadTake(sector, NULL);
+			return mapView + (__int64)sector * CD_FRAMESIZE_RAW;
+		}
+		if (ReadaheadTake(sector, buffer, true)) return buffer;
+		fseek(cdHandle, (long)sector * CD_FRAMESIZE_RAW, SEEK_SET);
+		if (fread(buffer, 1, CD_FRAMESIZE_RAW, cdHandle) != CD_FRAMESIZE_RAW) return NULL;
+		return buffer;
+	}
+
+	CdFile &file = cdFiles[f];
+	__int64 pos = (__int64)(sector - file.start) * CD_FRAMESIZE_RAW;
+	if (file.mapView) return file.mapView + pos;
+	fseek(file.handle, (long)pos, SEEK_SET);
+	if (fread(buffer, 1, CD_FRAMESIZE_RAW, file.handle) != CD_FRAMESIZE_RAW) return NULL;
+	return buffer;
+}
+
+long CDRopen(char filename[256]) {
 	fmode = 0;
 	pbuffer = cdbuffer;	
-	//}	
-    if (UseCue()) 
+	imageKey.clear();
+	StopReadahead();
+	CloseTracks();
+	if (Ztable) { free(Ztable); Ztable = NULL; }
+
+	const char *image = filename;
+	CueData CueTemp;
+	bool cue = UseCue() != 0;
+    if (cue) 
 	{				
-		CueData CueTemp;
 		CueTemp.cueparser(filename);
 		CueTemp.CopyToConfig();
-		cdHandle = fopen(Config.CueList[0].FileName, "rb");
-		if (cdHandle == NULL) {
-			SysMessage("Error loading %s\n", filename);
+		image = Config.CueList[0].FileName;
+	}
+	else
+		Config.CueTracks = 0;
+
+	cdHandle = fopen(image, "rb");
+	if (cdHandle == NULL) {
+		SysMessage("Error loading %s\n", filename);
+		strcpy(IsoFile,"");
+		return -1;
+	}
+
+	if (IsZimage(image)) {
+		if (!LoadZtable(image)) {
+			SysMessage("Error loading %s.table\n", image);
+			fclose(cdHandle);
+			cdHandle = NULL;
 			strcpy(IsoFile,"");
 			return -1;
 		}
+		fmode = 1;
 	}
 	else
-	{		
-		Config.CueTracks = 0;
-		cdHandle = fopen(filename, "rb");
-		if (cdHandle == NULL) {
-			SysMessage("Error loading %s\n", filename);
-			strcpy(IsoFile,"");
+		MapImage(image);
+
+	if (!BuildTrackTable(cue ? &CueTemp : NULL)) {
+		CloseTracks();
+		UnmapImage();
+		if (Ztable) { free(Ztable); Ztable = NULL; }
+		fclose(cdHandle);
+		cdHandle = NULL;
+		strcpy(IsoFile,"");
+		return -1;
+	}
+
+	StartReadahead(image);
+
+	struct stat st;
+	char key[512];
+	if (stat(image, &st) == 0)
+		sprintf(key, "%.400s|%lu|%lu", image, (unsigned long)st.st_size, (unsigned long)st.st_mtime);
+	else
+		sprintf(key, "%.400s", image);
+	imageKey = key;
+
+	return 0;
+}
+
+const char *CDRgetImageKey(void) {
+	return imageKey.c_str();
+}
+
+// compresses a .bin/.iso/.img (or the image a .cue refers to) into a .Z image and its .Z.table.
+// returns 0 on success
+long CDRcompressImage(const char *in, const char *out) {
+	std::string image = in;
+	int len = strlen(in);
+	if (len >= 4 && !strncmp(in+(len-4), ".cue", 4)) {
+		CueData CueTemp;
+		CueTemp.cueparser((char*)in);
+		CueTemp.CopyToConfig();
+		image = Config.CueList[0].FileName;
+	}
+
+	FILE *src = fopen(image.c_str(), "rb");
+	if (src == NULL) {
+		printf("Error loading %s\n", image.c_str());
+		return -1;
+	}
+	std::string tableName = std::string(out) + ".table";
+	FILE *dst = fopen(out, "wb");
+	FILE *table = fopen(tableName.c_str(), "wb");
+	if (dst == NULL || table == NULL) {
+		printf("Error creating %s\n", dst ? tableName.c_str() : out);
+		fclose(src);
+		if (dst) fclose(dst);
+		if (table) fclose(table);
+		return -1;
+	}
+
+	unsigned char sector[CD_FRAMESIZE_RAW];
+	unsigned char Zbuf[CD_FRAMESIZE_RAW * 2];
+	unsigned long pos = 0, sectors = 0;
+	while (fread(sector, 1, CD_FRAMESIZE_RAW, src) == CD_FRAMESIZE_RAW) {
+		uLongf size = sizeof(Zbuf);
+		int ret = compress2(Zbuf, &size, sector, CD_FRAMESIZE_RAW, Z_BEST_COMPRESSION);
+		if (ret != Z_OK) {
+			printf("Error compressing sector %lu (zlib error %d)\n", sectors, ret);
+			fclose(src);
+			fclose(dst);
+			fclose(table);
+			remove(out);
+			remove(tableName.c_str());
 			return -1;
 		}
+		unsigned short p = (unsigned short)size;
+		fwrite(&pos, 1, 4, table);
+		fwrite(&p, 1, 2, table);
+		fwrite(Zbuf, 1, size, dst);
+		pos += size;
+		sectors++;
 	}
 
+	printf("Compressed %lu sectors (%lu bytes) into %lu bytes\n", sectors, sectors * CD_FRAMESIZE_RAW, pos);
+	fclose(src);
+	fclose(dst);
+	fclose(table);
 	return 0;
 }
 
 long CDRclose(void) {
 	if (cdHandle == NULL)
 		return 0;
+	imageKey.clear();
+	StopReadahead();
+	CloseTracks();
+	UnmapImage();
 	fclose(cdHandle);
 	cdHandle = NULL;
 	if (Ztable) { free(Ztable); Ztable = NULL; }
+	Zsectors = 0;
+	fmode = 0;
 
 	return 0;
 }
@@ -187,10 +741,19 @@ long CDRgetTD(unsigned char track, unsigned char *buffer) {
 		else if (!track)
 		{
 			// Calculated last (only) track end, ugh
-			int pos = fseek(cdHandle, 0, SEEK_CUR);
-			fseek(cdHandle, 0, SEEK_END);
-			int numSecs = ftell(cdHandle) / CD_FRAMESIZE_RAW / 75;
-			fseek(cdHandle, pos, SEEK_SET);
+			int numSecs;
+			if (fmode == 1)
+				numSecs = Zsectors / 75;
+			else if (mapView)
+				numSecs = (int)(mapSize / CD_FRAMESIZE_RAW / 75);
+			else {
+				int pos = fseek(cdHandle, 0, SEEK_CUR);
+				fseek(cdHandle, 0, SEEK_END);
+				numSecs = ftell(cdHandle) / CD_FRAMESIZE_RAW / 75;
+				fseek(cdHandle, pos, SEEK_SET);
+			}
+			// (fseek returns 0 rather than the position, so this leaves the file at its start)
+			readPos = 0;
 
 			buffer[1] = (numSecs / 60) % 60;
 			buffer[2] = numSecs % 60;
@@ -201,6 +764,8 @@ long CDRgetTD(unsigned char track, unsigned char *buffer) {
 	}
 	else
 	{
+		if (track > Config.CueTracks)
+			return -1;
 		if (track)
 		{
 			// Start of specified track
@@ -229,26 +794,61 @@ long CDRreadTrack(unsigned char *time) {
 
 //	printf ("CDRreadTrack %d:%d:%d\n", btoi(time[0]), btoi(time[1]), btoi(time[2]));
 
-	if (!fmode) {
-		fseek(cdHandle, MSF2SECT(btoi(time[0]), btoi(time[1]), btoi(time[2])) * CD_FRAMESIZE_RAW + 12, SEEK_SET);
-		fread(cdbuffer, 1, DATA_SIZE, cdHandle);
-	} else if (fmode == 1) { //.Z
-		unsigned long pos, p;
-		unsigned long size;
-		unsigned char Zbuf[CD_FRAMESIZE_RAW];
-
-		p = MSF2SECT(btoi(time[0]), btoi(time[1]), btoi(time[2]));
-
-		pos = *(unsigned long*)&Ztable[p * 6];
-		fseek(cdHandle, pos, SEEK_SET);
-
-		p = *(unsigned short*)&Ztable[p * 6 + 4];
-		fread(Zbuf, 1, p, cdHandle);
+	if (cdFiles.size() > 1 && MSF2SECT(btoi(time[0]), btoi(time[1]), btoi(time[2])) >= cdFiles[1].start) {
+		//a data track in one of the cue sheet's other files
+		const unsigned char *raw = ReadRawSector(MSF2SECT(btoi(time[0]), btoi(time[1]), btoi(time[2])), cdbuffer);
+		if (raw == NULL) return -1;
+		memmove(cdbuffer, raw + 12, DATA_SIZE);
+		pbuffer = cdbuffer;
+	} else if (!fmode) {
+		int sector = MSF2SECT(btoi(time[0]), btoi(time[1]), btoi(time[2]));
+		__int64 pos = (__int64)sector * CD_FRAMESIZE_RAW + 12;
+		//(a failed seek before the start of the image would have left the file where it was)
+		if (pos < 0) pos = readPos;
+
+		if (mapView) {
+			ReadaheadTake(sector, NULL);
+			if (pos + DATA_SIZE <= mapSize) {
+				pbuffer = mapView + pos;
+				readPos = pos + DATA_SIZE;
+			} else {
+				//reading off the end of the image: fread would have read what there was over the last sector
+				if (pbuffer != cdbuffer) memcpy(cdbuffer, pbuffer, DATA_SIZE);
+				if (pos < mapSize) {
+					memcpy(cdbuffer, mapView + pos, (size_t)(mapSize - pos));
+					readPos = mapSize;
+				}
+				pbuffer = cdbuffer;
+			}
+		} else {
+			if (ReadaheadTake(sector, cdbuffer))
+				readPos = pos + DATA_SIZE;
+			else {
+				fseek(cdHandle, (long)pos, SEEK_SET);
+				readPos = pos + fread(cdbuffer, 1, DATA_SIZE, cdHandle);
+			}
+			pbuffer = cdbuffer;
+		}
 
-		size = CD_FRAMESIZE_RAW;
-		uncompress(cdbuffer, &size, Zbuf, p);
+		ReadaheadNotify(sector);
+	} else if (fmode == 1) { //.Z
+		int sector = MSF2SECT(btoi(time[0]), btoi(time[1]), btoi(time[2]));
+		if (sector < 0 || sector >= Zsectors) return -1;
+
+		ReadaheadTake(sector, NULL);
+		EnterCriticalSection(&raLock);
+		bool cached = ZcacheGet(sector, cdbuffer);
+		LeaveCriticalSection(&raLock);
+		if (!cached) {
+			if (!ZreadSector(cdHandle, sector, cdbuffer)) return -1;
+			EnterCriticalSection(&raLock);
+			ZcachePut(sector, cdbuffer);
+			LeaveCriticalSection(&raLock);
+		}
 		
 		pbuffer = cdbuffer + 12;
+
+		ReadaheadNotify(sector);
 	}
 	/*
 	else { // .bz
@@ -290,18 +890,53 @@ unsigned char* CDRgetBuffer(void) {
 	return pbuffer;
 }
 
+// leaves the buffer as a read of the sector would, as far as a savestate sees it
+void CDRsetBuffer(const unsigned char *data) {
+	memcpy(cdbuffer, data, DATA_SIZE);
+	pbuffer = cdbuffer;
+}
+
 // plays cdda audio
 // sector : byte 0 - minute ; byte 1 - second ; byte 2 - frame
 // does NOT uses bcd format
+// the cdrom reads the frames itself with CDRreadCDDA as it plays them, this just starts reading ahead from there
 long CDRplay(unsigned char *sector) {
+	int s = MSF2SECT(sector[0], sector[1], sector[2]);
+	const CdTrack *track = FindTrack(s);
+	if (track == NULL || !track->audio) return -1;
+	if (raThread && track->file == 0) {
+		EnterCriticalSection(&raLock);
+		raGeneration++;
+		raWant = s;
+		LeaveCriticalSection(&raLock);
+		raLastSector = s - 1;
+		SetEvent(raWake);
+	}
 	return 0;
 }
 
 // stops cdda audio
 long CDRstop(void) {
+	CDRcancelReadahead();
 	return 0;
 }
 
+// returns the 2352 bytes (588 16 bit stereo samples) of an audio sector, or NULL if the sector isn't in an audio track.
+// the data stays valid until the next call
+const unsigned char *CDRreadCDDA(int sector) {
+	const CdTrack *track = FindTrack(sector);
+	if (track == NULL || !track->audio) return NULL;
+	const unsigned char *frame = ReadRawSector(sector, cddaBuffer);
+	if (track->file == 0) ReadaheadNotify(sector);
+	return frame;
+}
+
+// returns one past the last sector of the track the sector is in, or -1 if it isn't in one
+int CDRgetTrackEnd(int sector) {
+	const CdTrack *track = FindTrack(sector);
+	return track ? track->end : -1;
+}
+
 long CDRtest(void) {
 	if (*IsoFile == 0)
 		return 0;
@@ -314,6 +949,11 @@ long CDRtest(void) {
 }
 
 int CDRisoFreeze(EMUFILE *f, int Mode) {
+	//a sector read straight from the mapped image goes into the state the same way as one which was read into cdbuffer
+	if (Mode == 1 && pbuffer && (pbuffer < cdbuffer || pbuffer >= cdbuffer + sizeof(cdbuffer))) {
+		memcpy(cdbuffer, pbuffer, DATA_SIZE);
+		pbuffer = cdbuffer;
+	}
 	gzfreezelarr(cdbuffer);
 	pbuffer = (unsigned char*)((intptr_t)pbuffer-(intptr_t)cdbuffer);
 	gzfreezel(&pbuffer);
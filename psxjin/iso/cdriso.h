@@ -37,16 +37,25 @@ void SysMessage(char *fmt, ...);
 long CDRinit(void);
 long CDRshutdown(void);
 long CDRopen(char* filename);
+long CDRcompressImage(const char *in, const char *out);
 long SwapCD(char* out, char *in);
 long CDRclose(void);
 long CDRgetTN(unsigned char *);
 long CDRgetTD(unsigned char , unsigned char *);
 long CDRreadTrack(unsigned char *);
 unsigned char * CDRgetBuffer(void);
+// puts a sector's data in the buffer without reading it from the image
+void CDRsetBuffer(const unsigned char *data);
+void CDRcancelReadahead(void);
+extern unsigned long CDRreadaheadHits, CDRreadaheadMisses;
+// identifies the image open, by its path, size and modification time
+const char *CDRgetImageKey(void);
 long CDRtest(void);
 void CDRabout(void);
 long CDRplay(unsigned char *);
 long CDRstop(void);
+const unsigned char *CDRreadCDDA(int sector);
+int CDRgetTrackEnd(int sector);
 struct CdrStat {
 	unsigned long Type;
 	unsigned long Status;
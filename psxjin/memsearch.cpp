@@ -0,0 +1,408 @@
+#include "PsxCommon.h"
+#include "memsearch.h"
+#include <emmintrin.h>
+
+// a 16 byte load at the last address of ram reads a little past the end
+#define PADDING 16
+
+static inline u32 PopCount(u32 v)
+{
+	v = v - ((v >> 1) & 0x55555555);
+	v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+	return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+static inline int LowestBit(u32 v)
+{
+	int n = 0;
+	if(!(v & 0xFFFF)) { n += 16; v >>= 16; }
+	if(!(v & 0xFF)) { n += 8; v >>= 8; }
+	if(!(v & 0xF)) { n += 4; v >>= 4; }
+	if(!(v & 0x3)) { n += 2; v >>= 2; }
+	if(!(v & 0x1)) { n += 1; }
+	return n;
+}
+
+// the bits of a mask with a bit per byte which fall on every size'th byte
+static inline u32 LaneMask(int size)
+{
+	return size == 1 ? 0xFFFFFFFF : size == 2 ? 0x55555555 : 0x11111111;
+}
+
+MemorySearch::MemorySearch()
+{
+	cur = (u8*)calloc(RAM_SIZE + PADDING, 1);
+	prev = (u8*)calloc(RAM_SIZE + PADDING, 1);
+	changeCounts = (u16*)calloc(RAM_SIZE, sizeof(u16));
+	active = (u32*)calloc(WORDS, sizeof(u32));
+	undoActive = (u32*)calloc(WORDS, sizeof(u32));
+	changed = (u32*)calloc(WORDS + 1, sizeof(u32));
+	prefix = (u32*)calloc(WORDS + 1, sizeof(u32));
+	itemSize = itemStep = 1;
+	itemSigned = false;
+	stepMask = LaneMask(1);
+	reset();
+}
+
+MemorySearch::~MemorySearch()
+{
+	free(cur);
+	free(prev);
+	free(changeCounts);
+	free(active);
+	free(undoActive);
+	free(changed);
+	free(prefix);
+}
+
+void MemorySearch::setType(int size, bool isSigned, int step)
+{
+	itemSize = size;
+	itemSigned = isSigned;
+	itemStep = step;
+	stepMask = LaneMask(step);
+	prefixValid = false;
+}
+
+void MemorySearch::reset()
+{
+	memcpy(cur, psxM, RAM_SIZE);
+	memcpy(prev, psxM, RAM_SIZE);
+	prevPending = false;
+	memset(active, 0xFF, WORDS * sizeof(u32));
+	memset(changeCounts, 0, RAM_SIZE * sizeof(u16));
+	prefixValid = false;
+}
+
+void MemorySearch::resetChanges()
+{
+	memset(changeCounts, 0, RAM_SIZE * sizeof(u16));
+}
+
+void MemorySearch::update()
+{
+	const u8* ram = (const u8*)psxM;
+	u32 w, i;
+
+	if(prevPending)
+	{
+		memcpy(prev, cur, RAM_SIZE);
+		prevPending = false;
+	}
+
+	// find the bytes which changed 32 at a time, and take in their new values
+	for(w = 0; w < WORDS; w++)
+	{
+		__m128i r0 = _mm_loadu_si128((const __m128i*)(ram + w*32));
+		__m128i r1 = _mm_loadu_si128((const __m128i*)(ram + w*32 + 16));
+		__m128i c0 = _mm_loadu_si128((const __m128i*)(cur + w*32));
+		__m128i c1 = _mm_loadu_si128((const __m128i*)(cur + w*32 + 16));
+		u32 same = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(r0, c0)) | ((u32)_mm_movemask_epi8(_mm_cmpeq_epi8(r1, c1)) << 16);
+		changed[w] = ~same;
+		if(~same)
+		{
+			_mm_storeu_si128((__m128i*)(cur + w*32), r0);
+			_mm_storeu_si128((__m128i*)(cur + w*32 + 16), r1);
+		}
+	}
+	changed[WORDS] = 0;
+
+	// an item changed if any of its bytes did, and its count only goes up by one however many did
+	for(w = 0; w < WORDS; w++)
+	{
+		u32 c = changed[w];
+		u32 next = changed[w+1];
+		u32 itemChanged = c;
+		for(i = 1; i < (u32)itemSize; i++)
+			itemChanged |= (c >> i) | (next << (32 - i));
+		itemChanged &= active[w] & stepMask;
+		while(itemChanged)
+		{
+			changeCounts[w*32 + LowestBit(itemChanged)]++;
+			itemChanged &= itemChanged - 1;
+		}
+	}
+}
+
+u32 MemorySearch::readValue(const u8* values, u32 address) const
+{
+	u32 value = 0;
+	memcpy(&value, values + (address & (RAM_SIZE-1)), itemSize); // assumes we're little-endian
+	if(itemSigned && itemSize < 4 && (value & (1 << (itemSize*8 - 1))))
+		value |= ~0u << (itemSize*8);
+	return value;
+}
+
+// clears the bytes of the items which failed, so that a failed word item takes its odd byte with it
+void MemorySearch::clearFailed(u32 word, u32 failed)
+{
+	u32 bytes = failed;
+	for(int i = 1; i < itemStep; i++)
+		bytes |= failed << i;
+	active[word] &= ~bytes;
+}
+
+template<typename T> static bool Compare(MemorySearch::Op op, T x, T y, T p)
+{
+	switch(op)
+	{
+		case MemorySearch::Less: return x < y;
+		case MemorySearch::More: return x > y;
+		case MemorySearch::LessEqual: return x <= y;
+		case MemorySearch::MoreEqual: return x >= y;
+		case MemorySearch::Equal: return x == y;
+		case MemorySearch::Unequal: return x != y;
+		case MemorySearch::DiffBy: return x - y == p || y - x == p;
+		case MemorySearch::Modulo: return p && x % p == y;
+	}
+	return false;
+}
+
+template<typename T> bool MemorySearch::satisfiesT(u32 address, Kind kind, Op op, s32 value, s32 param)
+{
+	T x, y;
+	switch(kind)
+	{
+		case Relative:
+			memcpy(&x, cur + address, sizeof(T));
+			memcpy(&y, prevValues() + address, sizeof(T));
+			return Compare<T>(op, x, y, (T)param);
+		case Specific:
+			memcpy(&x, cur + address, sizeof(T));
+			return Compare<T>(op, x, (T)value, (T)param);
+		case Address:
+			return Compare<u32>(op, address, value, param);
+		case Changes:
+			return Compare<u16>(op, changeCounts[address], value, param);
+	}
+	return false;
+}
+
+bool MemorySearch::satisfies(u32 address, Kind kind, Op op, s32 value, s32 param)
+{
+	address &= RAM_SIZE-1;
+	switch(itemSize)
+	{
+		case 1: return itemSigned ? satisfiesT<s8>(address, kind, op, value, param) : satisfiesT<u8>(address, kind, op, value, param);
+		case 2: return itemSigned ? satisfiesT<s16>(address, kind, op, value, param) : satisfiesT<u16>(address, kind, op, value, param);
+		default: return itemSigned ? satisfiesT<s32>(address, kind, op, value, param) : satisfiesT<u32>(address, kind, op, value, param);
+	}
+}
+
+// for the searches the vector compares don't cover: differences, modulos, addresses and change counts
+template<typename T> void MemorySearch::searchScalar(Kind kind, Op op, s32 value, s32 param)
+{
+	for(u32 w = 0; w < WORDS; w++)
+	{
+		u32 bits = active[w] & stepMask;
+		u32 failed = 0;
+		while(bits)
+		{
+			int b = LowestBit(bits);
+			bits &= bits - 1;
+			if(!satisfiesT<T>(w*32 + b, kind, op, value, param))
+				failed |= 1 << b;
+		}
+		if(failed)
+			clearFailed(w, failed);
+	}
+}
+
+template<int SIZE> static inline __m128i CmpGt(__m128i a, __m128i b)
+{
+	return SIZE == 1 ? _mm_cmpgt_epi8(a, b) : SIZE == 2 ? _mm_cmpgt_epi16(a, b) : _mm_cmpgt_epi32(a, b);
+}
+
+template<int SIZE> static inline __m128i CmpEq(__m128i a, __m128i b)
+{
+	return SIZE == 1 ? _mm_cmpeq_epi8(a, b) : SIZE == 2 ? _mm_cmpeq_epi16(a, b) : _mm_cmpeq_epi32(a, b);
+}
+
+template<int SIZE, int OP> static inline __m128i CmpOp(__m128i a, __m128i b)
+{
+	const __m128i ones = _mm_set1_epi32(-1);
+	switch(OP)
+	{
+		case MemorySearch::Less: return CmpGt<SIZE>(b, a);
+		case MemorySearch::More: return CmpGt<SIZE>(a, b);
+		case MemorySearch::LessEqual: return _mm_xor_si128(CmpGt<SIZE>(a, b), ones);
+		case MemorySearch::MoreEqual: return _mm_xor_si128(CmpGt<SIZE>(b, a), ones);
+		case MemorySearch::Equal: return CmpEq<SIZE>(a, b);
+		default: return _mm_xor_si128(CmpEq<SIZE>(a, b), ones);
+	}
+}
+
+template<int SIZE> static inline __m128i Broadcast(s32 value)
+{
+	return SIZE == 1 ? _mm_set1_epi8((char)value) : SIZE == 2 ? _mm_set1_epi16((short)value) : _mm_set1_epi32(value);
+}
+
+// compares 16 bytes at a time. a load from each of the item's starting phases (0 to size-1 bytes in)
+// gives 16/size items at once, and the first byte of each lane of the compare's mask marks where that item starts.
+// the vector compares are signed, so unsigned values get their top bit flipped first
+template<int SIZE, int OP> void MemorySearch::searchSimd(bool relative, bool isSigned, s32 value)
+{
+	const __m128i bias = isSigned ? _mm_setzero_si128() : Broadcast<SIZE>((s32)(1u << (SIZE*8 - 1)));
+	const __m128i specific = _mm_xor_si128(Broadcast<SIZE>(value), bias);
+	const u32 laneMask = LaneMask(SIZE) & 0xFFFF;
+	const u8* other = prevValues();
+
+	for(u32 w = 0; w < WORDS; w++)
+	{
+		u32 bits = active[w] & stepMask;
+		if(!bits)
+			continue;
+
+		u32 passed = 0;
+		for(u32 half = 0; half < 32; half += 16)
+		{
+			if(!((bits >> half) & 0xFFFF))
+				continue;
+			u32 base = w*32 + half;
+			for(int phase = 0; phase < SIZE; phase += itemStep)
+			{
+				__m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(cur + base + phase)), bias);
+				__m128i b = relative ? _mm_xor_si128(_mm_loadu_si128((const __m128i*)(other + base + phase)), bias) : specific;
+				passed |= ((u32)_mm_movemask_epi8(CmpOp<SIZE,OP>(a, b)) & laneMask) << (half + phase);
+			}
+		}
+
+		u32 failed = bits & ~passed;
+		if(failed)
+			clearFailed(w, failed);
+	}
+}
+
+template<int SIZE> void MemorySearch::searchSimd(Op op, bool relative, bool isSigned, s32 value)
+{
+	switch(op)
+	{
+		case Less: searchSimd<SIZE,Less>(relative, isSigned, value); break;
+		case More: searchSimd<SIZE,More>(relative, isSigned, value); break;
+		case LessEqual: searchSimd<SIZE,LessEqual>(relative, isSigned, value); break;
+		case MoreEqual: searchSimd<SIZE,MoreEqual>(relative, isSigned, value); break;
+		case Equal: searchSimd<SIZE,Equal>(relative, isSigned, value); break;
+		default: searchSimd<SIZE,Unequal>(relative, isSigned, value); break;
+	}
+}
+
+void MemorySearch::search(Kind kind, Op op, s32 value, s32 param)
+{
+	if((kind == Relative || kind == Specific) && op != DiffBy && op != Modulo)
+	{
+		bool relative = kind == Relative;
+		switch(itemSize)
+		{
+			case 1: searchSimd<1>(op, relative, itemSigned, value); break;
+			case 2: searchSimd<2>(op, relative, itemSigned, value); break;
+			default: searchSimd<4>(op, relative, itemSigned, value); break;
+		}
+	}
+	else
+	{
+		switch(itemSize)
+		{
+			case 1: itemSigned ? searchScalar<s8>(kind, op, value, param) : searchScalar<u8>(kind, op, value, param); break;
+			case 2: itemSigned ? searchScalar<s16>(kind, op, value, param) : searchScalar<u16>(kind, op, value, param); break;
+			default: itemSigned ? searchScalar<s32>(kind, op, value, param) : searchScalar<u32>(kind, op, value, param); break;
+		}
+	}
+
+	prevPending = true;
+	prefixValid = false;
+}
+
+void MemorySearch::eliminate(u32 address, u32 length)
+{
+	for(u32 a = address; a < address + length && a < RAM_SIZE; a++)
+		active[a / 32] &= ~(1 << (a % 32));
+	prefixValid = false;
+}
+
+void MemorySearch::saveUndo()
+{
+	memcpy(undoActive, active, WORDS * sizeof(u32));
+}
+
+void MemorySearch::undo()
+{
+	for(u32 w = 0; w < WORDS; w++)
+	{
+		u32 t = active[w];
+		active[w] = undoActive[w];
+		undoActive[w] = t;
+	}
+	prefixValid = false;
+}
+
+void MemorySearch::buildPrefix()
+{
+	u32 total = 0;
+	for(u32 w = 0; w < WORDS; w++)
+	{
+		prefix[w] = total;
+		total += PopCount(active[w] & stepMask);
+	}
+	prefix[WORDS] = total;
+	prefixValid = true;
+}
+
+u32 MemorySearch::count()
+{
+	if(!prefixValid)
+		buildPrefix();
+	return prefix[WORDS];
+}
+
+u32 MemorySearch::regions()
+{
+	u32 total = 0, carry = 0;
+	for(u32 w = 0; w < WORDS; w++)
+	{
+		u32 bits = active[w];
+		total += PopCount(bits & ~((bits << 1) | carry));
+		carry = bits >> 31;
+	}
+	return total;
+}
+
+u32 MemorySearch::addressOf(u32 index)
+{
+	if(!prefixValid)
+		buildPrefix();
+	if(index >= prefix[WORDS])
+		return 0xFFFFFFFF;
+
+	// the last word with fewer candidates before it than the index
+	u32 lo = 0, hi = WORDS - 1;
+	while(lo < hi)
+	{
+		u32 mid = (lo + hi + 1) / 2;
+		if(prefix[mid] <= index)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	u32 bits = active[lo] & stepMask;
+	for(u32 n = index - prefix[lo]; n; n--)
+		bits &= bits - 1;
+	return lo*32 + LowestBit(bits);
+}
+
+int MemorySearch::indexOf(u32 address)
+{
+	if(!isCandidate(address))
+		return -1;
+	if(!prefixValid)
+		buildPrefix();
+	address &= RAM_SIZE-1;
+	u32 below = (1u << (address % 32)) - 1;
+	return prefix[address / 32] + PopCount(active[address / 32] & stepMask & below);
+}
+
+bool MemorySearch::isCandidate(u32 address) const
+{
+	address &= RAM_SIZE-1;
+	return ((active[address / 32] & stepMask) >> (address % 32)) & 1;
+}
@@ -0,0 +1,87 @@
+#ifndef __MEMSEARCH_H__
+#define __MEMSEARCH_H__
+
+// A search of main ram for the addresses whose values behave a certain way,
+// kept apart from any UI so that the RAM Search window and Lua scripts can both drive one.
+//
+// The candidates are a bitset with a bit per byte of ram: an item (a byte, word or dword) is still
+// a candidate if the bit of its first byte is set and its address is a multiple of the step.
+// Searches compare 16 bytes of ram at a time and clear the bits of the items that fail,
+// and the values and change counts are kept for every address, so no per-candidate lists are ever built.
+class MemorySearch
+{
+public:
+	// what a search compares each candidate's value to
+	enum Kind { Relative, Specific, Address, Changes };
+	enum Op { Less, More, LessEqual, MoreEqual, Equal, Unequal, DiffBy, Modulo };
+
+	static const u32 RAM_SIZE = 0x200000;
+
+	MemorySearch();
+	~MemorySearch();
+
+	// size is 1, 2 or 4 bytes, and step (1, 2 or 4) is how far apart the items start.
+	// the candidates are kept, and the change counts are counted for the new size from here on
+	void setType(int size, bool isSigned, int step);
+	int size() const { return itemSize; }
+	bool isSigned() const { return itemSigned; }
+	int step() const { return itemStep; }
+
+	// makes every address a candidate again and starts over with the values in ram now
+	void reset();
+	// zeroes the change counts
+	void resetChanges();
+	// takes in the values in ram at the end of a frame and counts the items which changed
+	void update();
+	// the previous values become the current ones at the next update, as they do after a search
+	void updatePrevious() { prevPending = true; }
+	bool previousPending() const { return prevPending; }
+
+	// eliminates every candidate which doesn't satisfy the comparison.
+	// the previous values become the current ones at the next update
+	void search(Kind kind, Op op, s32 value, s32 param);
+	bool satisfies(u32 address, Kind kind, Op op, s32 value, s32 param);
+	// eliminates the bytes from address to address+length-1
+	void eliminate(u32 address, u32 length);
+
+	// keeps a copy of the candidates, which undo swaps back in (so a second undo redoes)
+	void saveUndo();
+	void undo();
+
+	u32 count();
+	u32 regions(); // runs of neighbouring candidate bytes
+	// the candidates in order of address, for showing them in a list
+	u32 addressOf(u32 index); // 0xFFFFFFFF past the end
+	int indexOf(u32 address); // -1 if the address isn't a candidate
+	bool isCandidate(u32 address) const;
+
+	u32 current(u32 address) const { return readValue(cur, address); }
+	u32 previous(u32 address) const { return readValue(prevValues(), address); }
+	u16 changes(u32 address) const { return changeCounts[address & (RAM_SIZE-1)]; }
+
+private:
+	static const u32 WORDS = RAM_SIZE / 32;
+
+	int itemSize, itemStep;
+	bool itemSigned;
+	u32 stepMask; // the bits of a candidate word which can start an item
+
+	u8 *cur, *prev;
+	bool prevPending; // prev is taken from cur at the next update
+	u16 *changeCounts;
+	u32 *active, *undoActive, *changed;
+	u32 *prefix; // candidates before each word, for addressOf and indexOf
+	bool prefixValid;
+
+	const u8* prevValues() const { return prevPending ? cur : prev; }
+	u32 readValue(const u8* values, u32 address) const;
+	void clearFailed(u32 word, u32 failed);
+	void buildPrefix();
+
+	template<typename T> bool satisfiesT(u32 address, Kind kind, Op op, s32 value, s32 param);
+	template<typename T> void searchScalar(Kind kind, Op op, s32 value, s32 param);
+	template<int SIZE, int OP> void searchSimd(bool relative, bool isSigned, s32 value);
+	template<int SIZE> void searchSimd(Op op, bool relative, bool isSigned, s32 value);
+};
+
+#endif /* __MEMSEARCH_H__ */
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <algorithm>
 #include "PsxCommon.h"
 #include "version.h"
 #include "padwin.h"
@@ -140,19 +141,98 @@ int SetBytesPerFrame( MovieType Movie)
 	return Movie.bytesPerFrame;
 }
 
-#define BUFFER_GROWTH_SIZE (16384)
+//the movie input is kept in blocks of INPUT_BLOCK_FRAMES frames, so that it grows without being copied
+//and any frame can be found straight away. a frame never straddles two blocks.
+//the frames below Movie.inputFlushedFrames are already in the file, so only the ones after them are written out.
+#define INPUT_BLOCK_FRAMES (4096)
 
-static void ReserveInputBufferSpace(uint32 spaceNeeded)
+static uint32 InputBlockSize()
 {
-	if (spaceNeeded > Movie.inputBufferSize) {
-		uint32 ptrOffset = Movie.inputBufferPtr - Movie.inputBuffer;
-		uint32 allocChunks = spaceNeeded / BUFFER_GROWTH_SIZE;
-		Movie.inputBufferSize = BUFFER_GROWTH_SIZE * (allocChunks+1);
-		Movie.inputBuffer = (uint8*)realloc(Movie.inputBuffer, Movie.inputBufferSize);
-		Movie.inputBufferPtr = Movie.inputBuffer + ptrOffset;
+	return INPUT_BLOCK_FRAMES * Movie.bytesPerFrame;
+}
+
+static uint8* InputBlock(uint32 block)
+{
+	if (block >= Movie.inputBlockCount) {
+		Movie.inputBlocks = (uint8**)realloc(Movie.inputBlocks, (block+1) * sizeof(uint8*));
+		for (uint32 i = Movie.inputBlockCount; i <= block; i++)
+			Movie.inputBlocks[i] = (uint8*)calloc(InputBlockSize(), 1);
+		Movie.inputBlockCount = block+1;
+	}
+	return Movie.inputBlocks[block];
+}
+
+static void FreeInputBlocks()
+{
+	for (uint32 i = 0; i < Movie.inputBlockCount; i++)
+		free(Movie.inputBlocks[i]);
+	free(Movie.inputBlocks);
+	Movie.inputBlocks = NULL;
+	Movie.inputBlockCount = 0;
+	Movie.inputBufferPtr = NULL;
+	Movie.inputFlushedFrames = 0;
+}
+
+static void SeekInputFrame(uint32 frame)
+{
+	Movie.inputBlock = frame / INPUT_BLOCK_FRAMES;
+	Movie.inputBufferPtr = InputBlock(Movie.inputBlock) + (frame % INPUT_BLOCK_FRAMES) * Movie.bytesPerFrame;
+}
+
+//called before each pad or control byte is read or written.
+//moves on to the next block once the last frame of one is done, and notes the frames that writes change
+static void PrepareInput(bool write)
+{
+	if (!Movie.inputBufferPtr)
+		SeekInputFrame(0);
+	else if (Movie.inputBufferPtr == Movie.inputBlocks[Movie.inputBlock] + InputBlockSize())
+		SeekInputFrame((Movie.inputBlock+1) * INPUT_BLOCK_FRAMES);
+	if (write) {
+		uint32 frame = Movie.inputBlock * INPUT_BLOCK_FRAMES + (Movie.inputBufferPtr - Movie.inputBlocks[Movie.inputBlock]) / Movie.bytesPerFrame;
+		if (frame < Movie.inputFlushedFrames)
+			Movie.inputFlushedFrames = frame;
 	}
 }
 
+static void ReadInputFrames(FILE* fp, uint32 frames)
+{
+	FreeInputBlocks();
+	for (uint32 frame = 0; frame < frames; frame += INPUT_BLOCK_FRAMES)
+		fread(InputBlock(frame / INPUT_BLOCK_FRAMES), Movie.bytesPerFrame, std::min<uint32>(frames - frame, INPUT_BLOCK_FRAMES), fp);
+	SeekInputFrame(0);
+	Movie.inputFlushedFrames = frames;
+	Movie.inputFlushedOffset = Movie.inputOffset;
+}
+
+static void WriteInputFrames(FILE* fp, uint32 first, uint32 frames)
+{
+	for (uint32 frame = first; frame < frames; ) {
+		uint32 block = frame / INPUT_BLOCK_FRAMES;
+		uint32 count = std::min<uint32>(frames - frame, (block+1) * INPUT_BLOCK_FRAMES - frame);
+		fwrite(InputBlock(block) + (frame % INPUT_BLOCK_FRAMES) * Movie.bytesPerFrame, Movie.bytesPerFrame, count, fp);
+		frame += count;
+	}
+}
+
+//the input as one run of frames, for MOV_Convert
+static uint8* CopyInputFrames(uint32 frames)
+{
+	uint8* data = (uint8*)malloc(Movie.bytesPerFrame * frames);
+	for (uint32 frame = 0; frame < frames; frame += INPUT_BLOCK_FRAMES)
+		memcpy(data + frame * Movie.bytesPerFrame, InputBlock(frame / INPUT_BLOCK_FRAMES),
+		       std::min<uint32>(frames - frame, INPUT_BLOCK_FRAMES) * Movie.bytesPerFrame);
+	return data;
+}
+
+static void SetInputFrames(const uint8* data, uint32 frames)
+{
+	FreeInputBlocks();
+	for (uint32 frame = 0; frame < frames; frame += INPUT_BLOCK_FRAMES)
+		memcpy(InputBlock(frame / INPUT_BLOCK_FRAMES), data + frame * Movie.bytesPerFrame,
+		       std::min<uint32>(frames - frame, INPUT_BLOCK_FRAMES) * Movie.bytesPerFrame);
+	SeekInputFrame(frames);
+}
+
 
 /*-----------------------------------------------------------------------------
 -                              FILE OPERATIONS                                -
@@ -195,6 +275,7 @@ int MOV_ReadMovieFile(char* szChoice, struct MovieType *tempMovie) {
 		tempMovie->Port2_Mtap = tempMovie->movieFlags&MOVIE_FLAG_P2_MTAP;
 		tempMovie->UsingAnalogHack = tempMovie->movieFlags&MOVIE_FLAG_ANALOG_HACK;
 		tempMovie->UsingRCntFix = tempMovie->movieFlags&MOVIE_FLAG_RCNTFIX;
+		tempMovie->UsingBootSnapshot = tempMovie->movieFlags&MOVIE_FLAG_BOOT_SNAPSHOT;
 	}
 	tempMovie->NumPlayers= 2;
 	tempMovie->P2_Start = 2;	
@@ -282,8 +363,14 @@ void MOV_WriteMovieFile()
 	Movie.inputOffset = Movie.cdIdsOffset+1+(9*Movie.CdromCount);
 	fwrite(&Movie.inputOffset, 1, 4, fpMovie);   //input offset
 	Movie.totalFrames=Movie.currentFrame+1; //used when toggling read-only mode
-	fseek(fpMovie, Movie.inputOffset, SEEK_SET);
-	fwrite(Movie.inputBuffer, 1, Movie.bytesPerFrame*(Movie.totalFrames), fpMovie);
+	if (Movie.inputOffset != Movie.inputFlushedOffset) //the cd ids before the input have grown
+		Movie.inputFlushedFrames = 0;
+	if (Movie.inputFlushedFrames > Movie.totalFrames)
+		Movie.inputFlushedFrames = Movie.totalFrames;
+	fseek(fpMovie, Movie.inputOffset + Movie.bytesPerFrame*Movie.inputFlushedFrames, SEEK_SET);
+	WriteInputFrames(fpMovie, Movie.inputFlushedFrames, Movie.totalFrames);
+	Movie.inputFlushedFrames = Movie.totalFrames;
+	Movie.inputFlushedOffset = Movie.inputOffset;
 }
 
 static void UpdateMovieFlags(void)
@@ -306,6 +393,8 @@ static void UpdateMovieFlags(void)
 		Movie.movieFlags |= MOVIE_FLAG_P1_MTAP;
 	if (Movie.Port2_Mtap)
 		Movie.movieFlags |= MOVIE_FLAG_P2_MTAP;
+	if (Movie.UsingBootSnapshot)
+		Movie.movieFlags |= MOVIE_FLAG_BOOT_SNAPSHOT;
 	fwrite(&Movie.movieFlags, 1, 2, fpMovie);      
 }
 
@@ -339,6 +428,9 @@ static void WriteMovieHeader()
 		Movie.movieFlags |= MOVIE_FLAG_ANALOG_HACK;
 	if (Config.RCntFix)
 		Movie.movieFlags |= MOVIE_FLAG_RCNTFIX;
+	Movie.UsingBootSnapshot = BootSnapshotUsed && !Movie.saveStateIncluded;
+	if (Movie.UsingBootSnapshot)
+		Movie.movieFlags |= MOVIE_FLAG_BOOT_SNAPSHOT;
 
 	
 	fwrite(&szFileHeader, 1, 4, fpMovie);          //header
@@ -476,7 +568,8 @@ static int StartRecord()
 	Movie.CdromCount = 1;
 	sprintf(Movie.CdromIds, "%9.9s", CdromId);
 	WriteMovieHeader();
-	Movie.inputBufferPtr = Movie.inputBuffer;
+	FreeInputBlocks();
+	SeekInputFrame(0);
 	ResetPads();
 	PADsetMode (0, (Movie.padType1 == 7) ? 1:0);
 	PADsetMode (1, (Movie.padType2 == 7) ? 1:0);
@@ -485,7 +578,6 @@ static int StartRecord()
 
 static int StartReplay()
 {
-	uint32 toRead;
 	Movie.bytesPerFrame = SetBytesPerFrame(Movie);
 
 	Config.PsxType = Movie.palTiming;
@@ -505,15 +597,10 @@ static int StartReplay()
 
 	// fill input buffer
 	fpMovie = fopen(Movie.movieFilename,"r+b");
-	{
-		fseek(fpMovie, Movie.inputOffset, SEEK_SET);
-		Movie.inputBufferPtr = Movie.inputBuffer;
-		toRead = Movie.bytesPerFrame * (Movie.totalFrames);
-		ReserveInputBufferSpace(toRead);
-		fread(Movie.inputBufferPtr, 1, toRead, fpMovie);
-		if (Movie.inputBufferPtr == 0)
-			return 0;
-	}
+	if (!fpMovie)
+		return 0;
+	fseek(fpMovie, Movie.inputOffset, SEEK_SET);
+	ReadInputFrames(fpMovie, Movie.totalFrames);
 	if (Movie.UsingAnalogHack)
 	{
 		Config.UsingAnalogHack = true;
@@ -609,6 +696,7 @@ inline static uint16 JoyRead16()
 
 void MOV_ReadJoy(PadDataS *pad,unsigned char type)
 {
+	PrepareInput(false);
 	pad->padding = 0;
 	pad->moveX = 0;
 	pad->moveY = 0;
@@ -843,9 +931,9 @@ void Convert_To_Text(unsigned char PadType) {
 
 void MOV_Convert()
 {
-   int OldSize = Movie.inputBufferSize;
    int OldBPF = Movie.bytesPerFrame;
-   OldBufferPtr = Movie.inputBuffer;  
+   uint8* OldBuffer = CopyInputFrames(Movie.totalFrames);
+   OldBufferPtr = OldBuffer;
    int Cflag, Cflag2;
    char tempstr[10];
    if (Movie.isText)
@@ -854,7 +942,6 @@ void MOV_Convert()
 	   Movie.bytesPerFrame = SetBytesPerFrame(Movie);
 	   NewBuffer = (uint8*)malloc(Movie.bytesPerFrame*Movie.totalFrames);
 	   NewBufferPtr = NewBuffer;
-	   Movie.inputBufferSize = Movie.bytesPerFrame*Movie.totalFrames;
 	   for (unsigned int i=0;i < Movie.totalFrames; i++)
 	   {
 		   if (Movie.Port1_Mtap)
@@ -884,7 +971,6 @@ void MOV_Convert()
 	   Movie.bytesPerFrame = SetBytesPerFrame(Movie);
 	   NewBuffer = (uint8*)malloc(Movie.bytesPerFrame*Movie.totalFrames);
 	   NewBufferPtr = NewBuffer;
-	   Movie.inputBufferSize = Movie.bytesPerFrame*Movie.totalFrames;
 	   for (unsigned int i=0;i < Movie.totalFrames; i++)
 	   {
 		   if (Movie.Port1_Mtap)
@@ -914,16 +1000,17 @@ void MOV_Convert()
 	   OldBufferPtr++;
 	  }
    }
-   free(Movie.inputBuffer);
-   Movie.inputBuffer = NewBuffer;
-   Movie.inputBufferPtr = NewBufferPtr;
+   free(OldBuffer);
+   SetInputFrames(NewBuffer, Movie.totalFrames);
+   free(NewBuffer);
    UpdateMovieFlags();
    MOV_WriteMovieFile();
    TruncateMovie();
 }
 
 void MOV_WriteJoy(PadDataS *pad,unsigned char type)
-{	
+{
+	PrepareInput(true);
 	if (Movie.isText)
 	{
 		char temp[1024];	
@@ -932,7 +1019,6 @@ void MOV_WriteJoy(PadDataS *pad,unsigned char type)
 		const char pad_mnemonics[] = "#XO^1234LDRUSLRs";
 	switch (type) {
 		case PSE_PAD_TYPE_MOUSE:
-			ReserveInputBufferSpace((uint32)((Movie.inputBufferPtr+MOUSE_PAD_SIZE)-Movie.inputBuffer));
 			for(int i=0;i<2;i++)
 			{			
 			int bitmask = (1<<(15-i));
@@ -948,7 +1034,6 @@ void MOV_WriteJoy(PadDataS *pad,unsigned char type)
 			break;
 		case PSE_PAD_TYPE_ANALOGPAD: // scph1150
 		case PSE_PAD_TYPE_ANALOGJOY: // scph1110
-			ReserveInputBufferSpace((uint32)((Movie.inputBufferPtr+ANALOG_PAD_SIZE)-Movie.inputBuffer));
 			for(int i=0;i<16;i++)
 			{			
 			int bitmask = (1<<(15-i));
@@ -963,13 +1048,11 @@ void MOV_WriteJoy(PadDataS *pad,unsigned char type)
 			Movie.inputBufferPtr += size;
 			break;
 		case PSE_PAD_TYPE_NONE:
-			ReserveInputBufferSpace((uint32)((Movie.inputBufferPtr+1)-Movie.inputBuffer));
 			Movie.inputBufferPtr[0] = (uint8)'|';
 			Movie.inputBufferPtr++;
 			break;
 		case PSE_PAD_TYPE_STANDARD:
 		default:
-			ReserveInputBufferSpace((uint32)((Movie.inputBufferPtr+STANDARD_PAD_SIZE)-Movie.inputBuffer));
 			printf("INPUT: %d\n",pad->buttonStatus^0xffff);
 			for(int i=0;i<13;i++)
 			{							
@@ -991,13 +1074,11 @@ void MOV_WriteJoy(PadDataS *pad,unsigned char type)
 	{
 		switch (type) {
 		case PSE_PAD_TYPE_MOUSE:
-			ReserveInputBufferSpace((uint32)((Movie.inputBufferPtr+4)-Movie.inputBuffer));
 			JoyWrite16(pad->buttonStatus^0xFFFF);
 			JoyWrite8(pad->moveX);
 			JoyWrite8(pad->moveY);
 			break;
 		case PSE_PAD_TYPE_ANALOGPAD: // scph1150
-			ReserveInputBufferSpace((uint32)((Movie.inputBufferPtr+6)-Movie.inputBuffer));
 			JoyWrite16(pad->buttonStatus^0xFFFF);
 			JoyWrite8(pad->leftJoyX);
 			JoyWrite8(pad->leftJoyY);
@@ -1005,7 +1086,6 @@ void MOV_WriteJoy(PadDataS *pad,unsigned char type)
 			JoyWrite8(pad->rightJoyY);
 			break;
 		case PSE_PAD_TYPE_ANALOGJOY: // scph1110
-			ReserveInputBufferSpace((uint32)((Movie.inputBufferPtr+6)-Movie.inputBuffer));
 			JoyWrite16(pad->buttonStatus^0xFFFF);
 			JoyWrite8(pad->leftJoyX);
 			JoyWrite8(pad->leftJoyY);
@@ -1016,13 +1096,13 @@ void MOV_WriteJoy(PadDataS *pad,unsigned char type)
 			break;
 		case PSE_PAD_TYPE_STANDARD:
 		default:
-			ReserveInputBufferSpace((uint32)((Movie.inputBufferPtr+2)-Movie.inputBuffer));
 			JoyWrite16(pad->buttonStatus^0xFFFF);
 		}
 	}
 }
 
-void MOV_ReadControl() {	
+void MOV_ReadControl() {
+	PrepareInput(false);
 	if (Movie.isText)
 	{
 		int contFlg = atoi((char*)Movie.inputBufferPtr);
@@ -1048,7 +1128,8 @@ void MOV_ReadControl() {
 	
 }
 
-void MOV_WriteControl() {	
+void MOV_WriteControl() {
+	PrepareInput(true);
 	if (Movie.isText)
 	{
 		char temp[10];
@@ -1065,7 +1146,6 @@ void MOV_WriteControl() {
 			controlFlags = 5;
 		if (MovieControl.VSyncWA)
 			controlFlags = 6;
-		ReserveInputBufferSpace((uint32)((Movie.inputBufferPtr+4)-Movie.inputBuffer));
 		sprintf(temp, "%d|\r\n",controlFlags); 	
 		memcpy(Movie.inputBufferPtr,temp,4);
 		Movie.inputBufferPtr +=  4;
@@ -1086,7 +1166,6 @@ void MOV_WriteControl() {
 			controlFlags |= MOVIE_CONTROL_RCNTFIX;
 		if (MovieControl.VSyncWA)
 			controlFlags |= MOVIE_CONTROL_VSYNCWA;
-		ReserveInputBufferSpace((uint32)((Movie.inputBufferPtr+1)-Movie.inputBuffer));
 		JoyWrite8(controlFlags);
 	}
 }
@@ -1173,18 +1252,37 @@ int MovieFreeze(EMUFILE *f, int Mode) {
 	gzfreezel(&cdOpenCase);
 	gzfreezel(&bufSize);
 
-	uint8* tempBuffer, *deleteTempBuffer = NULL;
-	if (!(Movie.mode == MOVIEMODE_PLAY && Mode == 0))
-		tempBuffer = Movie.inputBuffer;
-	else deleteTempBuffer = tempBuffer = new uint8[bufSize];
-	gzfreeze(tempBuffer, bufSize);
-	if(deleteTempBuffer) delete[] tempBuffer;
+	//the input is stored as one run, a block at a time. when recording, a state loaded only
+	//unflushes the input from the first frame it changes
+	uint8* tempBuffer = NULL;
+	if (Mode == 0 && Movie.mode == MOVIEMODE_RECORD)
+		tempBuffer = (uint8*)malloc(InputBlockSize());
+	for (uint32 pos = 0; pos < bufSize; ) {
+		uint8* block = InputBlock(pos / InputBlockSize());
+		uint32 size = std::min<uint32>(bufSize - pos, InputBlockSize());
+		if (Mode == 1)
+			f->fwrite(block, size);
+		else if (!tempBuffer)
+			f->fseek(size, SEEK_CUR);
+		else {
+			f->fread(tempBuffer, size);
+			if (memcmp(block, tempBuffer, size)) {
+				uint32 i = 0;
+				while (block[i] == tempBuffer[i]) i++;
+				if ((pos + i) / Movie.bytesPerFrame < Movie.inputFlushedFrames)
+					Movie.inputFlushedFrames = (pos + i) / Movie.bytesPerFrame;
+				memcpy(block, tempBuffer, size);
+			}
+		}
+		pos += size;
+	}
+	free(tempBuffer);
 
 	//loading state
 	if (Mode == 0) {
 		if (Movie.mode == MOVIEMODE_RECORD && !PSXjin_LuaRerecordCountSkip())
 			Movie.rerecordCount++;
-		Movie.inputBufferPtr = Movie.inputBuffer+(Movie.bytesPerFrame * Movie.currentFrame);
+		SeekInputFrame(Movie.currentFrame);
 
 		//update information GPU OSD after loading a savestate
 		GPUsetlagcounter(Movie.lagCounter);
@@ -0,0 +1,234 @@
+#include "PsxCommon.h"
+#include "pcprofile.h"
+#include <map>
+#include <set>
+#include <algorithm>
+
+#define MAX_DEPTH 32
+// how far back from the pc the prologue of its function is looked for
+#define MAX_SCAN 0x1000
+
+int pcSampling = 0;
+u32 pcNextSample;
+u32 pcSampleInterval;
+static std::string foldedFile;
+
+// the stacks are the starts of the functions, innermost first
+typedef std::vector<u32> Stack;
+static std::map<Stack, u32> stacks;
+static u32 samples;
+
+static std::map<u32, std::string> symbols; // by physical address
+
+void PcProfileStart(u32 interval, const char* folded)
+{
+	pcSampleInterval = std::max<u32>(interval, 1);
+	foldedFile = folded ? folded : "";
+	pcNextSample = psxRegs.cycle + pcSampleInterval;
+	pcSampling = 1;
+}
+
+void PcProfileStop()
+{
+	if (!pcSampling) return;
+	pcSampling = 0;
+	if (!foldedFile.empty())
+		PcProfileWriteFolded(foldedFile.c_str());
+}
+
+void PcProfileClear()
+{
+	stacks.clear();
+	samples = 0;
+}
+
+u32 PcProfileSamples()
+{
+	return samples;
+}
+
+static inline bool ReadWord(u32 addr, u32* word)
+{
+	u32* p = PSXM(addr & ~3);
+	if (!p) return false;
+	*word = SWAP32(*p);
+	return true;
+}
+
+// finds the start of the function addr is in by looking back for the addiu sp,sp,-n which makes its frame,
+// or for the jr ra (and its delay slot) which ends the function before it, if it has no frame.
+// also says how big the frame is, and where in it the return address is saved (-1 if it isn't)
+static u32 FindFunction(u32 pc, s32* frameSize, s32* raOffset)
+{
+	u32 start = pc & ~3, word;
+	*frameSize = 0;
+	*raOffset = -1;
+
+	for (u32 addr = start, i = 0; i < MAX_SCAN && ReadWord(addr, &word); i++, addr -= 4) {
+		if ((word & 0xffff0000) == 0x27bd0000 && (s16)word < 0) { // addiu sp,sp,-n
+			start = addr;
+			*frameSize = -(s16)word;
+			break;
+		}
+		if (word == 0x03e00008 && addr + 8 <= pc) { // jr ra
+			start = addr + 8;
+			break;
+		}
+	}
+
+	// the frame only counts once the cpu is past the instructions which make it
+	if (*frameSize) {
+		if (start >= pc) {
+			*frameSize = 0;
+			return start;
+		}
+		for (u32 addr = start + 4; addr < pc && ReadWord(addr, &word); addr += 4) {
+			if ((word & 0xffff0000) == 0xafbf0000) { // sw ra,n(sp)
+				*raOffset = (s16)word;
+				break;
+			}
+		}
+	}
+	return start;
+}
+
+void PcProfileSample()
+{
+	pcNextSample = psxRegs.cycle + pcSampleInterval;
+
+	Stack stack;
+	u32 pc = psxRegs.pc, sp = psxRegs.GPR.n.sp, ra = psxRegs.GPR.n.ra;
+	while (stack.size() < MAX_DEPTH) {
+		s32 frameSize, raOffset;
+		stack.push_back(FindFunction(pc, &frameSize, &raOffset));
+
+		if (raOffset >= 0) {
+			if (!ReadWord(sp + raOffset, &ra)) break;
+		}
+		else if (stack.size() > 1)
+			break; // only the innermost function can still have its return address in ra
+		sp += frameSize;
+
+		if (!ra || ra == pc || !PSXM(ra & ~3)) break;
+		pc = ra;
+	}
+
+	stacks[stack]++;
+	samples++;
+}
+
+bool PcProfileLoadSymbols(const char* filename)
+{
+	char line[512], name[256];
+	u32 address;
+	FILE* fp = fopen(filename, "r");
+	if (!fp) return false;
+
+	symbols.clear();
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%x %255s", &address, name) == 2)
+			symbols[address & 0x1fffffff] = name;
+	}
+	fclose(fp);
+	return true;
+}
+
+//------------------------------------------------------
+// naming the functions
+
+class FunctionNames
+{
+public:
+	FunctionNames()
+	{
+		// without symbols, every target of a jal in ram is taken to be the start of a function
+		if (symbols.empty() && psxM) {
+			for (u32 i = 0; i < 0x200000; i += 4) {
+				u32 word = psxMu32(i);
+				if ((word >> 26) == 3 && ((word & 0x3ffffff) << 2) < 0x200000)
+					targets.push_back((word & 0x3ffffff) << 2);
+			}
+			std::sort(targets.begin(), targets.end());
+			targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+		}
+	}
+
+	// the address of the function a start found on the stack belongs to, and its name
+	u32 resolve(u32 start, std::string* name)
+	{
+		u32 phys = start & 0x1fffffff;
+		char buf[16];
+
+		std::map<u32, std::string>::const_iterator sym = symbols.upper_bound(phys);
+		if (sym != symbols.begin()) {
+			--sym;
+			*name = sym->second;
+			return sym->first | (start & 0xe0000000);
+		}
+
+		std::vector<u32>::const_iterator target = std::upper_bound(targets.begin(), targets.end(), phys);
+		if (target != targets.begin() && phys - *(target - 1) < 0x10000)
+			phys = *(target - 1);
+		sprintf(buf, "sub_%08x", phys | (start & 0xe0000000));
+		*name = buf;
+		return phys | (start & 0xe0000000);
+	}
+
+private:
+	std::vector<u32> targets;
+};
+
+bool PcProfileWriteFolded(const char* filename)
+{
+	FILE* fp = fopen(filename, "w");
+	if (!fp) return false;
+
+	FunctionNames names;
+	std::map<std::string, u32> lines;
+	for (std::map<Stack, u32>::const_iterator it = stacks.begin(); it != stacks.end(); ++it) {
+		std::string line, name;
+		for (size_t i = it->first.size(); i-- > 0; ) {
+			names.resolve(it->first[i], &name);
+			line += name;
+			if (i) line += ';';
+		}
+		lines[line] += it->second;
+	}
+	for (std::map<std::string, u32>::const_iterator it = lines.begin(); it != lines.end(); ++it)
+		fprintf(fp, "%s %u\n", it->first.c_str(), it->second);
+
+	fclose(fp);
+	return true;
+}
+
+static bool MoreSelf(const PcProfileFunction& a, const PcProfileFunction& b)
+{
+	return a.self != b.self ? a.self > b.self : a.total > b.total;
+}
+
+void PcProfileFunctions(std::vector<PcProfileFunction>& functions)
+{
+	FunctionNames names;
+	std::map<u32, PcProfileFunction> byAddress;
+
+	functions.clear();
+	for (std::map<Stack, u32>::const_iterator it = stacks.begin(); it != stacks.end(); ++it) {
+		std::set<u32> seen; // a function which recursed is only counted once in a stack
+		for (size_t i = 0; i < it->first.size(); i++) {
+			std::string name;
+			u32 address = names.resolve(it->first[i], &name);
+			PcProfileFunction& f = byAddress[address];
+			if (f.name.empty()) {
+				f.address = address;
+				f.name = name;
+				f.self = f.total = 0;
+			}
+			if (i == 0) f.self += it->second;
+			if (seen.insert(address).second) f.total += it->second;
+		}
+	}
+
+	for (std::map<u32, PcProfileFunction>::const_iterator it = byAddress.begin(); it != byAddress.end(); ++it)
+		functions.push_back(it->second);
+	std::sort(functions.begin(), functions.end(), MoreSelf);
+}
@@ -0,0 +1,46 @@
+#ifndef __PCPROFILE_H__
+#define __PCPROFILE_H__
+
+#include <string>
+#include <vector>
+
+// A sampling profiler of the emulated program: which of the game's functions the cpu spends its time in.
+//
+// Every so many cycles psxBranchTest takes the pc, and walks the stack back through the callers by
+// looking for each function's prologue (the addiu sp,sp,-n which makes its frame and the sw ra which saves
+// its return address), since MIPS code keeps no frame pointers. The stacks are counted as they are,
+// and named when they're written out: by a symbol file if one was loaded, otherwise by the nearest
+// target of a jal in ram. The folded stacks file is what flamegraph.pl takes.
+
+extern int pcSampling;
+extern u32 pcNextSample, pcSampleInterval;
+void PcProfileSample();
+
+// a sample is due once the cycle count gets to pcNextSample, or if pcNextSample is more than an interval off,
+// which it is when the cycle count went back (a reset or a state load)
+inline bool PcProfileDue()
+{
+	return (u32)(pcNextSample - psxRegs.cycle - 1) >= pcSampleInterval;
+}
+
+// interval is the cycles between samples; the folded stacks are written to the file when sampling stops, if one is given
+void PcProfileStart(u32 interval, const char* foldedFile = NULL);
+void PcProfileStop();
+void PcProfileClear();
+u32 PcProfileSamples();
+
+// a text file of "address name" lines
+bool PcProfileLoadSymbols(const char* filename);
+bool PcProfileWriteFolded(const char* filename);
+
+struct PcProfileFunction
+{
+	u32 address;
+	std::string name;
+	u32 self;  // samples in the function itself
+	u32 total; // samples in it or in what it called
+};
+// the functions sampled, the ones with the most samples of their own first
+void PcProfileFunctions(std::vector<PcProfileFunction>& functions);
+
+#endif /* __PCPROFILE_H__ */
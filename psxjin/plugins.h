@@ -59,6 +59,7 @@ unsigned short SPUreadDMA(void);
 void SPUwriteDMAMem(unsigned short *, int);
 void SPUreadDMAMem(unsigned short *, int);
 void SPUplayADPCMchannel(xa_decode_t *);
+void SPUplayCDDAchannel(short *, int);
 //void SPUregisterCallback(void (CALLBACK *callback)(void));
 long SPUconfigure(void);
 long SPUopen(HWND hwnd);
@@ -0,0 +1,184 @@
+#include "PsxCommon.h"
+#include "profiler.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+const char* const profileNames[PROF_COUNT] = {
+	"cpu", "gte", "gpu", "vram", "display", "spu", "mdec", "cdrom", "lua", "idle"
+};
+
+// the OSD shows the average of this many frames
+#define OSD_FRAMES 30
+#define MAX_DEPTH 32
+
+int profiling = 0;
+static bool wanted = false;
+
+static int stack[MAX_DEPTH];
+static int depth, overflow;
+static u64 ticks[PROF_COUNT];
+static u64 lastTicks, frameStartTicks;
+static LARGE_INTEGER frameStartTime, timerFrequency;
+
+static double lastFrame[PROF_COUNT], lastTotal;
+static double osdSum[PROF_COUNT], osdTotal;
+static int osdFrames;
+
+static FILE* exportFile;
+static bool exportJson, firstRecord;
+static u32 frameNumber;
+
+static inline u64 Ticks()
+{
+#ifdef _MSC_VER
+	return __rdtsc();
+#else
+	u32 lo, hi;
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((u64)hi << 32) | lo;
+#endif
+}
+
+void ProfileEnterSlow(int category)
+{
+	u64 now = Ticks();
+	ticks[stack[depth]] += now - lastTicks;
+	lastTicks = now;
+	if (depth < MAX_DEPTH - 1)
+		stack[++depth] = category;
+	else
+		overflow++;
+}
+
+void ProfileLeaveSlow()
+{
+	u64 now = Ticks();
+	ticks[stack[depth]] += now - lastTicks;
+	lastTicks = now;
+	if (overflow)
+		overflow--;
+	else if (depth > 0)
+		depth--;
+}
+
+static void CloseExport()
+{
+	if (!exportFile) return;
+	if (exportJson)
+		fprintf(exportFile, "\n]\n");
+	fclose(exportFile);
+	exportFile = NULL;
+}
+
+bool ProfileStart(const char* filename)
+{
+	CloseExport();
+	if (filename && *filename) {
+		exportFile = fopen(filename, "w");
+		if (!exportFile) return false;
+		size_t len = strlen(filename);
+		exportJson = len >= 5 && !_stricmp(filename + len - 5, ".json");
+		firstRecord = true;
+		if (exportJson)
+			fprintf(exportFile, "[");
+		else {
+			fprintf(exportFile, "frame,total");
+			for (int i = 0; i < PROF_COUNT; i++)
+				fprintf(exportFile, ",%s", profileNames[i]);
+			fprintf(exportFile, "\n");
+		}
+	}
+	wanted = true;
+	return true;
+}
+
+void ProfileStop()
+{
+	wanted = false;
+}
+
+static void Export()
+{
+	if (exportJson) {
+		fprintf(exportFile, "%s\n{\"frame\":%u,\"total\":%.3f", firstRecord ? "" : ",", frameNumber, lastTotal);
+		for (int i = 0; i < PROF_COUNT; i++)
+			fprintf(exportFile, ",\"%s\":%.3f", profileNames[i], lastFrame[i]);
+		fprintf(exportFile, "}");
+	}
+	else {
+		fprintf(exportFile, "%u,%.3f", frameNumber, lastTotal);
+		for (int i = 0; i < PROF_COUNT; i++)
+			fprintf(exportFile, ",%.3f", lastFrame[i]);
+		fprintf(exportFile, "\n");
+	}
+	firstRecord = false;
+}
+
+static void ShowOSD()
+{
+	char text[256];
+	int len = sprintf(text, "%.1fms:", osdTotal / osdFrames);
+	for (int i = 0; i < PROF_COUNT; i++)
+		len += sprintf(text + len, " %s %.1f", profileNames[i], osdSum[i] / osdFrames);
+	GPUdisplayText(text);
+}
+
+void ProfileFrame()
+{
+	if (profiling) {
+		u64 now = Ticks();
+		LARGE_INTEGER time;
+		QueryPerformanceCounter(&time);
+		ticks[stack[depth]] += now - lastTicks;
+
+		// the tick counter's rate isn't known, so the frame's ticks are shared out over the time it really took
+		u64 frameTicks = now - frameStartTicks;
+		lastTotal = (time.QuadPart - frameStartTime.QuadPart) * 1000.0 / timerFrequency.QuadPart;
+		for (int i = 0; i < PROF_COUNT; i++) {
+			lastFrame[i] = frameTicks ? lastTotal * ticks[i] / frameTicks : 0;
+			osdSum[i] += lastFrame[i];
+			ticks[i] = 0;
+		}
+		osdTotal += lastTotal;
+		frameNumber++;
+
+		if (exportFile)
+			Export();
+		if (++osdFrames == OSD_FRAMES) {
+			ShowOSD();
+			memset(osdSum, 0, sizeof(osdSum));
+			osdTotal = 0;
+			osdFrames = 0;
+		}
+	}
+
+	if (wanted && !profiling) {
+		memset(ticks, 0, sizeof(ticks));
+		memset(osdSum, 0, sizeof(osdSum));
+		osdTotal = 0;
+		osdFrames = 0;
+		frameNumber = 0;
+		stack[0] = PROF_CPU;
+		depth = overflow = 0;
+		QueryPerformanceFrequency(&timerFrequency);
+	}
+	else if (!wanted && profiling) {
+		CloseExport();
+		GPUdisplayText(NULL);
+	}
+	profiling = wanted;
+
+	if (profiling) {
+		lastTicks = frameStartTicks = Ticks();
+		QueryPerformanceCounter(&frameStartTime);
+	}
+}
+
+bool ProfileLastFrame(double ms[PROF_COUNT], double* total)
+{
+	if (!profiling || !frameNumber) return false;
+	memcpy(ms, lastFrame, sizeof(lastFrame));
+	*total = lastTotal;
+	return true;
+}
@@ -0,0 +1,57 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+// Where the host's time goes in each frame, by subsystem.
+//
+// The subsystems mark the code they run with PROFILE_SCOPE (or ProfileEnter/ProfileLeave where a scope
+// doesn't fit), and the time between the marks is charged to whichever subsystem was entered last,
+// so the times don't overlap: the gte's time isn't counted in the cpu's, nor a dma's in the code which started it.
+// Whatever isn't marked is the cpu's. While the profiler is off a mark costs a test of a global.
+//
+// The profiler only starts and stops at the end of a frame, so the marks around it always pair up.
+
+enum ProfileCategory
+{
+	PROF_CPU,
+	PROF_GTE,
+	PROF_GPU,     // drawing primitives
+	PROF_VRAM,    // the gpu's data port: vram transfers, and the command words of the primitives
+	PROF_DISPLAY, // putting the frame on the screen
+	PROF_SPU,
+	PROF_MDEC,
+	PROF_CDROM,
+	PROF_LUA,
+	PROF_IDLE,    // the frame limiter and the window's messages
+	PROF_COUNT
+};
+
+extern int profiling;
+void ProfileEnterSlow(int category);
+void ProfileLeaveSlow();
+
+inline void ProfileEnter(int category) { if (profiling) ProfileEnterSlow(category); }
+inline void ProfileLeave() { if (profiling) ProfileLeaveSlow(); }
+
+class ProfileScope
+{
+public:
+	ProfileScope(int category) : on(profiling) { if (on) ProfileEnterSlow(category); }
+	~ProfileScope() { if (on) ProfileLeaveSlow(); }
+private:
+	int on;
+};
+
+#define PROFILE_SCOPE(category) ProfileScope profileScope(category)
+
+// starts showing the times on the screen, and writing them for each frame to the file if there is one
+// (as JSON if its name ends in .json, as CSV otherwise)
+bool ProfileStart(const char* filename);
+void ProfileStop();
+// called at the end of each frame
+void ProfileFrame();
+
+extern const char* const profileNames[PROF_COUNT];
+// the milliseconds each subsystem took in the last frame; false if the profiler isn't on
+bool ProfileLastFrame(double ms[PROF_COUNT], double* total);
+
+#endif /* __PROFILER_H__ */
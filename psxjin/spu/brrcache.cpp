@@ -0,0 +1,55 @@
+//brrcache.cpp
+
+//This program is free software; you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation; either version 2 of the License, or
+//(at your option) any later version. See also the license.txt file for
+//additional informations.                                              
+
+#include "stdafx.h"
+#include "PsxCommon.h"
+#include "brrcache.h"
+
+BRRCache::BRRCache()
+{
+	reset();
+}
+
+void BRRCache::reset()
+{
+	memset(gens,0,sizeof(gens));
+	for(int i=0;i<ENTRIES;i++)
+		entries[i].valid = false;
+	hits = misses = 0;
+}
+
+const BRRCache::Entry* BRRCache::find(u32 blockAddress, s32 s_1, s32 s_2)
+{
+	const Entry* e = slot(blockAddress,s_1,s_2);
+	if(e->valid
+		&& e->blockAddress == blockAddress
+		&& e->s_1 == s_1 && e->s_2 == s_2
+		&& e->gen[0] == gens[(blockAddress>>4)&(LINES-1)]
+		&& e->gen[1] == gens[((blockAddress+15)>>4)&(LINES-1)])
+	{
+		hits++;
+		return e;
+	}
+
+	misses++;
+	return NULL;
+}
+
+void BRRCache::store(u32 blockAddress, s32 s_1, s32 s_2, const s16* samples, s32 out_1, s32 out_2)
+{
+	Entry* e = slot(blockAddress,s_1,s_2);
+	e->valid = true;
+	e->blockAddress = blockAddress;
+	e->gen[0] = gens[(blockAddress>>4)&(LINES-1)];
+	e->gen[1] = gens[((blockAddress+15)>>4)&(LINES-1)];
+	e->s_1 = s_1;
+	e->s_2 = s_2;
+	e->out_1 = out_1;
+	e->out_2 = out_2;
+	memcpy(e->samples,samples,sizeof(e->samples));
+}
@@ -0,0 +1,60 @@
+//brrcache.h
+
+//This program is free software; you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation; either version 2 of the License, or
+//(at your option) any later version. See also the license.txt file for
+//additional informations.                                              
+
+#ifndef _BRRCACHE_H_
+#define _BRRCACHE_H_
+
+#include "PsxCommon.h"
+
+//a cache of decoded BRR blocks, so that looped samples and samples played on several channels
+//don't need to be decoded again every time a channel reaches them.
+//the result of decoding a block depends on its 16 bytes of spu ram and on the two previous samples of the decoder,
+//so entries are keyed on all of those. writes to spu ram bump a generation counter for the 16 bytes they land in,
+//which invalidates any entries made from them.
+class BRRCache
+{
+public:
+	struct Entry
+	{
+		u32 blockAddress;
+		u32 gen[2];     //generations of the (up to two) 16 byte lines the block was decoded from
+		s32 s_1, s_2;   //decoder history going into the block
+		s32 out_1, out_2; //decoder history coming out of the block
+		s16 samples[28];
+		bool valid;
+	};
+
+	BRRCache();
+
+	//the entries describe the ram of the spu which owns the cache, so they don't get copied along with the rest of it
+	BRRCache& operator=(const BRRCache&) { reset(); return *this; }
+
+	void reset();
+
+	//call this whenever spu ram at addr is written
+	void invalidate(u32 addr) { gens[(addr>>4)&(LINES-1)]++; }
+
+	//returns the decoded block, or NULL if it needs to be decoded and stored
+	const Entry* find(u32 blockAddress, s32 s_1, s32 s_2);
+	void store(u32 blockAddress, s32 s_1, s32 s_2, const s16* samples, s32 out_1, s32 out_2);
+
+	u32 hits, misses;
+
+private:
+	static const int LINES = 0x80000>>4;
+	static const int ENTRIES = 2048;
+
+	Entry* slot(u32 blockAddress, s32 s_1, s32 s_2) {
+		return &entries[((blockAddress>>3) ^ (s_1*7) ^ (s_2*13)) & (ENTRIES-1)];
+	}
+
+	u32 gens[LINES];
+	Entry entries[ENTRIES];
+};
+
+#endif //_BRRCACHE_H_
@@ -60,8 +60,8 @@ void SPU_chan::save(EMUFILE* fp)
 
 	ADSR.save(fp);
 
-	fp->writedouble(smpinc);
-	fp->writedouble(smpcnt);
+	fp->writedouble(smpinc/4096.0);
+	fp->writedouble(smpcnt/4096.0);
 	fp->write32le(blockAddress);
 
 	fp->write8le(bFMod);
@@ -100,8 +100,8 @@ void SPU_chan::load(EMUFILE* fp)
 
 	ADSR.load(fp);
 
-	fp->readdouble(&smpinc);
-	fp->readdouble(&smpcnt);
+	smpinc = (u32)(fp->readdouble()*4096);
+	smpcnt = (u32)(fp->readdouble()*4096);
 	fp->read32le(&blockAddress);
 
 	fp->read8le(&bFMod);
@@ -132,8 +132,7 @@ void SPUfreeze_new(EMUFILE* fp)
 
 	fp->write32le((u32)0); //version
 
-	CTASSERT(sizeof(SPU_core->spuMem)==0x80000);
-	fp->fwrite(SPU_core->spuMem,0x80000);
+	SPU_core->spuMem.save(fp);
 	fp->fwrite(regArea,0x200);
 	
 	fp->writedouble(&SPU_core->mixtime);
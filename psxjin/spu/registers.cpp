@@ -272,7 +272,7 @@ void SPU_struct::writeRegister(u32 r, u16 val)
 		break;
 
 	case H_SPUdata:
-		spuMem[spuAddr>>1] = val;
+		writeSpuMem(spuAddr,val);
 		spuAddr+=2;
 		if (spuAddr>0x7ffff) spuAddr=0;
 		break;
@@ -462,6 +462,14 @@ void SPUwriteRegister(u32 reg, u16 val)
 	//we have no reason yet to doubt that this will work.
 	regArea[(r-0xc00)>>1] = val;
 
+	//a data port write is the same as a single word dma; the user spu can take it along with the core.
+	//it changes the ram's page tables, which the sound thread also does, so it's made under the lock
+	if(r==H_SPUdata)
+	{
+		SPUwriteDMA(val);
+		return;
+	}
+
 	SPU_core->writeRegister(r,val);
 	if(SPU_user)
 		SPU_user->writeRegister(r,val);
@@ -521,7 +529,7 @@ u16 SPUreadRegister(u32 reg)
 			return (u16)(SPU_core->spuAddr>>3);
 
 		case H_SPUdata: {
-			u16 s=SPU_core->spuMem[SPU_core->spuAddr>>1];
+			u16 s=SPU_core->spuMem.read16(SPU_core->spuAddr);
 			SPU_core->spuAddr+=2;
 			if(SPU_core->spuAddr>0x7ffff) SPU_core->spuAddr=0;
 			
@@ -38,6 +38,8 @@
 #include "PsxCommon.h"
 #include "externals.h"
 
+#include <algorithm>
+
 
 void StartREVERB(SPU_chan * pChannel)
 {
@@ -67,44 +69,80 @@ void SPU_struct::StoreREVERB(SPU_chan* pChannel,s32 left,s32 right)
 
 ////////////////////////////////////////////////////////////////////////
 
-FORCEINLINE int SPU_struct::g_buffer(int iOff)                          // get_buffer content helper: takes care about wraps
+//returns the spu ram index (in samples) of a reverb buffer location relative to the current work address.
+//with WRAP, takes care of wraps around the work area; without it, the caller has already made sure that none can happen
+template<bool WRAP> FORCEINLINE int SPU_struct::rvbIndex(int iOff)
+{
+	iOff+=rvb.CurrAddr;
+	if(WRAP)
+	{
+		while (iOff>0x3FFFF)       iOff=rvb.StartAddr+(iOff-0x40000);
+		while (iOff<rvb.StartAddr) iOff=0x3ffff-(rvb.StartAddr-iOff);
+	}
+	return iOff;
+}
+
+////////////////////////////////////////////////////////////////////////
+
+template<bool WRAP> FORCEINLINE int SPU_struct::g_buffer(int iOff)                          // get_buffer content helper
 {
-	short * p=(short *)spuMem;
-	iOff=(iOff*4)+rvb.CurrAddr;
-	while (iOff>0x3FFFF)       iOff=rvb.StartAddr+(iOff-0x40000);
-	while (iOff<rvb.StartAddr) iOff=0x3ffff-(rvb.StartAddr-iOff);
-	return (int)*(p+iOff);
+	return (s16)spuMem.read16(rvbIndex<WRAP>(iOff*4)<<1);
 }
 
 ////////////////////////////////////////////////////////////////////////
 
-FORCEINLINE void SPU_struct::s_buffer(int iOff,int iVal)                // set_buffer content helper: takes care about wraps and clipping
+template<bool WRAP> FORCEINLINE void SPU_struct::s_buffer(int iOff,int iVal)                // set_buffer content helper: takes care about clipping
 {
-	short * p=(short *)spuMem;
-	iOff=(iOff*4)+rvb.CurrAddr;
-	while (iOff>0x3FFFF) iOff=rvb.StartAddr+(iOff-0x40000);
-	while (iOff<rvb.StartAddr) iOff=0x3ffff-(rvb.StartAddr-iOff);
+	iOff=rvbIndex<WRAP>(iOff*4);
 	if (iVal<-32768L) iVal=-32768L;
 	if (iVal>32767L) iVal=32767L;
-	*(p+iOff)=(short)iVal;
+	writeSpuMem(iOff<<1,(u16)iVal);
 }
 
 ////////////////////////////////////////////////////////////////////////
 
-FORCEINLINE void SPU_struct::s_buffer1(int iOff,int iVal)                // set_buffer (+1 sample) content helper: takes care about wraps and clipping
+template<bool WRAP> FORCEINLINE void SPU_struct::s_buffer1(int iOff,int iVal)                // set_buffer (+1 sample) content helper: takes care about clipping
 {
-	short * p=(short *)spuMem;
-	iOff=(iOff*4)+rvb.CurrAddr+1;
-	while (iOff>0x3FFFF) iOff=rvb.StartAddr+(iOff-0x40000);
-	while (iOff<rvb.StartAddr) iOff=0x3ffff-(rvb.StartAddr-iOff);
+	iOff=rvbIndex<WRAP>((iOff*4)+1);
 	if (iVal<-32768L) iVal=-32768L;
 	if (iVal>32767L) iVal=32767L;
-	*(p+iOff)=(short)iVal;
+	writeSpuMem(iOff<<1,(u16)iVal);
 }
 
 ////////////////////////////////////////////////////////////////////////
 
-int SPU_struct::MixREVERBLeft()
+//returns true if none of the reverb buffer accesses can wrap around the work area during the next `ticks` 22khz ticks.
+//the reverb can then address the work area directly for all of them.
+bool SPU_struct::REVERB_canSkipWraps(int ticks)
+{
+	const s32 offsets[] = {
+		rvb.IIR_SRC_A0, rvb.IIR_SRC_A1, rvb.IIR_SRC_B0, rvb.IIR_SRC_B1,
+		rvb.IIR_DEST_A0, rvb.IIR_DEST_A1, rvb.IIR_DEST_B0, rvb.IIR_DEST_B1,
+		rvb.ACC_SRC_A0, rvb.ACC_SRC_B0, rvb.ACC_SRC_C0, rvb.ACC_SRC_D0,
+		rvb.ACC_SRC_A1, rvb.ACC_SRC_B1, rvb.ACC_SRC_C1, rvb.ACC_SRC_D1,
+		rvb.MIX_DEST_A0, rvb.MIX_DEST_A1, rvb.MIX_DEST_B0, rvb.MIX_DEST_B1,
+		rvb.MIX_DEST_A0 - rvb.FB_SRC_A, rvb.MIX_DEST_A1 - rvb.FB_SRC_A,
+		rvb.MIX_DEST_B0 - rvb.FB_SRC_B, rvb.MIX_DEST_B1 - rvb.FB_SRC_B,
+	};
+
+	s32 lo = offsets[0], hi = offsets[0];
+	for(int i=1;i<(int)ARRAY_SIZE(offsets);i++)
+	{
+		lo = std::min(lo,offsets[i]);
+		hi = std::max(hi,offsets[i]);
+	}
+
+	//the work address itself wraps when it passes the end of spu ram
+	const s32 lastAddr = rvb.CurrAddr + ticks - 1;
+	if (lastAddr>0x3FFFF) return false;
+
+	//(+1 for the IIR destinations, which are written one sample ahead)
+	return rvb.CurrAddr + lo*4 >= rvb.StartAddr && lastAddr + hi*4 + 1 <= 0x3FFFF;
+}
+
+////////////////////////////////////////////////////////////////////////
+
+template<bool WRAP> int SPU_struct::REVERB_mixLeft()
 {
 	//if (iUseReverb==0) return 0;
 
@@ -121,46 +159,46 @@ int SPU_struct::MixREVERBLeft()
 			const int INPUT_SAMPLE_L=sRVBBuf[0];
 			const int INPUT_SAMPLE_R=sRVBBuf[1];
 
-			const int IIR_INPUT_A0 = (g_buffer(rvb.IIR_SRC_A0) * rvb.IIR_COEF)/32768L + (INPUT_SAMPLE_L * rvb.IN_COEF_L)/32768L;
-			const int IIR_INPUT_A1 = (g_buffer(rvb.IIR_SRC_A1) * rvb.IIR_COEF)/32768L + (INPUT_SAMPLE_R * rvb.IN_COEF_R)/32768L;
-			const int IIR_INPUT_B0 = (g_buffer(rvb.IIR_SRC_B0) * rvb.IIR_COEF)/32768L + (INPUT_SAMPLE_L * rvb.IN_COEF_L)/32768L;
-			const int IIR_INPUT_B1 = (g_buffer(rvb.IIR_SRC_B1) * rvb.IIR_COEF)/32768L + (INPUT_SAMPLE_R * rvb.IN_COEF_R)/32768L;
-
-			const int IIR_A0 = (IIR_INPUT_A0 * rvb.IIR_ALPHA)/32768L + (g_buffer(rvb.IIR_DEST_A0) * (32768L - rvb.IIR_ALPHA))/32768L;
-			const int IIR_A1 = (IIR_INPUT_A1 * rvb.IIR_ALPHA)/32768L + (g_buffer(rvb.IIR_DEST_A1) * (32768L - rvb.IIR_ALPHA))/32768L;
-			const int IIR_B0 = (IIR_INPUT_B0 * rvb.IIR_ALPHA)/32768L + (g_buffer(rvb.IIR_DEST_B0) * (32768L - rvb.IIR_ALPHA))/32768L;
-			const int IIR_B1 = (IIR_INPUT_B1 * rvb.IIR_ALPHA)/32768L + (g_buffer(rvb.IIR_DEST_B1) * (32768L - rvb.IIR_ALPHA))/32768L;
-
-			s_buffer1(rvb.IIR_DEST_A0, IIR_A0);
-			s_buffer1(rvb.IIR_DEST_A1, IIR_A1);
-			s_buffer1(rvb.IIR_DEST_B0, IIR_B0);
-			s_buffer1(rvb.IIR_DEST_B1, IIR_B1);
-
-			ACC0 = (g_buffer(rvb.ACC_SRC_A0) * rvb.ACC_COEF_A)/32768L +
-			       (g_buffer(rvb.ACC_SRC_B0) * rvb.ACC_COEF_B)/32768L +
-			       (g_buffer(rvb.ACC_SRC_C0) * rvb.ACC_COEF_C)/32768L +
-			       (g_buffer(rvb.ACC_SRC_D0) * rvb.ACC_COEF_D)/32768L;
-			ACC1 = (g_buffer(rvb.ACC_SRC_A1) * rvb.ACC_COEF_A)/32768L +
-			       (g_buffer(rvb.ACC_SRC_B1) * rvb.ACC_COEF_B)/32768L +
-			       (g_buffer(rvb.ACC_SRC_C1) * rvb.ACC_COEF_C)/32768L +
-			       (g_buffer(rvb.ACC_SRC_D1) * rvb.ACC_COEF_D)/32768L;
-
-			FB_A0 = g_buffer(rvb.MIX_DEST_A0 - rvb.FB_SRC_A);
-			FB_A1 = g_buffer(rvb.MIX_DEST_A1 - rvb.FB_SRC_A);
-			FB_B0 = g_buffer(rvb.MIX_DEST_B0 - rvb.FB_SRC_B);
-			FB_B1 = g_buffer(rvb.MIX_DEST_B1 - rvb.FB_SRC_B);
-
-			s_buffer(rvb.MIX_DEST_A0, ACC0 - (FB_A0 * rvb.FB_ALPHA)/32768L);
-			s_buffer(rvb.MIX_DEST_A1, ACC1 - (FB_A1 * rvb.FB_ALPHA)/32768L);
-
-			s_buffer(rvb.MIX_DEST_B0, (rvb.FB_ALPHA * ACC0)/32768L - (FB_A0 * (int)(rvb.FB_ALPHA^0xFFFF8000))/32768L - (FB_B0 * rvb.FB_X)/32768L);
-			s_buffer(rvb.MIX_DEST_B1, (rvb.FB_ALPHA * ACC1)/32768L - (FB_A1 * (int)(rvb.FB_ALPHA^0xFFFF8000))/32768L - (FB_B1 * rvb.FB_X)/32768L);
+			const int IIR_INPUT_A0 = (g_buffer<WRAP>(rvb.IIR_SRC_A0) * rvb.IIR_COEF)/32768L + (INPUT_SAMPLE_L * rvb.IN_COEF_L)/32768L;
+			const int IIR_INPUT_A1 = (g_buffer<WRAP>(rvb.IIR_SRC_A1) * rvb.IIR_COEF)/32768L + (INPUT_SAMPLE_R * rvb.IN_COEF_R)/32768L;
+			const int IIR_INPUT_B0 = (g_buffer<WRAP>(rvb.IIR_SRC_B0) * rvb.IIR_COEF)/32768L + (INPUT_SAMPLE_L * rvb.IN_COEF_L)/32768L;
+			const int IIR_INPUT_B1 = (g_buffer<WRAP>(rvb.IIR_SRC_B1) * rvb.IIR_COEF)/32768L + (INPUT_SAMPLE_R * rvb.IN_COEF_R)/32768L;
+
+			const int IIR_A0 = (IIR_INPUT_A0 * rvb.IIR_ALPHA)/32768L + (g_buffer<WRAP>(rvb.IIR_DEST_A0) * (32768L - rvb.IIR_ALPHA))/32768L;
+			const int IIR_A1 = (IIR_INPUT_A1 * rvb.IIR_ALPHA)/32768L + (g_buffer<WRAP>(rvb.IIR_DEST_A1) * (32768L - rvb.IIR_ALPHA))/32768L;
+			const int IIR_B0 = (IIR_INPUT_B0 * rvb.IIR_ALPHA)/32768L + (g_buffer<WRAP>(rvb.IIR_DEST_B0) * (32768L - rvb.IIR_ALPHA))/32768L;
+			const int IIR_B1 = (IIR_INPUT_B1 * rvb.IIR_ALPHA)/32768L + (g_buffer<WRAP>(rvb.IIR_DEST_B1) * (32768L - rvb.IIR_ALPHA))/32768L;
+
+			s_buffer1<WRAP>(rvb.IIR_DEST_A0, IIR_A0);
+			s_buffer1<WRAP>(rvb.IIR_DEST_A1, IIR_A1);
+			s_buffer1<WRAP>(rvb.IIR_DEST_B0, IIR_B0);
+			s_buffer1<WRAP>(rvb.IIR_DEST_B1, IIR_B1);
+
+			ACC0 = (g_buffer<WRAP>(rvb.ACC_SRC_A0) * rvb.ACC_COEF_A)/32768L +
+			       (g_buffer<WRAP>(rvb.ACC_SRC_B0) * rvb.ACC_COEF_B)/32768L +
+			       (g_buffer<WRAP>(rvb.ACC_SRC_C0) * rvb.ACC_COEF_C)/32768L +
+			       (g_buffer<WRAP>(rvb.ACC_SRC_D0) * rvb.ACC_COEF_D)/32768L;
+			ACC1 = (g_buffer<WRAP>(rvb.ACC_SRC_A1) * rvb.ACC_COEF_A)/32768L +
+			       (g_buffer<WRAP>(rvb.ACC_SRC_B1) * rvb.ACC_COEF_B)/32768L +
+			       (g_buffer<WRAP>(rvb.ACC_SRC_C1) * rvb.ACC_COEF_C)/32768L +
+			       (g_buffer<WRAP>(rvb.ACC_SRC_D1) * rvb.ACC_COEF_D)/32768L;
+
+			FB_A0 = g_buffer<WRAP>(rvb.MIX_DEST_A0 - rvb.FB_SRC_A);
+			FB_A1 = g_buffer<WRAP>(rvb.MIX_DEST_A1 - rvb.FB_SRC_A);
+			FB_B0 = g_buffer<WRAP>(rvb.MIX_DEST_B0 - rvb.FB_SRC_B);
+			FB_B1 = g_buffer<WRAP>(rvb.MIX_DEST_B1 - rvb.FB_SRC_B);
+
+			s_buffer<WRAP>(rvb.MIX_DEST_A0, ACC0 - (FB_A0 * rvb.FB_ALPHA)/32768L);
+			s_buffer<WRAP>(rvb.MIX_DEST_A1, ACC1 - (FB_A1 * rvb.FB_ALPHA)/32768L);
+
+			s_buffer<WRAP>(rvb.MIX_DEST_B0, (rvb.FB_ALPHA * ACC0)/32768L - (FB_A0 * (int)(rvb.FB_ALPHA^0xFFFF8000))/32768L - (FB_B0 * rvb.FB_X)/32768L);
+			s_buffer<WRAP>(rvb.MIX_DEST_B1, (rvb.FB_ALPHA * ACC1)/32768L - (FB_A1 * (int)(rvb.FB_ALPHA^0xFFFF8000))/32768L - (FB_B1 * rvb.FB_X)/32768L);
 
 			rvb.iLastRVBLeft  = rvb.iRVBLeft;
 			rvb.iLastRVBRight = rvb.iRVBRight;
 
-			rvb.iRVBLeft  = (g_buffer(rvb.MIX_DEST_A0)+g_buffer(rvb.MIX_DEST_B0))/3;
-			rvb.iRVBRight = (g_buffer(rvb.MIX_DEST_A1)+g_buffer(rvb.MIX_DEST_B1))/3;
+			rvb.iRVBLeft  = (g_buffer<WRAP>(rvb.MIX_DEST_A0)+g_buffer<WRAP>(rvb.MIX_DEST_B0))/3;
+			rvb.iRVBRight = (g_buffer<WRAP>(rvb.MIX_DEST_A1)+g_buffer<WRAP>(rvb.MIX_DEST_B1))/3;
 
 			rvb.iRVBLeft  = (rvb.iRVBLeft  * rvb.VolLeft)  / 0x4000;
 			rvb.iRVBRight = (rvb.iRVBRight * rvb.VolRight) / 0x4000;
@@ -182,6 +220,11 @@ int SPU_struct::MixREVERBLeft()
 	return rvb.iLastRVBLeft;
 }
 
+int SPU_struct::MixREVERBLeft()
+{
+	return REVERB_mixLeft<true>();
+}
+
 ////////////////////////////////////////////////////////////////////////
 
 int SPU_struct::MixREVERBRight()
@@ -195,6 +238,32 @@ int SPU_struct::MixREVERBRight()
 
 ////////////////////////////////////////////////////////////////////////
 
+template<bool WRAP> void SPU_struct::REVERB_mixBlock(const s32* inLeft, const s32* inRight, s32* left, s32* right, int length)
+{
+	for(int j=0;j<length;j++)
+	{
+		sRVBBuf[0] = inLeft[j];
+		sRVBBuf[1] = inRight[j];
+		left[j] += REVERB_mixLeft<WRAP>();
+		right[j] += MixREVERBRight();
+	}
+}
+
+//runs the reverb over a block of 44100hz samples, adding its output into left and right.
+//inLeft and inRight hold the reverb input for each sample (what StoreREVERB would have accumulated).
+//this gives exactly the same results as MixREVERBLeft/MixREVERBRight once per sample,
+//but when the work area can't wrap during the block, it skips the wrap handling on every buffer access.
+void SPU_struct::MixREVERBBlock(const s32* inLeft, const s32* inRight, s32* left, s32* right, int length)
+{
+	//there is one 22khz tick for every two samples, and maybe one more depending on where we are in the cycle
+	if(REVERB_canSkipWraps(length/2+1))
+		REVERB_mixBlock<false>(inLeft,inRight,left,right,length);
+	else
+		REVERB_mixBlock<true>(inLeft,inRight,left,right,length);
+}
+
+////////////////////////////////////////////////////////////////////////
+
 
 /*
 -----------------------------------------------------------------------------
@@ -23,6 +23,11 @@
 
 #include <stdio.h>
 #include <queue>
+#include <algorithm>
+
+#ifdef ENABLE_SSE2
+#include <emmintrin.h>
+#endif
 
 //FILE* wavout = NULL;
 
@@ -41,6 +46,7 @@
 #include "metaspu/metaspu.h"
 #include "xa.h"
 #include "movie.h"
+#include "profiler.h"
 #include "registers.h"
 
 SPU_struct *SPU_core, *SPU_user;
@@ -122,8 +128,9 @@ static int iSecureStart=0; // secure start counter
 
 void SPU_chan::updatePitch(u16 pitch)
 {
-	smpinc = 44100.0 / 44100.0 / 4096 * pitch;
-	//printf("%f\n",smpinc);
+	//the pitch register is already a 4.12 fixed point sample step at 44100hz
+	smpinc = pitch;
+	//printf("%08X\n",smpinc);
 }
 
 void SPU_chan::keyon()
@@ -137,7 +144,7 @@ void SPU_chan::keyon()
 
 	iOldNoise = 0;
 	flags = 0;
-	smpcnt = 28;
+	smpcnt = 28<<12;
 
 	updatePitch(rawPitch);
 	
@@ -386,26 +393,24 @@ SPU_struct::SPU_struct(bool _isCore)
 		channels[i].ch = i;
 		channels[i].spu = this;
 	}
-
-	memset(spuMem,0,sizeof(spuMem));
 }
 
 SPU_struct::~SPU_struct() {
 }
 
-s32 SPU_chan::decodeBRR(SPU_struct* spu)
+bool SPU_chan::fetchBRR(SPU_struct* spu)
 {
 	//find out which block we need and decode a new one if necessary.
 	//it is safe to only check for overflow once since we can only play samples at +2 octaves (4x too fast)
 	//and so as long as we are outputting at near psx resolution (44100) we can only advance through samples
 	//at rates that are low enough to be safe.
 	//if we permitted 11025khz output the story would be different.
+	//returns false if the channel stopped instead.
 
 restart:
 
-	//printf("%d %f\n",ch,smpcnt);
-	int sampnum = (int)smpcnt;
-	if(sampnum>=28)
+	//printf("%d %08X\n",ch,smpcnt);
+	if(smpcnt>=(28<<12))
 	{
 		//end or loop
 		if(flags&1)
@@ -421,7 +426,7 @@ restart:
 			//maybe adsr release is only for keyoff
 			if(flags != 3) {
 				status = CHANSTATUS_STOPPED;
-				return 0;
+				return false;
 			}
 			else {
 				//printf("[%02d] looping to %d\n",ch,loopStartAddr);
@@ -434,9 +439,7 @@ restart:
 		//do not do this before "end or loop" or else looping will glitch as it fails to
 		//immediately decode a block.
 		//why did I ever try this? I can't remember.
-		smpcnt -= 28;
-
-		sampnum = (int)smpcnt;
+		smpcnt -= 28<<12;
 
 		//this will be tested by the impressive valkyrie profile new game sound
 		//which is large and apparently streams in
@@ -452,18 +455,32 @@ restart:
 			//printf("[%02d] embedded loop addr set to %d\n",ch,loopStartAddr);
 		}
 
-		blockAddress+=2;
-
-		s32 predict_nr = header0;
-		s32 shift_factor = predict_nr&0xf;
-		predict_nr >>= 4;
-
 		//before we decode a new block, save the last 4 values of the old block
 		block[28] = block[24];
 		block[29] = block[25];
 		block[30] = block[26];
 		block[31] = block[27];
 
+		//looped samples and samples playing on several channels will usually have been decoded already
+		const BRRCache::Entry* cached = spu->brrCache.find(blockAddress,s_1,s_2);
+		if(cached)
+		{
+			memcpy(block,cached->samples,sizeof(cached->samples));
+			s_1 = cached->out_1;
+			s_2 = cached->out_2;
+			blockAddress+=16;
+			return true;
+		}
+
+		const u32 cacheAddress = blockAddress;
+		const s32 cache_1 = s_1, cache_2 = s_2;
+
+		blockAddress+=2;
+
+		s32 predict_nr = header0;
+		s32 shift_factor = predict_nr&0xf;
+		predict_nr >>= 4;
+
 		//decode 
 		for(int i=0,j=0;i<14;i++)
 		{
@@ -487,37 +504,109 @@ restart:
 
 			block[j++] = fa;
 		}
+
+		spu->brrCache.store(cacheAddress,cache_1,cache_2,block,s_1,s_2);
 	}
 
+	return true;
+}
+
+s32 SPU_chan::decodeBRR(SPU_struct* spu)
+{
+	if(!fetchBRR(spu))
+		return 0;
+
 	//perform interpolation. hardcoded for now
 	//if(GetAsyncKeyState('I'))
 	//it is safe to only check for overflow once since we can only play samples at +2 octaves (4x too fast)
+	int sampnum = smpcnt>>12;
 	if(true)
 	{
 		s16 a = block[sampnum];
 		s16 b = block[(sampnum-1)&31];
 		s16 c = block[(sampnum-2)&31];
 		s16 d = block[(sampnum-3)&31];
-		return Interpolate(a,b,c,d,smpcnt);
+		return Interpolate(a,b,c,d,smpcnt/4096.0);
 	}
 	else return block[sampnum];
 
 	//printf("%d\n",*out);
 }
 
+static FORCEINLINE void tickDecodeBufferIrqs(SPU_struct* spu)
+{
+	if(spu->isCore)
+	{
+		spu->triggerIrqRange(spu->mixIrqCounter,2);
+		spu->triggerIrqRange(spu->mixIrqCounter+0x400,2);
+		spu->triggerIrqRange(spu->mixIrqCounter+0x800,2);
+		spu->triggerIrqRange(spu->mixIrqCounter+0xC00,2);
 
-void mixAudio(bool killReverb, SPU_struct* spu, int length)
+		spu->mixIrqCounter += 2;
+		spu->mixIrqCounter &= 0x3FF;
+	}
+}
+
+//the final stage of mixing one output sample, shared by both mixers:
+//adds in xa, handles mute and the decode buffer irqs, and writes to the output buffer
+static FORCEINLINE void mixOutputSample(SPU_struct* spu, int j, s32 left_accum, s32 right_accum)
 {
-	memset(spu->outbuf, 0, length*4*2);
+	{
+		s32 left, right;
+		spu->xaqueue.fetch(&left,&right);
 
-	//(todo - analyze master volumes etc.)
+		left_accum += left;
+		right_accum += right;
+	}
 
-	bool checklog[24]; for(int i=0;i<24;i++) checklog[i] = false;
+	//handle spu mute
+	if ((spu->spuCtrl&0x4000)==0) {
+		left_accum = 0;
+		right_accum = 0;
+	}
+
+	s16 output[] = { limit(left_accum), limit(right_accum) };
+
+	if(iSoundMode == SOUND_MODE_SYNCH && spu->isCore)
+		synchronizer->enqueue_samples(output,1);
+
+	spu->outbuf[j*2] = output[0];
+	spu->outbuf[j*2+1] = output[1];
+
+	//fwrite(&left_out,2,1,wavout);
+	//fwrite(&right_out,2,1,wavout);
+	//fflush(wavout);
+
+	// special irq handling in the decode buffers (0x0000-0x1000)
+	// we know:
+	// the decode buffers are located in spu memory in the following way:
+	// 0x0000-0x03ff  CD audio left
+	// 0x0400-0x07ff  CD audio right
+	// 0x0800-0x0bff  Voice 1
+	// 0x0c00-0x0fff  Voice 3
+	// and decoded data is 16 bit for one sample
+	// we assume:
+	// even if voices 1/3 are off or no cd audio is playing, the internal
+	// play positions will move on and wrap after 0x400 bytes.
+	// Therefore: we just need a pointer from spumem+0 to spumem+3ff, and
+	// increase this pointer on each sample by 2 bytes. If this pointer
+	// (or 0x400 offsets of this pointer) hits the spuirq address, we generate
+	// an IRQ. 
+
+	tickDecodeBufferIrqs(spu);
+}
+
+//the reference mixer. it visits every channel for every output sample.
+//the block mixer below must match it; it is still used when more than one channel is pulling from the shared noise generator,
+//since the order in which the noise is consumed can't be reproduced one channel at a time.
+static void mixAudio_reference(bool killReverb, SPU_struct* spu, int length)
+{
+	//(todo - analyze master volumes etc.)
 
 	for(int j=0;j<length;j++)
 	{
 		s32 left_accum = 0, right_accum = 0;
-		s32 fmod;
+		s32 fmod = 0;
 
 		spu->REVERB_initSample();
 
@@ -548,8 +637,6 @@ void mixAudio(bool killReverb, SPU_struct* spu, int length)
 
 			//and now immediately afterwards tick it again
 			MixADSR(chan);
-	
-			checklog[i] = true;
 
 			samp = samp * adsrLevel/1023;
 			//samp = ((s64)samp * adsrLevel)>>10; //maybe better?
@@ -557,7 +644,7 @@ void mixAudio(bool killReverb, SPU_struct* spu, int length)
 			//apply the modulation
 			if(chan->bFMod)
 			{
-				if(fmod < -32768 || fmod > 32767) printf("[%02d]: fmod value out of range! (%d) !\n",samp);
+				if(fmod < -32768 || fmod > 32767) printf("[%02d]: fmod value out of range! (%d) !\n",i,fmod);
 				//this was a little hard to test. ff7 battle fx were using it, but 
 				//its hard to tell since I dont think our noise is very good. need a better test.
 				s32 pitch = chan->rawPitch;
@@ -592,78 +679,443 @@ void mixAudio(bool killReverb, SPU_struct* spu, int length)
 			right_accum += spu->MixREVERBRight();
 		}
 
-		{
-			s32 left, right;
-			spu->xaqueue.fetch(&left,&right);
+		mixOutputSample(spu,j,left_accum,right_accum);
 
-			left_accum += left;
-			right_accum += right;
+	} //sample loop
+}
+
+//---------------------------------------------------------------
+//block mixer
+//rather than visiting all 24 channels for every output sample, each channel renders a whole block of samples
+//at a time with its state held in registers and a fixed point sample counter.
+//everything which crosses channels within one output sample is kept in arrays covering the block:
+//the fmod input of the next channel, the dry mix, and the reverb input.
+//the reverb then runs over the whole block, and the last stage (xa, irqs) is run one sample at a time.
+
+#define MIXBLOCK_SIZE 256
+
+struct SPU_mixblock
+{
+	s32 voice[MIXBLOCK_SIZE];    //the current channel's output, after the envelope
+	s32 fmod[MIXBLOCK_SIZE];     //the previous channel's output (the fmod input for the current channel)
+	s32 left[MIXBLOCK_SIZE], right[MIXBLOCK_SIZE];
+	s32 rvbLeft[MIXBLOCK_SIZE], rvbRight[MIXBLOCK_SIZE];
+};
+
+static SPU_mixblock mixblock;
+
+//the fixed point interpolators. these take the fractional sample position in 12 bits.
+//gaussian is exactly the same as _Interpolate; linear and cubic can differ from its float math by 1
+template<SPUInterpolationMode MODE> static FORCEINLINE s32 InterpolateFixed(const s16* block, int sampnum, u32 frac);
+
+template<> FORCEINLINE s32 InterpolateFixed<SPUInterpolation_None>(const s16* block, int sampnum, u32 frac)
+{
+	return block[sampnum];
+}
+
+template<> FORCEINLINE s32 InterpolateFixed<SPUInterpolation_Linear>(const s16* block, int sampnum, u32 frac)
+{
+	s32 a = block[sampnum];
+	s32 b = block[(sampnum-1)&31];
+	return (b*(s32)(4096-frac) + a*(s32)frac)>>12;
+}
+
+#ifdef ENABLE_SSE2
+//the gauss table narrowed to 16 bits (the largest coefficient is 0x519) so it can be multiplied in sse lanes
+static s16 gauss16[1024];
+#endif
+
+static void StaticInitMixer()
+{
+#ifdef ENABLE_SSE2
+	for(int i=0;i<1024;i++)
+		gauss16[i] = (s16)gauss[i];
+#endif
+}
+
+template<> FORCEINLINE s32 InterpolateFixed<SPUInterpolation_Gaussian>(const s16* block, int sampnum, u32 frac)
+{
+	s32 index = (frac>>4)*4;
+#ifdef ENABLE_SSE2
+	//gather the taps oldest first so that they line up with the gauss table
+	s16 taps[4] = { block[(sampnum-3)&31], block[(sampnum-2)&31], block[(sampnum-1)&31], block[sampnum] };
+	__m128i s = _mm_loadl_epi64((__m128i*)taps);
+	__m128i g = _mm_loadl_epi64((__m128i*)&gauss16[index]);
+	__m128i p = _mm_unpacklo_epi16(_mm_mullo_epi16(s,g),_mm_mulhi_epi16(s,g));
+	p = _mm_and_si128(p,_mm_set1_epi32(~2047));
+	p = _mm_add_epi32(p,_mm_shuffle_epi32(p,_MM_SHUFFLE(1,0,3,2)));
+	p = _mm_add_epi32(p,_mm_shuffle_epi32(p,_MM_SHUFFLE(2,3,0,1)));
+	s32 result = _mm_cvtsi128_si32(p);
+#else
+	s32 result = (gauss[index]*block[(sampnum-3)&31])&~2047;
+	result += (gauss[index+1]*block[(sampnum-2)&31])&~2047;
+	result += (gauss[index+2]*block[(sampnum-1)&31])&~2047;
+	result += (gauss[index+3]*block[sampnum])&~2047;
+#endif
+	return (result>>11)&~1;
+}
+
+template<> FORCEINLINE s32 InterpolateFixed<SPUInterpolation_Cubic>(const s16* block, int sampnum, u32 frac)
+{
+	s64 y0 = block[(sampnum-3)&31], y1 = block[(sampnum-2)&31], y2 = block[(sampnum-1)&31], y3 = block[sampnum];
+	s64 mu = frac;
+	s64 a0 = y3 - y2 - y0 + y1;
+	s64 a1 = y0 - y1 - a0;
+	s64 a2 = y2 - y0;
+	s64 a3 = y1;
+
+	//this is a0*mu^3 + a1*mu^2 + a2*mu + a3 with everything scaled up by 2^36
+	s64 result = ((a0*mu + a1*4096)*mu + a2*(4096*4096))*mu + a3*((s64)1<<36);
+	return (s32)(result/((s64)1<<36));
+}
+
+template<> FORCEINLINE s32 InterpolateFixed<SPUInterpolation_Cosine>(const s16* block, int sampnum, u32 frac)
+{
+	return _Interpolate(block[sampnum],block[(sampnum-1)&31],block[(sampnum-2)&31],block[(sampnum-3)&31],frac/4096.0);
+}
+
+//renders up to length samples of one channel into mixblock.voice and returns how many were produced
+//(fewer if the channel stopped). mixblock.fmod is consumed as the modulation input.
+//when SILENT, the channel's state is advanced exactly the same way but no samples are interpolated or output.
+template<SPUInterpolationMode MODE, bool SILENT> static int renderChannel(SPU_struct* spu, SPU_chan* chan, int length)
+{
+	const s32* fmod = mixblock.fmod;
+	s32* voice = mixblock.voice;
+
+	u32 smpcnt = chan->smpcnt;
+	u32 smpinc = chan->smpinc;
+	const bool bNoise = chan->bNoise!=0;
+	const bool bFMod = chan->bFMod!=0;
+	const s32 rawPitch = chan->rawPitch;
+
+	int j;
+	for(j=0;j<length;j++)
+	{
+		//the envelope may have stopped the channel during the previous sample. this is tested before anything
+		//is fetched, as the reference mixer does, since starting a new block can raise an irq and moves the
+		//block address, and the noise generator is shared
+		if (chan->status == CHANSTATUS_STOPPED)
+			break;
+
+		s32 samp;
+		if(bNoise)
+			samp = iGetNoiseVal(chan);
+		else
+		{
+			chan->smpcnt = smpcnt;
+			if(!chan->fetchBRR(spu))
+				break;
+			smpcnt = chan->smpcnt;
+			if(SILENT) samp = 0;
+			else samp = InterpolateFixed<MODE>(chan->block,smpcnt>>12,smpcnt&0xFFF);
 		}
 
-		//handle spu mute
-		if ((spu->spuCtrl&0x4000)==0) {
-			left_accum = 0;
-			right_accum = 0;
+		//or the block just fetched may have ended it
+		if (chan->status == CHANSTATUS_STOPPED)
+			break;
+
+		s32 adsrLevel = chan->ADSR.lVolume;
+		MixADSR(chan);
+
+		if(bFMod)
+			smpinc = (u16)(((32768+fmod[j])*rawPitch)>>15);
+
+		smpcnt += smpinc;
+		if(!SILENT)
+			voice[j] = samp * adsrLevel/1023;
+	}
+
+	chan->smpcnt = smpcnt;
+	chan->smpinc = smpinc;
+	return j;
+}
+
+//renders a channel with the user's choice of interpolation
+static int renderChannelInterpolated(SPU_struct* spu, SPU_chan* chan, int length)
+{
+	switch((SPUInterpolationMode)iUseInterpolation)
+	{
+	case SPUInterpolation_None: return renderChannel<SPUInterpolation_None,false>(spu,chan,length);
+	case SPUInterpolation_Linear: return renderChannel<SPUInterpolation_Linear,false>(spu,chan,length);
+	case SPUInterpolation_Gaussian: return renderChannel<SPUInterpolation_Gaussian,false>(spu,chan,length);
+	case SPUInterpolation_Cubic: return renderChannel<SPUInterpolation_Cubic,false>(spu,chan,length);
+	case SPUInterpolation_Cosine: return renderChannel<SPUInterpolation_Cosine,false>(spu,chan,length);
+	default: return 0;
+	}
+}
+
+static void mixAudio_block(bool killReverb, SPU_struct* spu, int offset, int length)
+{
+	SPU_mixblock &mb = mixblock;
+
+	memset(mb.left,0,length*sizeof(s32));
+	memset(mb.right,0,length*sizeof(s32));
+	memset(mb.rvbLeft,0,length*sizeof(s32));
+	memset(mb.rvbRight,0,length*sizeof(s32));
+	//there is no channel before the first one, so it has nothing to modulate it
+	memset(mb.fmod,0,length*sizeof(s32));
+
+	for(int i=0;i<24;i++)
+	{
+		SPU_chan *chan = &spu->channels[i];
+
+		int produced = 0;
+		if(chan->status != CHANSTATUS_STOPPED)
+			produced = renderChannelInterpolated(spu,chan,length);
+
+		//apply the volumes. these loops have no dependencies between samples so the compiler can vectorize them
+		const s32 lvol = chan->iLeftVolume, rvol = chan->iRightVolume;
+		const s32* voice = mb.voice;
+		s32* left = mb.left;
+		s32* right = mb.right;
+		if(!killReverb && chan->bRVBActive)
+		{
+			s32* rvbLeft = mb.rvbLeft;
+			s32* rvbRight = mb.rvbRight;
+			for(int j=0;j<produced;j++)
+			{
+				s32 l = (voice[j] * lvol) / 0x4000;
+				s32 r = (voice[j] * rvol) / 0x4000;
+				left[j] += l; right[j] += r;
+				rvbLeft[j] += l; rvbRight[j] += r;
+			}
 		}
+		else
+		{
+			for(int j=0;j<produced;j++)
+			{
+				left[j] += (voice[j] * lvol) / 0x4000;
+				right[j] += (voice[j] * rvol) / 0x4000;
+			}
+		}
+
+		//this channel's output is the modulation input for the next channel
+		memcpy(mb.fmod,voice,produced*sizeof(s32));
+		memset(mb.fmod+produced,0,(length-produced)*sizeof(s32));
+	}
+
+	if(!killReverb)
+		spu->MixREVERBBlock(mb.rvbLeft,mb.rvbRight,mb.left,mb.right,length);
+	else spu->REVERB_initSample();
+
+	for(int j=0;j<length;j++)
+		mixOutputSample(spu,offset+j,mb.left[j],mb.right[j]);
+}
+
+//advances the spu by length samples without producing any sound, for when the output would be discarded anyway.
+//envelopes, block decoding, loop and end flags, irqs and the xa queue all move on exactly as they do in mixAudio_block
+//with killReverb, but nothing is interpolated or mixed. only a channel which modulates the next one's pitch
+//needs its samples rendered.
+static void stepAudio_block(SPU_struct* spu, int length)
+{
+	SPU_mixblock &mb = mixblock;
 
-		s16 output[] = { limit(left_accum), limit(right_accum) };
-
-		if(iSoundMode == SOUND_MODE_SYNCH)
-			synchronizer->enqueue_samples(output,1);
-
-		spu->outbuf[j*2] = output[0];
-		spu->outbuf[j*2+1] = output[1];
-
-		//fwrite(&left_out,2,1,wavout);
-		//fwrite(&right_out,2,1,wavout);
-		//fflush(wavout);
-
-		// special irq handling in the decode buffers (0x0000-0x1000)
-		// we know:
-		// the decode buffers are located in spu memory in the following way:
-		// 0x0000-0x03ff  CD audio left
-		// 0x0400-0x07ff  CD audio right
-		// 0x0800-0x0bff  Voice 1
-		// 0x0c00-0x0fff  Voice 3
-		// and decoded data is 16 bit for one sample
-		// we assume:
-		// even if voices 1/3 are off or no cd audio is playing, the internal
-		// play positions will move on and wrap after 0x400 bytes.
-		// Therefore: we just need a pointer from spumem+0 to spumem+3ff, and
-		// increase this pointer on each sample by 2 bytes. If this pointer
-		// (or 0x400 offsets of this pointer) hits the spuirq address, we generate
-		// an IRQ. 
-
-		if(spu->isCore)
+	memset(mb.fmod,0,length*sizeof(s32));
+
+	for(int i=0;i<24;i++)
+	{
+		SPU_chan *chan = &spu->channels[i];
+		const bool modulates = i<23 && spu->channels[i+1].bFMod;
+
+		int produced = 0;
+		if(chan->status != CHANSTATUS_STOPPED)
 		{
-			spu->triggerIrqRange(spu->mixIrqCounter,2);
-			spu->triggerIrqRange(spu->mixIrqCounter+0x400,2);
-			spu->triggerIrqRange(spu->mixIrqCounter+0x800,2);
-			spu->triggerIrqRange(spu->mixIrqCounter+0xC00,2);
+			if(modulates) produced = renderChannelInterpolated(spu,chan,length);
+			else produced = renderChannel<SPUInterpolation_None,true>(spu,chan,length);
+		}
 
-			spu->mixIrqCounter += 2;
-			spu->mixIrqCounter &= 0x3FF;
+		if(modulates)
+		{
+			memcpy(mb.fmod,mb.voice,produced*sizeof(s32));
+			memset(mb.fmod+produced,0,(length-produced)*sizeof(s32));
 		}
+	}
 
-	} //sample loop
+	spu->REVERB_initSample();
+
+	for(int j=0;j<length;j++)
+	{
+		spu->xaqueue.advance();
+		tickDecodeBufferIrqs(spu);
+	}
+}
 
-	//this prints which channels are active
-	//for(int i=0;i<24;i++) {
-	//	if(i==16) printf(" ");
-	//	if(checklog[i]) printf("%1x",i&15);
-	//	else printf(" ");
-	//}
-	//printf("\n");
+//the noise generator is shared, so channels using it can only be rendered one at a time if there is just one of them
+static bool canRenderByChannel(SPU_struct* spu)
+{
+	int noiseChannels = 0;
+	for(int i=0;i<24;i++)
+		if(spu->channels[i].status != CHANSTATUS_STOPPED && spu->channels[i].bNoise)
+			noiseChannels++;
+	return noiseChannels<=1;
+}
+
+void stepAudio(SPU_struct* spu, int length)
+{
+	if(!canRenderByChannel(spu))
+		mixAudio_reference(true,spu,length);
+	else
+	{
+		for(int done=0;done<length;done+=MIXBLOCK_SIZE)
+			stepAudio_block(spu,std::min(length-done,MIXBLOCK_SIZE));
+	}
+}
+
+void mixAudio(bool killReverb, SPU_struct* spu, int length)
+{
+	memset(spu->outbuf, 0, length*4*2);
+
+	if(!canRenderByChannel(spu))
+		mixAudio_reference(killReverb,spu,length);
+	else
+	{
+		for(int done=0;done<length;done+=MIXBLOCK_SIZE)
+			mixAudio_block(killReverb,spu,done,std::min(length-done,MIXBLOCK_SIZE));
+	}
 
 	if (spu == SPU_core) 
 		RecordBuffer(&spu->outbuf[0], length*4);
 }
 
+//makes a private copy of the core spu to run tests on. it can't raise irqs.
+static SPU_struct* cloneCoreForTest()
+{
+	SPU_struct* spu = new SPU_struct(false);
+	*spu = *SPU_core;
+	spu->isCore = false;
+	for(int i=0;i<24;i++)
+		spu->channels[i].spu = spu;
+	return spu;
+}
+
+//keys on channel 0 of a test copy at unit pitch and releases it so that its envelope ends on the last sample of
+//its first block. a mixer which doesn't test for the stop before fetching would go on to start the next block.
+static void endEnvelopeAtBlockEnd(SPU_struct* spu)
+{
+	SPU_chan* chan = &spu->channels[0];
+	chan->rawPitch = 0x1000;
+	chan->pending = 0;
+	chan->keyon();
+	chan->bFMod = 0;
+
+	//the release is linear, so one tick tells how much each one takes off
+	chan->status = CHANSTATUS_KEYOFF;
+	chan->ADSR.ReleaseModeExp = 0;
+	chan->ADSR.ReleaseRate = 0x50;
+	SPU_chan probe = *chan;
+	probe.ADSR.EnvelopeVol = 0x40000000;
+	MixADSR(&probe);
+	s32 step = 0x40000000 - probe.ADSR.EnvelopeVol;
+	chan->ADSR.EnvelopeVol = step*27 + step/2;
+}
+
+//whether two copies of the spu have the same channel, noise and xa state
+static bool sameState(SPU_struct* a, SPU_struct* b)
+{
+	bool same = a->dwNoiseVal == b->dwNoiseVal
+		&& a->xaqueue.size() == b->xaqueue.size();
+	for(int i=0;i<24;i++)
+	{
+		const SPU_chan &x = a->channels[i], &y = b->channels[i];
+		same = same && x.status == y.status && x.smpcnt == y.smpcnt && x.smpinc == y.smpinc
+			&& x.blockAddress == y.blockAddress && x.loopStartAddr == y.loopStartAddr && x.flags == y.flags
+			&& x.s_1 == y.s_1 && x.s_2 == y.s_2 && x.iOldNoise == y.iOldNoise
+			&& x.ADSR.State == y.ADSR.State && x.ADSR.EnvelopeVol == y.ADSR.EnvelopeVol && x.ADSR.lVolume == y.ADSR.lVolume;
+	}
+	return same;
+}
+
+//runs both mixers over the same copy of the core spu state and reports the largest difference between their outputs.
+//they are also run over a copy with a channel whose envelope ends at the end of a block, which must leave them in the
+//same state; -1 is returned if it doesn't.
+//this is for testing the block mixer; nothing is output and the core spu is left untouched.
+s32 SPUbenchmarkMixer(int samples, double* referenceSeconds, double* blockSeconds)
+{
+	Lock lock;
+
+	if(samples > (int)(ARRAY_SIZE(SPU_core->outbuf)/2))
+		samples = ARRAY_SIZE(SPU_core->outbuf)/2;
+
+	SPU_struct* spuRef = cloneCoreForTest();
+	SPU_struct* spuBlock = cloneCoreForTest();
+
+	LARGE_INTEGER freq, t0, t1, t2;
+	QueryPerformanceFrequency(&freq);
+
+	QueryPerformanceCounter(&t0);
+	mixAudio_reference(false,spuRef,samples);
+	QueryPerformanceCounter(&t1);
+	for(int done=0;done<samples;done+=MIXBLOCK_SIZE)
+		mixAudio_block(false,spuBlock,done,std::min(samples-done,MIXBLOCK_SIZE));
+	QueryPerformanceCounter(&t2);
+
+	s32 maxDiff = 0;
+	for(int i=0;i<samples*2;i++)
+		maxDiff = std::max(maxDiff,(s32)abs(spuRef->outbuf[i]-spuBlock->outbuf[i]));
+
+	*referenceSeconds = (double)(t1.QuadPart-t0.QuadPart)/freq.QuadPart;
+	*blockSeconds = (double)(t2.QuadPart-t1.QuadPart)/freq.QuadPart;
+
+	delete spuRef;
+	delete spuBlock;
+
+	spuRef = cloneCoreForTest();
+	spuBlock = cloneCoreForTest();
+	endEnvelopeAtBlockEnd(spuRef);
+	endEnvelopeAtBlockEnd(spuBlock);
+	mixAudio_reference(false,spuRef,64);
+	mixAudio_block(false,spuBlock,0,64);
+	for(int i=0;i<64*2;i++)
+		maxDiff = std::max(maxDiff,(s32)abs(spuRef->outbuf[i]-spuBlock->outbuf[i]));
+	if(!sameState(spuRef,spuBlock))
+		maxDiff = -1;
+
+	delete spuRef;
+	delete spuBlock;
+
+	return maxDiff;
+}
+
+//advances one copy of the core spu state with stepAudio and another with mixAudio (as the core is mixed in dual mode),
+//and checks that they end up in the same state. the same is done for copies with a channel whose envelope ends at the
+//end of a block, since the silent stepping mustn't fetch past the stop either.
+bool SPUverifyStep(int samples)
+{
+	Lock lock;
+
+	if(samples > (int)(ARRAY_SIZE(SPU_core->outbuf)/2))
+		samples = ARRAY_SIZE(SPU_core->outbuf)/2;
+
+	SPU_struct* spuMix = cloneCoreForTest();
+	SPU_struct* spuStep = cloneCoreForTest();
+
+	mixAudio(true,spuMix,samples);
+	stepAudio(spuStep,samples);
+
+	bool same = sameState(spuMix,spuStep);
+
+	delete spuMix;
+	delete spuStep;
+
+	spuMix = cloneCoreForTest();
+	spuStep = cloneCoreForTest();
+	endEnvelopeAtBlockEnd(spuMix);
+	endEnvelopeAtBlockEnd(spuStep);
+	mixAudio(true,spuMix,64);
+	stepAudio(spuStep,64);
+	same = same && sameState(spuMix,spuStep);
+
+	delete spuMix;
+	delete spuStep;
+
+	return same;
+}
+
 u16 SPU_struct::SPUreadDMA(void)
 {
 	//printf("SPU single read dma %08X\n",spuAddr);
 
-	u16 s=SPU_core->spuMem[spuAddr>>1];
+	u16 s=SPU_core->spuMem.read16(spuAddr);
 
 	//triggerIrqRange(spuAddr,2);
 
@@ -679,7 +1131,7 @@ void SPU_struct::SPUreadDMAMem(u16 * pusPSXMem,int iSize)
 
 	for (int i=0;i<iSize;i++)
 	{
-		*pusPSXMem++=spuMem[spuAddr>>1];                    // spu addr got by writeregister
+		*pusPSXMem++=spuMem.read16(spuAddr);                // spu addr got by writeregister
 		//triggerIrqRange(spuAddr,2);
 		spuAddr+=2;                                         // inc spu addr
 		if (spuAddr>0x7ffff) spuAddr=0;                     // wrap
@@ -690,40 +1142,67 @@ void SPU_struct::SPUreadDMAMem(u16 * pusPSXMem,int iSize)
 // irqs? Will an irq be triggered, if new data is written to
 // the memory irq address?
 
-void SPU_struct::SPUwriteDMA(u16 val)
+//if a mirror spu is given, it gets the same writes, and its transfer address follows this one's
+void SPU_struct::SPUwriteDMA(u16 val, SPU_struct* mirror)
 {
 	//printf("SPU single write dma %08X\n",spuAddr);
 
-	spuMem[spuAddr>>1] = val;                             // spu addr got by writeregister
+	if(mirror) writeSpuMem(mirror,spuAddr,val);
+	else writeSpuMem(spuAddr,val);                        // spu addr got by writeregister
 	//triggerIrqRange(spuAddr,2);
 
 	spuAddr+=2;                                           // inc spu addr
 	if (spuAddr>0x7ffff) spuAddr=0;                       // wrap
+
+	if(mirror) mirror->spuAddr = spuAddr;
 }
 
 
-void SPU_struct::SPUwriteDMAMem(u16 * pusPSXMem,int iSize)
+void SPU_struct::SPUwriteDMAMem(u16 * pusPSXMem,int iSize, SPU_struct* mirror)
 {
 	//printf("SPU multi write dma %08X %d\n",spuAddr, iSize);
 
 	for (int i=0;i<iSize;i++)
 	{
-		spuMem[spuAddr>>1] = *pusPSXMem++;                  // spu addr got by writeregister
+		if(mirror) writeSpuMem(mirror,spuAddr,*pusPSXMem++);
+		else writeSpuMem(spuAddr,*pusPSXMem++);             // spu addr got by writeregister
 		//triggerIrqRange(spuAddr,2);
 		spuAddr+=2;                                         // inc spu addr
 		if (spuAddr>0x7ffff) spuAddr=0;                     // wrap
 	}
+
+	if(mirror) mirror->spuAddr = spuAddr;
 }
 
-u16 SPUreadDMA() { return SPU_core->SPUreadDMA(); }
-void SPUreadDMAMem(u16 * pusPSXMem,int iSize) { SPU_core->SPUreadDMAMem(pusPSXMem,iSize); }
+//the user spu follows the core's transfer address, so that subsequent writes will be in the right place
+u16 SPUreadDMA() {
+	u16 s = SPU_core->SPUreadDMA();
+	if(SPU_user) SPU_user->spuAddr = SPU_core->spuAddr;
+	return s;
+}
+void SPUreadDMAMem(u16 * pusPSXMem,int iSize) {
+	SPU_core->SPUreadDMAMem(pusPSXMem,iSize);
+	if(SPU_user) SPU_user->spuAddr = SPU_core->spuAddr;
+}
+//writes go to the core and user spus together, which keeps the ram pages they share from being copied.
+//they're made under the lock, since the sound thread changes the user spu's page table too (when the reverb writes its buffer)
 void SPUwriteDMA(u16 val) {
-	SPU_core->SPUwriteDMA(val);
-	if(SPU_user) SPU_user->SPUwriteDMA(val);
+	Lock lock;
+	if(SPU_user && SPU_user->spuAddr == SPU_core->spuAddr)
+		SPU_core->SPUwriteDMA(val,SPU_user);
+	else {
+		SPU_core->SPUwriteDMA(val);
+		if(SPU_user) SPU_user->SPUwriteDMA(val);
+	}
 }
 void SPUwriteDMAMem(u16 * pusPSXMem,int iSize) { 
-	SPU_core->SPUwriteDMAMem(pusPSXMem,iSize);
-	if(SPU_user) SPU_user->SPUwriteDMAMem(pusPSXMem,iSize);
+	Lock lock;
+	if(SPU_user && SPU_user->spuAddr == SPU_core->spuAddr)
+		SPU_core->SPUwriteDMAMem(pusPSXMem,iSize,SPU_user);
+	else {
+		SPU_core->SPUwriteDMAMem(pusPSXMem,iSize);
+		if(SPU_user) SPU_user->SPUwriteDMAMem(pusPSXMem,iSize);
+	}
 }
 
 //measured 16123034 cycles per second
@@ -757,6 +1236,7 @@ void SNDDXUpdateAudio(s16 *buffer, u32 num_samples);
 void SPUasync(unsigned long cycle)
 {
 	Lock lock;
+	PROFILE_SCOPE(PROF_SPU);
 
 	SPU_core->mixtime += samples_per_cycle*cycle*2;
 	int mixtodo = (int)SPU_core->mixtime;
@@ -769,9 +1249,12 @@ void SPUasync(unsigned long cycle)
 	case SOUND_MODE_ASYNCH:
 		break;
 	case SOUND_MODE_DUAL:
-		//produce the logically correct amount of sound, just for emulation's sake (output will be discarded)
-		//TODO (as an optimization, the output could actually be non-mixed. i think this may be done in desmume)
-		mixAudio(true,SPU_core,mixtodo);
+		//advance the core by the logically correct amount of sound, just for emulation's sake.
+		//the user spu makes what we hear, so the core doesn't need to mix anything unless we are recording it
+		if(iDoRecord)
+			mixAudio(true,SPU_core,mixtodo);
+		else
+			stepAudio(SPU_core,mixtodo);
 		break;
 	case SOUND_MODE_SYNCH:
 		//printf("mixing %d cycles (%d samples) (adjustobuf size:%d)\n",cycle,mixtodo,adjustobuf.size);
@@ -830,6 +1313,27 @@ void REVERBInfo::load(EMUFILE* fp) {
 // XA AUDIO
 ////////////////////////////////////////////////////////////////////////
 
+//this is called from the cdrom system with a sector of cd audio (44100hz 16 bit stereo).
+//it goes through the xa queue, since the drive can't play both at once and the cd volume applies to both.
+//(so the cd volume is handled here, rather than through cddavCallback)
+void SPUplayCDDAchannel(short *pcm, int nbytes)
+{
+	if (!pcm) return;
+
+	Lock lock;
+	SPU_core->xaqueue.feed(pcm,nbytes/4,44100);
+
+	switch(iSoundMode)
+	{
+	case SOUND_MODE_ASYNCH:
+	case SOUND_MODE_DUAL:
+		SPU_user->xaqueue.feed(pcm,nbytes/4,44100);
+		break;
+	case SOUND_MODE_SYNCH:
+		break;
+	}
+}
+
 //this is called from the cdrom system with a buffer of decoded xa audio
 //we are supposed to grab it and then play it. 
 void SPUplayADPCMchannel(xa_decode_t *xap)
@@ -859,12 +1363,16 @@ long SPUinit(void)
 	SPU_core = new SPU_struct(true);
 	SPU_user = new SPU_struct(false);
 	StaticInitADSR();
+	StaticInitMixer();
 	SPUReset();
 	return 0;
 }
 
+//the config dialog calls this from the ui thread, while the sound thread may be using the synchronizer and the user spu
 void SPUReset()
 {
+	Lock lock;
+
 	ESynchMethod method;
 	switch(iSynchMethod)
 	{
@@ -881,8 +1389,12 @@ void SPUReset()
 	SPUcloneUser();
 }
 
+//this is cheap: the user spu shares the core's ram pages until one of them writes to a page.
+//the copy releases the user spu's pages, so it's made under the lock, which the sound thread mixes under
 void SPUcloneUser()
 {
+	Lock lock;
+
 	*SPU_user = *SPU_core;
 	SPU_user->isCore = false;
 	for(int i=0;i<24;i++)
@@ -902,7 +1414,7 @@ bool SPUunfreeze_new(EMUFILE* fp)
 	u32 version = fp->read32le();
 	//if(version<3) return false;
 
-	fp->fread(SPU_core->spuMem,0x80000);
+	SPU_core->spuMem.load(fp);
 	fp->fread(regArea,0x200);
 
 	fp->readdouble(&SPU_core->mixtime);
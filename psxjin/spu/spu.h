@@ -31,6 +31,8 @@
 #include "Decode_XA.h"
 #include "emufile.h"
 #include "xa.h"
+#include "brrcache.h"
+#include "spuram.h"
 
 #define NSSIZE 1
 
@@ -143,6 +145,14 @@ struct _ADSRInfo
 
 class SPU_struct;
 
+//the mixed output belongs to the spu which mixed it, so it isn't copied along with the rest of the state
+struct SPU_outbuf
+{
+	s16 samples[100000];
+	SPU_outbuf& operator=(const SPU_outbuf&) { return *this; }
+	operator s16*() { return samples; }
+};
+
 class SPU_chan
 {
 public:
@@ -176,8 +186,10 @@ public:
 	_ADSRInfo ADSR;
 
 	//runtime information never really exposed to cpu
-	double smpinc; //sample frequency stepper value i.e. 2.000 equals octave+1
-	double smpcnt; //current sample counter within the current block, kept under 28
+	//the sample counters are 20.12 fixed point, which is the precision of the pitch register.
+	//(savestates still store them as doubles, which represent these values exactly)
+	u32 smpinc; //sample frequency stepper value i.e. 0x2000 equals octave+1
+	u32 smpcnt; //current sample counter within the current block, kept under 28<<12
 	s32 blockAddress; //the current 16B encoded block address
 
 	//are these features enabled for this channel?
@@ -204,6 +216,7 @@ public:
 	s16 block[32];
 	s32 s_1,s_2;
 	u8 flags;
+	bool fetchBRR(SPU_struct* spu);
 	s32 decodeBRR(SPU_struct* spu);
 
 };
@@ -217,7 +230,7 @@ public:
 	void triggerIrqRange(u32 base, u32 size);
 
 	SPU_chan channels[24];
-	s16 outbuf[100000];
+	SPU_outbuf outbuf;
 	void writeRegister(u32 r, u16 val);
 	bool isCore;
 	double mixtime;
@@ -231,8 +244,19 @@ public:
 	u16 spuStat;
 	u16 spuIrq;
 	u32 mixIrqCounter;
-	u16 spuMem[256*1024];
-	inline u8 readSpuMem(u32 addr) { return ((u8*)spuMem)[addr]; }
+	SPU_ram spuMem;
+	inline u8 readSpuMem(u32 addr) { return spuMem.read8(addr); }
+	//all writes to spu ram should go through here so that the decoded block cache stays coherent
+	inline void writeSpuMem(u32 addr, u16 val) { spuMem.write16(addr,val); brrCache.invalidate(addr); }
+	//writes the same value to this spu and to another one following it (the user spu), so that the ram pages they share stay shared
+	inline void writeSpuMem(SPU_struct* mirror, u32 addr, u16 val)
+	{
+		SPU_ram::write16(spuMem,mirror->spuMem,addr,val);
+		brrCache.invalidate(addr);
+		mirror->brrCache.invalidate(addr);
+	}
+
+	BRRCache brrCache;
 
 	xa_queue xaqueue;
 
@@ -243,16 +267,21 @@ public:
 	void StoreREVERB(SPU_chan* pChannel,s32 left, s32 right);
 	int MixREVERBLeft();
 	int MixREVERBRight();
-	int g_buffer(int iOff);
-	void s_buffer(int iOff,int iVal);
-	void s_buffer1(int iOff,int iVal);
+	void MixREVERBBlock(const s32* inLeft, const s32* inRight, s32* left, s32* right, int length);
+	bool REVERB_canSkipWraps(int ticks);
+	template<bool WRAP> int REVERB_mixLeft();
+	template<bool WRAP> void REVERB_mixBlock(const s32* inLeft, const s32* inRight, s32* left, s32* right, int length);
+	template<bool WRAP> int rvbIndex(int iOff);
+	template<bool WRAP> int g_buffer(int iOff);
+	template<bool WRAP> void s_buffer(int iOff,int iVal);
+	template<bool WRAP> void s_buffer1(int iOff,int iVal);
 	//------
 
 	//--dma--
 	u16 SPUreadDMA(void);
 	void SPUreadDMAMem(u16 * pusPSXMem,int iSize);
-	void SPUwriteDMA(u16 val);
-	void SPUwriteDMAMem(u16 * pusPSXMem,int iSize);
+	void SPUwriteDMA(u16 val, SPU_struct* mirror = NULL);
+	void SPUwriteDMAMem(u16 * pusPSXMem,int iSize, SPU_struct* mirror = NULL);
 	//
 };
 
@@ -268,6 +297,9 @@ void SPUfreeze_new(EMUFILE* fp);
 bool SPUunfreeze_new(EMUFILE* fp);
 void SPUcloneUser();
 
+s32 SPUbenchmarkMixer(int samples, double* referenceSeconds, double* blockSeconds);
+bool SPUverifyStep(int samples);
+
 void SPUmute();
 void SPUunMute();
 void SPUReset();
@@ -0,0 +1,120 @@
+//spuram.cpp
+
+//This program is free software; you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation; either version 2 of the License, or
+//(at your option) any later version. See also the license.txt file for
+//additional informations.                                              
+
+#include "stdafx.h"
+#include "PsxCommon.h"
+#include "emufile.h"
+#include "spuram.h"
+
+//the core and user spus run on different threads, so the reference counts are changed with interlocked operations.
+//a page is only ever freed by whichever spu drops the last reference to it.
+
+SPU_ram::SPU_ram()
+{
+	for(int i=0;i<PAGES;i++)
+		pages[i] = NULL;
+	reset();
+}
+
+SPU_ram::SPU_ram(const SPU_ram& other)
+{
+	for(int i=0;i<PAGES;i++)
+	{
+		pages[i] = other.pages[i];
+		InterlockedIncrement(&pages[i]->refs);
+	}
+}
+
+SPU_ram::~SPU_ram()
+{
+	for(int i=0;i<PAGES;i++)
+		release(pages[i]);
+}
+
+SPU_ram& SPU_ram::operator=(const SPU_ram& other)
+{
+	for(int i=0;i<PAGES;i++)
+	{
+		Page* old = pages[i];
+		pages[i] = other.pages[i];
+		InterlockedIncrement(&pages[i]->refs);
+		release(old);
+	}
+	return *this;
+}
+
+void SPU_ram::reset()
+{
+	//every page starts out as the same page of zeroes
+	Page* zero = new Page;
+	memset(zero->data,0,sizeof(zero->data));
+	zero->refs = PAGES;
+	for(int i=0;i<PAGES;i++)
+	{
+		release(pages[i]);
+		pages[i] = zero;
+	}
+}
+
+void SPU_ram::release(Page* page)
+{
+	if(page && InterlockedDecrement(&page->refs) == 0)
+		delete page;
+}
+
+void SPU_ram::unshare(int page)
+{
+	Page* old = pages[page];
+	Page* copy = new Page;
+	memcpy(copy->data,old->data,sizeof(copy->data));
+	copy->refs = 1;
+	pages[page] = copy;
+	release(old);
+}
+
+void SPU_ram::write16(SPU_ram& a, SPU_ram& b, u32 addr, u16 val)
+{
+	const int page = addr>>PAGE_SHIFT;
+	if(a.pages[page] == b.pages[page])
+	{
+		//if anything else is sharing the page too, these two need a copy of their own first
+		if(a.pages[page]->refs != 2)
+		{
+			a.unshare(page);
+			b.release(b.pages[page]);
+			b.pages[page] = a.pages[page];
+			InterlockedIncrement(&b.pages[page]->refs);
+		}
+		a.pages[page]->data[(addr&(PAGE_SIZE-1))>>1] = val;
+	}
+	else
+	{
+		a.write16(addr,val);
+		b.write16(addr,val);
+	}
+}
+
+void SPU_ram::save(EMUFILE* fp) const
+{
+	for(int i=0;i<PAGES;i++)
+		fp->fwrite(pages[i]->data,PAGE_SIZE);
+}
+
+void SPU_ram::load(EMUFILE* fp)
+{
+	for(int i=0;i<PAGES;i++)
+	{
+		if(pages[i]->refs != 1)
+		{
+			release(pages[i]);
+			pages[i] = new Page;
+			pages[i]->refs = 1;
+		}
+		fp->fread(pages[i]->data,PAGE_SIZE);
+	}
+}
@@ -0,0 +1,66 @@
+//spuram.h
+
+//This program is free software; you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation; either version 2 of the License, or
+//(at your option) any later version. See also the license.txt file for
+//additional informations.                                              
+
+#ifndef _SPURAM_H_
+#define _SPURAM_H_
+
+#include "PsxCommon.h"
+
+class EMUFILE;
+
+//the 512KB of spu ram, split into pages which are shared copy-on-write between spus.
+//the user spu is a copy of the core spu, and apart from the reverb work area of whichever one is running the reverb,
+//their ram stays identical. so copying an spu only shares its pages, and a page is copied the first time
+//one of the spus sharing it writes to it.
+class SPU_ram
+{
+public:
+	static const int SIZE = 0x80000;
+	static const int PAGE_SHIFT = 12;
+	static const int PAGE_SIZE = 1<<PAGE_SHIFT;
+	static const int PAGES = SIZE>>PAGE_SHIFT;
+
+	SPU_ram();
+	SPU_ram(const SPU_ram& other);
+	~SPU_ram();
+	SPU_ram& operator=(const SPU_ram& other);
+
+	//sets all of the ram to zero
+	void reset();
+
+	u8 read8(u32 addr) const { return ((u8*)pages[addr>>PAGE_SHIFT]->data)[addr&(PAGE_SIZE-1)]; }
+	u16 read16(u32 addr) const { return pages[addr>>PAGE_SHIFT]->data[(addr&(PAGE_SIZE-1))>>1]; }
+
+	void write16(u32 addr, u16 val)
+	{
+		Page* &page = pages[addr>>PAGE_SHIFT];
+		if(page->refs != 1) unshare(addr>>PAGE_SHIFT);
+		page->data[(addr&(PAGE_SIZE-1))>>1] = val;
+	}
+
+	//writes the same value to two spus' ram. if they are sharing the page, it only needs writing once.
+	static void write16(SPU_ram& a, SPU_ram& b, u32 addr, u16 val);
+
+	void save(EMUFILE* fp) const;
+	void load(EMUFILE* fp);
+
+private:
+	struct Page
+	{
+		volatile LONG refs;
+		u16 data[PAGE_SIZE/2];
+	};
+
+	//gives this ram its own copy of a page
+	void unshare(int page);
+	static void release(Page* page);
+
+	Page* pages[PAGES];
+};
+
+#endif //_SPURAM_H_
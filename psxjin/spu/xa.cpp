@@ -12,68 +12,123 @@
 #include "stdafx.h"
 #include "PsxCommon.h"
 
-#include <deque>
+#include <algorithm>
 #include "spu.h"
 
 s32 _Interpolate(s16 a, s16 b, s16 c, s16 d, double _ratio);
 
-//this code is really naive. it's probably all wrong, i'm not good at this kind of stuff.
-//really ought to make a circular buffer.
-//alternatively we could keep these in the blocks they originally came in
-//instead of splitting them all into samples.
-//the timing logic is terribly slow.
-//going for a simple reference implementation here.
-//but it is a little strange because the blocks can be different samplerates.
-//another reason for implementing it this way is so that the xa_queue can represent some kind of reliable hardware state
-//and the spu can fetch samples from it at whatever rate it needs to (whatever rate, one day, the user has specified)
+//the queue keeps the audio in the blocks it came in (one per xa sector or sector of cd audio),
+//in a fixed ring, so that nothing is allocated once the ring has gone round.
+//each block has its own samplerate, since the blocks can be different samplerates.
+//the queue represents some kind of reliable hardware state, and the spu fetches samples from it
+//at whatever rate it needs to (whatever rate, one day, the user has specified)
 //instead of resampling everything as soon as it is received.
 //
 //there may be something wrong with the interpolation, but it is hard to tell, since I think there is also
 //something wrong with the xa adpcm decoding.
 xa_queue::xa_queue()
-	: counter(0)
+	: head(0)
+	, nblocks(0)
+	, ndropped(0)
+	, phase(0)
 	, lastFrac(0)
 {
+	memset(blocks,0,sizeof(blocks));
 	//we need to be bootstrapped with something
-	xa_sample blank;
-	blank.left = blank.right = 0;
-	blank.freq = 44100;
 	for(int i=0;i<4;i++)
-		curr.push_back(blank);
+	{
+		curr[i].left = curr[i].right = 0;
+		curr[i].freq = 44100;
+	}
 }
 
-void xa_queue::enqueue(xa_decode_t* xap)
+xa_queue::xa_queue(const xa_queue& other)
+{
+	memset(blocks,0,sizeof(blocks));
+	copy(other);
+}
+
+xa_queue& xa_queue::operator=(const xa_queue& other)
 {
-	xa_sample blank;
-	blank.left = blank.right = 0;
-	blank.freq = xap->freq;
+	if(this != &other)
+		copy(other);
+	return *this;
+}
+
+xa_queue::~xa_queue()
+{
+	for(int i=0;i<BLOCKS;i++)
+		delete blocks[i];
+}
+
+//the blocks already allocated here are reused; the ones past the other queue's live blocks are left as they are
+void xa_queue::copy(const xa_queue& other)
+{
+	head = other.head;
+	nblocks = other.nblocks;
+	ndropped = other.ndropped;
+	phase = other.phase;
+	lastFrac = other.lastFrac;
+	for(int i=0;i<4;i++)
+		curr[i] = other.curr[i];
+
+	for(int i=0;i<nblocks;i++)
+	{
+		int b = (head+i)%BLOCKS;
+		const xa_block& block = *other.blocks[b];
+		if(!blocks[b]) blocks[b] = new xa_block;
+		blocks[b]->freq = block.freq;
+		blocks[b]->step = block.step;
+		blocks[b]->count = block.count;
+		blocks[b]->pos = block.pos;
+		memcpy(blocks[b]->samples,block.samples,block.count*2*sizeof(s16));
+	}
+}
+
+xa_block* xa_queue::push_block(s32 freq)
+{
+	if(nblocks == BLOCKS)
+	{
+		//nobody is playing what we're given. drop the oldest rather than grow without bound
+		if(ndropped++ == 0)
+			printf("xa queue full; dropping the oldest audio\n");
+		head = (head+1)%BLOCKS;
+		nblocks--;
+	}
+	int b = (head+nblocks)%BLOCKS;
+	if(!blocks[b]) blocks[b] = new xa_block;
+	xa_block* block = blocks[b];
+	nblocks++;
+	block->freq = freq;
+	block->step = (u32)(((u64)freq<<PHASE_SHIFT)/44100);
+	block->count = 0;
+	block->pos = 0;
+	return block;
+}
 
-	//if this is the first sample in your queue, clear our time tracking data
-	//if(size()==0)
-	//{
-	//	lastFrac = 0;
-	//	counter = 0;
-	//}
+void xa_queue::enqueue(xa_decode_t* xap)
+{
+	xa_block* block = push_block(xap->freq);
+	int n = std::min<int>(xap->nsamples,(int)xa_block::MAXSAMPLES);
 
 	if(xap->stereo)
-		for(int i=0;i<xap->nsamples;i++)
-		{
-			xa_sample temp;
-			temp.freq = xap->freq;
-			temp.left = xap->pcm[i*2];
-			temp.right = xap->pcm[i*2+1];
-			push_back(temp);
-		}
+		memcpy(block->samples,xap->pcm,n*2*sizeof(s16));
 	else
-		for(int i=0;i<xap->nsamples;i++)
-		{
-			xa_sample temp;
-			temp.freq = xap->freq;
-			temp.left = temp.right = xap->pcm[i];
-			push_back(temp);
-		}
+		for(int i=0;i<n;i++)
+			block->samples[i*2] = block->samples[i*2+1] = xap->pcm[i];
+	block->count = n;
 }
 
+size_t xa_queue::size() const
+{
+	size_t total = 0;
+	for(int i=0;i<nblocks;i++)
+	{
+		const xa_block& block = *blocks[(head+i)%BLOCKS];
+		total += block.count - block.pos;
+	}
+	return total;
+}
 
 void xa_queue::fetch(s16* fourStereoSamples)
 {
@@ -86,42 +141,58 @@ void xa_queue::fetch(s16* fourStereoSamples)
 
 void xa_queue::advance()
 {
-	if(size()==0) return;
-	counter += 1.0/44100;
+	if(nblocks==0) return;
+	//the phase counts in fractions of a sample of the block being played
+	phase += blocks[head]->step;
 	for(;;)
 	{
-		if(size()==0) {
-			//printf("empty with counter=%f\n",counter);
-			//if we have a counter >= 1 then we may be having timer problems
+		if(nblocks==0) {
+			//if we have a phase of a second or more then we may be having timer problems
 			//and our XA queue is underrunning.
-			if(counter>=1) printf("empty with counter=%f\n",counter);
-			//counter < 1 is OK as it is just a little phase error between SPU and XA
+			if(phase>=((u32)curr[3].freq<<PHASE_SHIFT)) printf("empty with phase=%u\n",phase);
+			//anything less is OK as it is just a little phase error between SPU and XA
 			return;
 		}
-		double target = 1.0/front().freq;
-		if(counter>=target)
+		if(phase<PHASE_ONE) break;
+
+		xa_block& block = *blocks[head];
+		curr[0] = curr[1];
+		curr[1] = curr[2];
+		curr[2] = curr[3];
+		curr[3].left = block.samples[block.pos*2];
+		curr[3].right = block.samples[block.pos*2+1];
+		curr[3].freq = block.freq;
+		phase -= PHASE_ONE;
+		if(++block.pos == block.count)
 		{
-			curr.pop_front();
-			curr.push_back(front());
-			pop_front();
-			counter -= target;
-		} else break;
+			head = (head+1)%BLOCKS;
+			nblocks--;
+		}
 	}
-	lastFrac = counter/(1.0/front().freq);
-	//lastFrac = 0;
+	lastFrac = (double)phase/PHASE_ONE;
 }
 
+//the state is saved the way it was when every sample was queued separately with its samplerate
 void xa_queue::freeze(EMUFILE* fp)
 {
 	fp->write32le((u32)0); //version
-	fp->writedouble(counter);
+	s32 freq = nblocks ? blocks[head]->freq : curr[3].freq;
+	fp->writedouble((double)phase/PHASE_ONE/freq);
 	fp->writedouble(lastFrac);
-	fp->write32le(curr.size());
-	for(size_t i=0;i<curr.size();i++)
+	fp->write32le((u32)4);
+	for(int i=0;i<4;i++)
 		curr[i].freeze(fp);
-	fp->write32le(size());
-	for(size_t i=0;i<size();i++)
-		operator[](i).freeze(fp);
+	fp->write32le((u32)size());
+	for(int i=0;i<nblocks;i++)
+	{
+		const xa_block& block = *blocks[(head+i)%BLOCKS];
+		for(int j=block.pos;j<block.count;j++)
+		{
+			xa_sample samp(block.samples[j*2],block.samples[j*2+1]);
+			samp.freq = block.freq;
+			samp.freeze(fp);
+		}
+	}
 }
 
 bool xa_queue::unfreeze(EMUFILE* fp)
@@ -129,24 +200,31 @@ bool xa_queue::unfreeze(EMUFILE* fp)
 	reconstruct(this);
 	u32 version;
 	fp->read32le(&version);
+	double counter;
 	fp->readdouble(&counter);
 	fp->readdouble(&lastFrac);
 	u32 temp;
 	fp->read32le(&temp);
-	curr.resize(0);
 	for(size_t i=0;i<temp;i++)
 	{
 		xa_sample samp;
 		samp.unfreeze(fp);
-		curr.push_back(samp);
+		//keep the last four
+		if(temp-i<=4) curr[4-(temp-i)] = samp;
 	}
 	fp->read32le(&temp);
+	xa_block* block = NULL;
 	for(size_t i=0;i<temp;i++)
 	{
 		xa_sample samp;
 		samp.unfreeze(fp);
-		push_back(samp);
+		if(!block || block->freq != samp.freq || block->count == xa_block::MAXSAMPLES)
+			block = push_block(samp.freq);
+		block->samples[block->count*2] = samp.left;
+		block->samples[block->count*2+1] = samp.right;
+		block->count++;
 	}
+	phase = (u32)(lastFrac*PHASE_ONE+0.5);
 	return true;
 }
 
@@ -157,6 +235,15 @@ void xa_queue::feed(xa_decode_t *xap)
 	enqueue(xap);
 }
 
+//cd audio comes through here too, already as interleaved stereo
+void xa_queue::feed(const s16* stereo, int nsamples, s32 freq)
+{
+	xa_block* block = push_block(freq);
+	int n = std::min<int>(nsamples,(int)xa_block::MAXSAMPLES);
+	memcpy(block->samples,stereo,n*2*sizeof(s16));
+	block->count = n;
+}
+
 void xa_queue::fetch(s32* left, s32* right)
 {
 	s16 samples[8];
@@ -28,7 +28,6 @@
 #define _XA_H_
 
 #include "PsxCommon.h"
-#include <deque>
 #include "emufile.h"
 struct xa_decode_t;
 
@@ -55,23 +54,54 @@ struct xa_sample
 	bool unfreeze(EMUFILE* fp);
 };
 
-class xa_queue : public std::deque<xa_sample>
+//a block of audio as it came from the cdrom: an xa sector, or a sector of cd audio
+struct xa_block
+{
+	static const int MAXSAMPLES = 4032; //a mono level C sector
+	s32 freq;
+	u32 step; //how far the phase moves through the block's samples per 44100hz tick
+	s32 count; //stereo samples in the block
+	s32 pos; //the next one to be played
+	s16 samples[MAXSAMPLES*2];
+};
+
+class xa_queue
 {
 public:
 	xa_queue();
+	xa_queue(const xa_queue& other);
+	xa_queue& operator=(const xa_queue& other);
+	~xa_queue();
 	void enqueue(xa_decode_t* xap);
 	void advance();
 	void freeze(EMUFILE* fp);
 	bool unfreeze(EMUFILE* fp);
 	void feed(xa_decode_t *xap);
+	void feed(const s16* stereo, int nsamples, s32 freq);
 	void fetch(s16* fourStereoSamples);
 	void fetch(s32* left, s32* right);
+	//the number of samples waiting to be played
+	size_t size() const;
+	//how many blocks were dropped because nothing played them before the queue filled
+	u32 dropped() const { return ndropped; }
 
 private:
-	double counter;
+	static const int BLOCKS = 32;
+	static const int PHASE_SHIFT = 16;
+	static const u32 PHASE_ONE = 1<<PHASE_SHIFT;
+
+	xa_block* push_block(s32 freq);
+	void copy(const xa_queue& other);
+
+	//the blocks are allocated when the ring first gets to them and kept after that;
+	//a copy of the queue only gets the ones with audio in them
+	xa_block* blocks[BLOCKS];
+	int head, nblocks; //the oldest block, and how many there are
+	u32 ndropped;
+	u32 phase; //16.16 position between curr[3] and the next sample
 	double lastFrac;
 
-	std::deque<xa_sample> curr;
+	xa_sample curr[4]; //the last four samples played, oldest first, for interpolation
 
 };
 
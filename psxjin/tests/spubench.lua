@@ -0,0 +1,44 @@
+-- Benchmarks the block SPU mixer against the reference mixer while a movie plays.
+-- Every few frames, a copy of the current SPU state is mixed by both mixers;
+-- their outputs must agree to within 1 LSB.
+-- Silently stepping the SPU (as the core is in dual sound mode) must also leave it
+-- in the same state as mixing it.
+
+out_filename = arg[1]
+out = io.open(out_filename, "a+")
+
+frames = 0 + (arg[2] or 3600)
+samples = 4410
+
+reference_time = 0
+block_time = 0
+worst = 0
+step_ok = true
+
+while movie.framecount() < frames do
+   if movie.framecount() % 10 == 0 then
+      ref, blk, diff = test.spubench(samples)
+      reference_time = reference_time + ref
+      block_time = block_time + blk
+      if diff > worst then worst = diff end
+      if not test.spustep(samples) then step_ok = false end
+   end
+   emu.frameadvance()
+end
+
+if worst <= 1 then
+   out:write("spu mixer benchmark passed")
+else
+   out:write("ERROR!  spu mixers differ by up to ", worst, " LSB")
+end
+out:write(string.format(" (reference %.3fs, block %.3fs)\n", reference_time, block_time))
+
+if step_ok then
+   out:write("spu silent stepping passed\n")
+else
+   out:write("ERROR!  silently stepping the spu leaves it in a different state than mixing\n")
+end
+
+out:close()
+
+emu.exitemulator()